@@ -10,7 +10,7 @@ FUNCTION(PREPEND var prefix)
     SET(${var} "${listVar}" PARENT_SCOPE)
 ENDFUNCTION(PREPEND)
 
-set(HSEG_SOURCE_FILES include/Image/Image.h include/helper/coordinate_helper.h include/helper/image_helper.h src/helper/image_helper.cpp include/helper/opencv_helper.h src/helper/opencv_helper.cpp src/Energy/EnergyFunction.cpp include/Energy/EnergyFunction.h include/Image/Coordinates.h src/Energy/Weights.cpp include/Energy/Weights.h include/helper/hash_helper.h src/Timer.cpp include/Timer.h src/Accuracy/ConfusionMatrix.cpp include/Accuracy/ConfusionMatrix.h include/Inference/InferenceIterator.h include/Inference/InferenceResult.h include/Inference/InferenceResultDetails.h src/Threading/ThreadPool.cpp include/Threading/ThreadPool.h include/typedefs.h src/Image/FeatureImage.cpp include/Image/FeatureImage.h include/Image/Feature.h src/Energy/LossAugmentedEnergyFunction.cpp include/Energy/LossAugmentedEnergyFunction.h include/Inference/Cluster.h include/helper/clustering_helper.h src/helper/clustering_helper.cpp include/Energy/IStepSizeRule.h src/Energy/DiminishingStepSizeRule.cpp include/Energy/DiminishingStepSizeRule.h src/Energy/AdamStepSizeRule.cpp include/Energy/AdamStepSizeRule.h)
+set(HSEG_SOURCE_FILES include/Image/Image.h include/helper/coordinate_helper.h include/helper/image_helper.h src/helper/image_helper.cpp include/helper/opencv_helper.h src/helper/opencv_helper.cpp src/Energy/EnergyFunction.cpp include/Energy/EnergyFunction.h include/Image/Coordinates.h src/Energy/Weights.cpp include/Energy/Weights.h include/helper/hash_helper.h src/Timer.cpp include/Timer.h src/Profiler.cpp include/Profiler.h src/PerfCounters.cpp include/PerfCounters.h src/MetricsLog.cpp include/MetricsLog.h src/Accuracy/ConfusionMatrix.cpp include/Accuracy/ConfusionMatrix.h include/Inference/InferenceIterator.h include/Inference/InferenceResult.h include/Inference/InferenceResultDetails.h src/Threading/ThreadPool.cpp include/Threading/ThreadPool.h include/Threading/BoundedQueue.h include/Threading/TaskGroup.h src/Threading/TaskGroup.cpp include/Threading/Parallel.h include/Threading/Topology.h src/Threading/Topology.cpp include/Threading/MemoryBudget.h src/Threading/MemoryBudget.cpp include/typedefs.h src/Image/FeatureImage.cpp include/Image/FeatureImage.h include/Image/Feature.h src/Energy/LossAugmentedEnergyFunction.cpp include/Energy/LossAugmentedEnergyFunction.h include/Inference/Cluster.h include/helper/clustering_helper.h src/helper/clustering_helper.cpp include/helper/schedule_helper.h src/helper/schedule_helper.cpp include/Energy/IStepSizeRule.h src/Energy/DiminishingStepSizeRule.cpp include/Energy/DiminishingStepSizeRule.h src/Energy/AdamStepSizeRule.cpp include/Energy/AdamStepSizeRule.h src/Energy/BCFWStepSizeRule.cpp include/Energy/BCFWStepSizeRule.h src/Energy/TrainingCheckpoint.cpp include/Energy/TrainingCheckpoint.h src/Energy/AsyncWeights.cpp include/Energy/AsyncWeights.h src/Energy/SparseWeights.cpp include/Energy/SparseWeights.h src/Energy/ConstraintCache.cpp include/Energy/ConstraintCache.h include/Inference/QuantizedClusterSearch.h src/Inference/QuantizedClusterSearch.cpp include/Inference/LatentStateStore.h src/Inference/LatentStateStore.cpp include/Inference/MemoryEstimator.h src/Inference/MemoryEstimator.cpp include/Dataset/DatasetCache.h src/Dataset/DatasetCache.cpp include/Network/Socket.h src/Network/Socket.cpp)
 set(HSEG_INCLUDE_DIRS ${HSEG_DIR}/include)
 set(HSEG_INCLUDE_SYS_DIRS ${trw_s_INCLUDE_DIRS} ${properties_INCLUDE_DIRS} ${Boost_INCLUDE_DIRS} ${OpenCV_INCLUDE_DIRS} ${EIGEN3_INCLUDE_DIR} ${PNG_INCLUDE_DIRS} ${MATIO_INCLUDE_DIRS} ${dense_crf_INCLUDE_DIRS})
 set(HSEG_LIBS trw_s densecrf properties ${OpenCV_LIBS} ${Boost_LIBRARIES} ${PNG_LIBRARIES} ${MATIO_LIBRARIES})
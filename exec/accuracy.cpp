@@ -8,24 +8,29 @@
 #include <Accuracy/ConfusionMatrix.h>
 #include <boost/filesystem/path.hpp>
 #include <Energy/LossAugmentedEnergyFunction.h>
+#include <Inference/InferenceIterator.h>
 
 PROPERTIES_DEFINE(Accuracy,
                   GROUP_DEFINE(dataset,
                                PROP_DEFINE_A(std::string, list, "", -l)
                                GROUP_DEFINE(path,
                                             PROP_DEFINE_A(std::string, gt, "", --gt)
+                                            PROP_DEFINE_A(std::string, imgCluster, "", --img_cluster)
                                )
                                GROUP_DEFINE(extension,
                                             PROP_DEFINE_A(std::string, gt, ".png", --gt_ext)
+                                            PROP_DEFINE_A(std::string, imgCluster, ".mat", --img_ext_cluster)
                                )
                                GROUP_DEFINE(constants,
                                             PROP_DEFINE_A(uint32_t, numClasses, 21, --numClasses)
                                             PROP_DEFINE_A(uint32_t, featDim, 512, --featDim)
+                                            PROP_DEFINE_A(uint32_t, featDimCluster, 512, --featDim_cluster)
                                )
                   )
                   GROUP_DEFINE(param,
                                PROP_DEFINE_A(std::string, weights, "", -w)
                                PROP_DEFINE_A(ClusterId, numClusters, 100, --numClusters)
+                               PROP_DEFINE_A(ClusterId, shortlist, 0, --shortlist)
                   )
                   GROUP_DEFINE(train,
                                PROP_DEFINE_A(float, C, 0.1, -C)
@@ -68,6 +73,64 @@ struct ImageAccuracyData
     float iouAccuracy = 0.f;
 };
 
+/**
+ * Gives access to the cluster affiliation step of the inference
+ */
+class AffiliationProbe : public InferenceIterator<EnergyFunction>
+{
+public:
+    using InferenceIterator<EnergyFunction>::InferenceIterator;
+    using InferenceIterator<EnergyFunction>::updateClusterAffiliation;
+};
+
+/**
+ * Compares the exhaustive cluster affiliation search with the quantized shortlist search
+ */
+struct ShortlistReport
+{
+    size_t agreeingSites = 0;
+    size_t sites = 0;
+    Timer exactTimer;
+    Timer shortlistTimer;
+
+    bool compare(std::string const& featFilename, Weights const& weights, LabelImage const& pred,
+                 std::vector<Cluster> const& clusters, ClusterId shortlist)
+    {
+        FeatureImage features;
+        if(!features.read(featFilename))
+            return false;
+        if(features.width() != pred.width() || features.height() != pred.height())
+            features.rescale(pred.width(), pred.height(), true);
+
+        EnergyFunction energy(&weights, clusters.size(), false);
+        AffiliationProbe exact(&energy, &features, &features, 0, 0, 0);
+        AffiliationProbe approx(&energy, &features, &features, 0, 0, shortlist);
+
+        LabelImage exactClustering(pred.width(), pred.height());
+        LabelImage approxClustering(pred.width(), pred.height());
+        exactTimer.start();
+        exact.updateClusterAffiliation(exactClustering, pred, clusters);
+        exactTimer.pause();
+        shortlistTimer.start();
+        approx.updateClusterAffiliation(approxClustering, pred, clusters);
+        shortlistTimer.pause();
+
+        for(SiteId i = 0; i < pred.pixels(); ++i)
+            if(exactClustering.atSite(i) == approxClustering.atSite(i))
+                agreeingSites++;
+        sites += pred.pixels();
+        return true;
+    }
+
+    template<typename Stream>
+    void print(Stream& out, ClusterId shortlist) const
+    {
+        out << "Shortlist (" << shortlist << " candidates) agreement: "
+            << (100.f * agreeingSites) / sites << " % (" << agreeingSites << "/" << sites << ")" << std::endl;
+        out << "Shortlist time: " << shortlistTimer.elapsed() << " vs. exhaustive " << exactTimer.elapsed() << std::endl;
+    }
+};
+
 int main(int argc, char** argv)
 {
     // Read properties
@@ -96,6 +159,17 @@ int main(int argc, char** argv)
 
     std::vector<ImageAccuracyData> imageAccData;
 
+    // The shortlist report needs the weights and cluster features the clustering has been computed with
+    bool const reportShortlist = properties.param.shortlist > 0 && !properties.dataset.path.imgCluster.empty();
+    Weights weights(properties.dataset.constants.numClasses, properties.dataset.constants.featDim,
+                    properties.dataset.constants.featDimCluster);
+    if(reportShortlist && !weights.read(properties.param.weights))
+    {
+        std::cerr << "Couldn't read weights from \"" << properties.param.weights << "\"" << std::endl;
+        return ERR_CANT_READ_WEIGHTS;
+    }
+    ShortlistReport shortlistReport;
+
     for(auto const& f : fileNames)
     {
         std::string const& predFilename = properties.inDir + f + properties.dataset.extension.gt;
@@ -136,6 +210,16 @@ int main(int argc, char** argv)
             return ERR_CLUSTERING_LOAD;
         }
 
+        if(reportShortlist && !clusters.empty())
+        {
+            std::string const& featFilename = properties.dataset.path.imgCluster + f + properties.dataset.extension.imgCluster;
+            if(!shortlistReport.compare(featFilename, weights, pred, clusters, properties.param.shortlist))
+            {
+                std::cerr << "Couldn't load cluster features from \"" << featFilename << "\"" << std::endl;
+                return ERR_IMAGE_LOAD;
+            }
+        }
+
         accuracy.join(pred, gt);
 
         size_t imgRawPxCorrect = 0;
@@ -180,12 +264,19 @@ int main(int argc, char** argv)
     std::cout << "Raw px percentage: " << (100.f * rawPxCorrect) / rawPixelCount << " % (" << rawPxCorrect << "/"
               << rawPixelCount << ")" << std::endl;
     std::cout << "Mean px percentage: " << (100.f * meanCorrectPercentage) / fileNames.size() << " %" << std::endl;
+    if(reportShortlist)
+        shortlistReport.print(std::cout, properties.param.shortlist);
     std::ofstream out(properties.outDir + fileListName + "_accuracy.txt");
     if(out.is_open())
     {
         out << properties << std::endl << std::endl;
         out << accuracy << std::endl;
         out << "Loss: " << loss << std::endl << std::endl;
+        if(reportShortlist)
+        {
+            shortlistReport.print(out, properties.param.shortlist);
+            out << std::endl;
+        }
 
 //        std::sort(imageAccData.begin(), imageAccData.end(),
 //                  [](ImageAccuracyData const& a, ImageAccuracyData const& b) { return a.rawAccuracy > b.rawAccuracy; });
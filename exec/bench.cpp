@@ -0,0 +1,342 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#include <BaseProperties.h>
+#include <Energy/Weights.h>
+#include <Energy/EnergyFunction.h>
+#include <helper/image_helper.h>
+#include <Inference/InferenceIterator.h>
+#include <boost/filesystem/operations.hpp>
+#include <Timer.h>
+
+PROPERTIES_DEFINE(Bench,
+                  GROUP_DEFINE(size,
+                               PROP_DEFINE_A(Coord, width, 500, --width)
+                               PROP_DEFINE_A(Coord, height, 375, --height)
+                               PROP_DEFINE_A(uint32_t, featDim, 512, --featDim)
+                               PROP_DEFINE_A(uint32_t, featDimCluster, 512, --featDim_cluster)
+                               PROP_DEFINE_A(uint32_t, numClasses, 21, --numClasses)
+                               PROP_DEFINE_A(ClusterId, numClusters, 100, --numClusters)
+                  )
+                  GROUP_DEFINE(param,
+                               PROP_DEFINE_A(bool, usePairwise, true, --usePairwise)
+                               PROP_DEFINE_A(ClusterId, shortlist, 0, --shortlist)
+                  )
+                  PROP_DEFINE_A(uint32_t, repetitions, 5, --repetitions)
+                  PROP_DEFINE_A(uint32_t, seed, 0, --seed)
+                  PROP_DEFINE_A(uint32_t, numThreads, 4, --numThreads)
+                  PROP_DEFINE_A(std::string, tmpDir, "/tmp/", --tmp)
+                  PROP_DEFINE_A(std::string, out, "bench.json", -o)
+)
+
+enum EXIT_CODE
+{
+    SUCCESS = 0,
+    CANT_WRITE_RESULT,
+};
+
+/**
+ * Gives access to the single phases of the inference
+ */
+class InferenceProbe : public InferenceIterator<EnergyFunction>
+{
+public:
+    using InferenceIterator<EnergyFunction>::InferenceIterator;
+    using InferenceIterator<EnergyFunction>::updateClusterAffiliation;
+    using InferenceIterator<EnergyFunction>::updateLabels;
+    using InferenceIterator<EnergyFunction>::updateClusterFeatures;
+    using InferenceIterator<EnergyFunction>::initialize;
+    using InferenceIterator<EnergyFunction>::updateLabelsOnGroundTruth;
+};
+
+struct Measurement
+{
+    std::string name;
+    std::vector<double> ms; //< Time of every repetition in milliseconds
+};
+
+/**
+ * Runs \p fun once to warm up and then times \p repetitions further runs
+ */
+template<typename Fun>
+Measurement measure(std::string const& name, uint32_t repetitions, Fun&& fun)
+{
+    Measurement m;
+    m.name = name;
+    fun();
+    for(uint32_t r = 0; r < repetitions; ++r)
+    {
+        Timer t(true);
+        fun();
+        m.ms.push_back(t.elapsed<Timer::nanoseconds>().count() / 1e6);
+    }
+    std::cout << std::setw(40) << std::left << name << std::right << " "
+              << std::accumulate(m.ms.begin(), m.ms.end(), 0.) / std::max<size_t>(m.ms.size(), 1) << " ms" << std::endl;
+    return m;
+}
+
+void writeJson(std::ostream& out, BenchProperties const& properties, std::vector<Measurement> const& results)
+{
+    out << "{" << std::endl;
+    out << "  \"config\": {" << std::endl;
+    out << "    \"width\": " << properties.size.width << "," << std::endl;
+    out << "    \"height\": " << properties.size.height << "," << std::endl;
+    out << "    \"featDim\": " << properties.size.featDim << "," << std::endl;
+    out << "    \"featDimCluster\": " << properties.size.featDimCluster << "," << std::endl;
+    out << "    \"numClasses\": " << properties.size.numClasses << "," << std::endl;
+    out << "    \"numClusters\": " << properties.size.numClusters << "," << std::endl;
+    out << "    \"usePairwise\": " << (properties.param.usePairwise ? "true" : "false") << "," << std::endl;
+    out << "    \"shortlist\": " << properties.param.shortlist << "," << std::endl;
+    out << "    \"numThreads\": " << properties.numThreads << "," << std::endl;
+    out << "    \"repetitions\": " << properties.repetitions << "," << std::endl;
+    out << "    \"seed\": " << properties.seed << std::endl;
+    out << "  }," << std::endl;
+    out << "  \"results\": [" << std::endl;
+    for(size_t i = 0; i < results.size(); ++i)
+    {
+        auto const& ms = results[i].ms;
+        double const total = std::accumulate(ms.begin(), ms.end(), 0.);
+        out << "    {\"name\": \"" << results[i].name << "\""
+            << ", \"repetitions\": " << ms.size()
+            << ", \"mean_ms\": " << (ms.empty() ? 0. : total / ms.size())
+            << ", \"min_ms\": " << (ms.empty() ? 0. : *std::min_element(ms.begin(), ms.end()))
+            << ", \"max_ms\": " << (ms.empty() ? 0. : *std::max_element(ms.begin(), ms.end()))
+            << ", \"ms\": [";
+        for(size_t r = 0; r < ms.size(); ++r)
+            out << (r > 0 ? ", " : "") << ms[r];
+        out << "]}" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    out << "  ]" << std::endl;
+    out << "}" << std::endl;
+}
+
+int main(int argc, char** argv)
+{
+    // Read properties
+    BenchProperties properties;
+    properties.read("properties/hseg_bench.info");
+    properties.fromCmd(argc, argv);
+    std::cout << "----------------------------------------------------------------" << std::endl;
+    std::cout << "Used properties: " << std::endl;
+    std::cout << properties << std::endl;
+    std::cout << "----------------------------------------------------------------" << std::endl;
+
+    Coord const width = properties.size.width;
+    Coord const height = properties.size.height;
+    Label const numClasses = properties.size.numClasses;
+    ClusterId const numClusters = properties.size.numClusters;
+    uint32_t const reps = properties.repetitions;
+    SiteId const numPx = width * height;
+
+    // Generate synthetic data
+    std::default_random_engine generator(properties.seed);
+    std::uniform_real_distribution<float> featDist(0.f, 1.f);
+    std::uniform_int_distribution<Label> labelDist(0, numClasses - 1);
+    std::uniform_int_distribution<ClusterId> clusterDist(0, std::max(numClusters, 1u) - 1);
+    std::uniform_int_distribution<SiteId> siteDist(0, numPx - 1);
+
+    FeatureImage pxFeat(width, height, properties.size.featDim);
+    FeatureImage clusterFeat(width, height, properties.size.featDimCluster);
+    LabelImage labeling(width, height);
+    LabelImage clustering(width, height);
+    for(SiteId i = 0; i < numPx; ++i)
+    {
+        for(uint32_t c = 0; c < pxFeat.dim(); ++c)
+            pxFeat.atSite(i)(c) = featDist(generator);
+        for(uint32_t c = 0; c < clusterFeat.dim(); ++c)
+            clusterFeat.atSite(i)(c) = featDist(generator);
+        labeling.atSite(i) = labelDist(generator);
+        clustering.atSite(i) = numClusters > 0 ? clusterDist(generator) : 0;
+    }
+    std::vector<Cluster> clusters(numClusters);
+    for(auto& c : clusters)
+    {
+        c.m_feature = clusterFeat.atSite(siteDist(generator));
+        c.m_label = labelDist(generator);
+    }
+
+    std::srand(properties.seed);
+    Weights weights(numClasses, pxFeat.dim(), clusterFeat.dim());
+    weights.randomize();
+    weights.clampToFeasible();
+
+    EnergyFunction energy(&weights, numClusters, properties.param.usePairwise);
+    InferenceProbe inference(&energy, &pxFeat, &clusterFeat, 0, 0, properties.param.shortlist);
+
+    std::vector<Measurement> results;
+    volatile Cost sink = 0;
+
+    // Cost kernels
+    results.push_back(measure("EnergyFunction::unaryCost", reps, [&]
+    {
+        Cost sum = 0;
+        for(SiteId i = 0; i < numPx; ++i)
+            for(Label l = 0; l < numClasses; ++l)
+                sum += energy.unaryCost(i, pxFeat.atSite(i), l);
+        sink = sum;
+    }));
+    results.push_back(measure("EnergyFunction::pairwiseCost", reps, [&]
+    {
+        Cost sum = 0;
+        for(SiteId i = 0; i + 1 < numPx; ++i)
+            for(Label l1 = 0; l1 < numClasses; ++l1)
+                for(Label l2 = 0; l2 < numClasses; ++l2)
+                    sum += energy.pairwiseCost(pxFeat.atSite(i), pxFeat.atSite(i + 1), l1, l2);
+        sink = sum;
+    }));
+    if(numClusters > 0)
+    {
+        results.push_back(measure("EnergyFunction::higherOrderCost", reps, [&]
+        {
+            Cost sum = 0;
+            for(SiteId i = 0; i < numPx; ++i)
+                for(ClusterId k = 0; k < numClusters; ++k)
+                    sum += energy.higherOrderCost(clusterFeat.atSite(i), clusters[k].m_feature, labeling.atSite(i), clusters[k].m_label);
+            sink = sum;
+        }));
+        results.push_back(measure("EnergyFunction::featureCost", reps, [&]
+        {
+            Cost sum = 0;
+            for(SiteId i = 0; i < numPx; ++i)
+                for(ClusterId k = 0; k < numClusters; ++k)
+                    sum += energy.featureCost(clusterFeat.atSite(i), clusters[k].m_feature, labeling.atSite(i), clusters[k].m_label);
+            sink = sum;
+        }));
+    }
+
+    // Energy and gradient
+    results.push_back(measure("EnergyFunction::giveEnergyByWeight", reps, [&]
+    {
+        sink = energy.giveEnergyByWeight(pxFeat, clusterFeat, labeling, clustering, clusters).sum();
+    }));
+    results.push_back(measure("EnergyFunction::giveEnergyByWeight[threads]", reps, [&]
+    {
+        sink = energy.giveEnergyByWeight(pxFeat, clusterFeat, labeling, clustering, clusters, nullptr, properties.numThreads).sum();
+    }));
+    if(numClusters > 0 && pxFeat.dim() == clusterFeat.dim())
+    {
+        FeatureImage gradient(width, height, pxFeat.dim());
+        results.push_back(measure("EnergyFunction::computeFeatureGradient", reps, [&]
+        {
+            energy.computeFeatureGradient(gradient, labeling, clustering, clusters, clusterFeat, properties.numThreads);
+            sink = gradient.atSite(0)(0);
+        }));
+        Eigen::MatrixXf gradientMat;
+        results.push_back(measure("EnergyFunction::computeFeatureGradient[grouped]", reps, [&]
+        {
+            energy.computeFeatureGradient(gradientMat, labeling, clustering, clusters, clusterFeat, properties.numThreads);
+            sink = gradientMat(0, 0);
+        }));
+    }
+
+    // Inference phases
+    results.push_back(measure("InferenceIterator::initialize", reps, [&]
+    {
+        LabelImage l, c;
+        std::vector<Cluster> k;
+        inference.initialize(l, c, k);
+    }));
+    if(numClusters > 0)
+    {
+        results.push_back(measure("InferenceIterator::updateClusterAffiliation", reps, [&]
+        {
+            LabelImage c(width, height);
+            inference.updateClusterAffiliation(c, labeling, clusters);
+        }));
+        results.push_back(measure("InferenceIterator::updateClusterFeatures", reps, [&]
+        {
+            std::vector<Cluster> k = clusters;
+            inference.updateClusterFeatures(k, labeling, clustering);
+        }));
+        results.push_back(measure("InferenceIterator::updateLabelsOnGroundTruth", reps, [&]
+        {
+            std::vector<Cluster> k = clusters;
+            inference.updateLabelsOnGroundTruth(labeling, k, clustering);
+        }));
+    }
+    results.push_back(measure("InferenceIterator::updateLabels", reps, [&]
+    {
+        LabelImage l(width, height);
+        std::vector<Cluster> k = clusters;
+        inference.updateLabels(l, k, clustering);
+    }));
+
+    // TRW-S on its own, on a grid with random potentials of the same size
+    results.push_back(measure("MRFEnergy::Minimize_TRW_S", reps, [&]
+    {
+        std::default_random_engine gen(properties.seed);
+        TypeGeneral::GlobalSize globalSize;
+        MRFEnergy<TypeGeneral> mrfEnergy(globalSize);
+        std::vector<MRFEnergy<TypeGeneral>::NodeId> nodeIds;
+        nodeIds.reserve(numPx);
+        std::vector<TypeGeneral::REAL> unary(numClasses);
+        for(SiteId i = 0; i < numPx; ++i)
+        {
+            std::generate(unary.begin(), unary.end(), [&] { return featDist(gen); });
+            nodeIds.push_back(mrfEnergy.AddNode(TypeGeneral::LocalSize(numClasses), TypeGeneral::NodeData(unary.data())));
+        }
+        std::vector<TypeGeneral::REAL> costMat(numClasses * numClasses);
+        for(SiteId i = 0; i < numPx; ++i)
+        {
+            auto coords = helper::coord::siteTo2DCoordinate(i, width);
+            std::generate(costMat.begin(), costMat.end(), [&] { return featDist(gen); });
+            if(coords.x() + 1 < width)
+                mrfEnergy.AddEdge(nodeIds[i], nodeIds[i + 1], TypeGeneral::EdgeData(TypeGeneral::GENERAL, costMat.data()));
+            if(coords.y() + 1 < height)
+                mrfEnergy.AddEdge(nodeIds[i], nodeIds[i + width], TypeGeneral::EdgeData(TypeGeneral::GENERAL, costMat.data()));
+        }
+        MRFEnergy<TypeGeneral>::Options options;
+        options.m_eps = 0.01f;
+        options.m_printMinIter = std::numeric_limits<int>::max();
+        MRFEnergy<TypeGeneral>::REAL lowerBound = 0, e = 0;
+        mrfEnergy.Minimize_TRW_S(options, lowerBound, e);
+        sink = e;
+    }));
+
+    // I/O
+    std::string const featFilename = properties.tmpDir + "hseg_bench_features.mat";
+    std::string const pngFilename = properties.tmpDir + "hseg_bench_labeling.png";
+    if(pxFeat.write(featFilename))
+    {
+        results.push_back(measure("FeatureImage::read", reps, [&]
+        {
+            FeatureImage f;
+            f.read(featFilename);
+        }));
+        results.push_back(measure("FeatureImage::read[half]", reps, [&]
+        {
+            FeatureImage f;
+            f.read(featFilename, FeatureImage::Precision::Half);
+        }));
+        boost::filesystem::remove(featFilename);
+    }
+    else
+        std::cerr << "Couldn't write temporary features to \"" << featFilename << "\". Skipping read benchmark." << std::endl;
+    results.push_back(measure("FeatureImage::rescale", reps, [&]
+    {
+        FeatureImage f = pxFeat;
+        f.rescale(0.5f, true);
+    }));
+    helper::image::ColorMap const cmap = helper::image::generateColorMapVOC(256ul);
+    results.push_back(measure("helper::image::writePalettePNG", reps, [&]
+    {
+        helper::image::writePalettePNG(pngFilename, labeling, cmap);
+    }));
+    results.push_back(measure("helper::image::readPalettePNG", reps, [&]
+    {
+        LabelImage l;
+        helper::image::readPalettePNG(pngFilename, l, nullptr);
+    }));
+    boost::filesystem::remove(pngFilename);
+
+    std::ofstream out(properties.out);
+    if(!out.is_open())
+    {
+        std::cerr << "Couldn't write results to \"" << properties.out << "\"" << std::endl;
+        return CANT_WRITE_RESULT;
+    }
+    writeJson(out, properties, results);
+
+    return SUCCESS;
+}
@@ -6,9 +6,17 @@
 #include <Energy/Weights.h>
 #include <helper/image_helper.h>
 #include <helper/clustering_helper.h>
+#include <helper/schedule_helper.h>
 #include <Inference/InferenceIterator.h>
 #include <boost/filesystem/operations.hpp>
 #include <Threading/ThreadPool.h>
+#include <Threading/Topology.h>
+#include <Threading/BoundedQueue.h>
+#include <Threading/MemoryBudget.h>
+#include <Inference/MemoryEstimator.h>
+#include <MetricsLog.h>
+#include <Timer.h>
+#include <atomic>
 
 PROPERTIES_DEFINE(InferenceBatch,
                   GROUP_DEFINE(datasetPx,
@@ -47,46 +55,75 @@ PROPERTIES_DEFINE(InferenceBatch,
                           PROP_DEFINE_A(bool, usePairwise, true, --usePairwise)
                           PROP_DEFINE_A(float, eps, 0, --eps)
                           PROP_DEFINE_A(float, maxIter, 50, --max_iter)
+                          PROP_DEFINE_A(ClusterId, shortlist, 0, --shortlist)
                   )
                   PROP_DEFINE_A(bool, scaleToRgb, false, --scale_to_rgb)
                   PROP_DEFINE_A(float, scaleFactor, 1.f, --scaleFactor)
                   PROP_DEFINE_A(std::string, outDir, "", --out)
                   PROP_DEFINE_A(uint16_t, numThreads, 4, --numThreads)
+                  PROP_DEFINE_A(uint16_t, numLoaderThreads, 1, --numLoaderThreads)
+                  PROP_DEFINE_A(uint16_t, numWriterThreads, 1, --numWriterThreads)
+                  PROP_DEFINE_A(size_t, prefetch, 8, --prefetch)
+                  PROP_DEFINE_A(std::string, featurePrecision, "single", --featurePrecision)
+                  PROP_DEFINE_A(bool, numa, false, --numa)
+                  PROP_DEFINE_A(std::string, metrics, "", --metrics)
+                  PROP_DEFINE_A(float, progressEvery, 30, --progressEvery)
+                  PROP_DEFINE_A(size_t, memoryBudgetMB, 0, --memoryBudgetMB)
+                  PROP_DEFINE_A(bool, largestFirst, true, --largestFirst)
 )
 
 enum EXIT_CODE
 {
     SUCCESS = 0,
     FILE_LIST_EMPTY,
+    INVALID_FEATURE_PRECISION,
+    CANT_OPEN_METRICS,
+    INVALID_PIPELINE_SIZE,
 };
 
-struct Result
+/**
+ * A sample that has been read from disk and is ready for inference
+ */
+struct LoadedSample
 {
-    bool okay = false;
     std::string filename;
+    FeatureImage featuresPx;
+    FeatureImage featuresCluster;
+    float loadMs = 0;
+    std::shared_ptr<MemoryBudget::Reservation> pReservation; //< Memory of the sample until it has been written
+};
+
+/**
+ * Inference result that is ready to be written to disk
+ */
+struct InferredSample
+{
+    std::string filename;
+    InferenceResult result;
+    float loadMs = 0;
+    float inferMs = 0;
+    int worker = -1; //< Index of the inference thread
+    std::shared_ptr<MemoryBudget::Reservation> pReservation;
 };
 
-Result process(std::string const& imageFilename, std::string imageClusterFilename, std::string const& rgbFileName, Weights const& weights, std::string const& spOutPath,
-               std::string const& labelOutPath, std::string const& margOutPath, helper::image::ColorMap const& cmap,
-               ClusterId numClusters, float eps, uint32_t maxIter, bool scaleToRgb, bool usePairwise, float scaleFactor)
+bool load(std::string const& imageFilename, std::string const& imageClusterFilename, std::string const& rgbFileName,
+          bool scaleToRgb, float scaleFactor, FeatureImage::Precision featurePrecision, LoadedSample& outSample)
 {
-    std::string filename = boost::filesystem::path(imageFilename).stem().string();
-    Result res;
-    res.filename = filename;
+    outSample.filename = boost::filesystem::path(imageFilename).stem().string();
 
     // Load image
-    FeatureImage featuresPx;
-    if(!featuresPx.read(imageFilename))
+    FeatureImage& featuresPx = outSample.featuresPx;
+    if(!featuresPx.read(imageFilename, featurePrecision))
     {
         std::cerr << "Unable to read features from \"" << imageFilename << "\"" << std::endl;
-        return res;
+        return false;
     }
     featuresPx.rescale(scaleFactor);
-    FeatureImage featuresCluster;
-    if(!featuresCluster.read(imageClusterFilename))
+    FeatureImage& featuresCluster = outSample.featuresCluster;
+    if(!featuresCluster.read(imageClusterFilename, featurePrecision))
     {
         std::cerr << "Unable to read features from \"" << imageClusterFilename << "\"" << std::endl;
-        return res;
+        return false;
     }
     featuresCluster.rescale(scaleFactor);
     if(featuresCluster.width() != featuresPx.width() || featuresCluster.height() != featuresPx.height())
@@ -99,7 +136,7 @@ Result process(std::string const& imageFilename, std::string imageClusterFilenam
             std::cerr << "Cluster and pixel feature map size don't match up: "
                       << "(" << featuresCluster.width() << "," << featuresCluster.height() << ") vs. "
                       << "(" << featuresPx.width() << "," << featuresPx.height() << ")." << std::endl;
-            return res;
+            return false;
         }
     }
 
@@ -110,7 +147,7 @@ Result process(std::string const& imageFilename, std::string imageClusterFilenam
         if(!rgb.read(rgbFileName))
         {
             std::cerr << "Couldn't load rgb image \"" << rgbFileName << "\"." << std::endl;
-            return res;
+            return false;
         }
         uint32_t width = rgb.width();
         uint32_t height = rgb.height();
@@ -119,30 +156,34 @@ Result process(std::string const& imageFilename, std::string imageClusterFilenam
         featuresCluster.rescale(width, height, true);
     }
 
+    return true;
+}
+
+InferenceResult infer(LoadedSample const& sample, WeightsSnapshot const& pWeights, ClusterId numClusters, float eps,
+                      uint32_t maxIter, bool usePairwise, ClusterId shortlist)
+{
     // Create energy function
-    EnergyFunction energyFun(&weights, numClusters, usePairwise);
+    EnergyFunction energyFun(pWeights.get(), numClusters, usePairwise);
 
     // Do the inference!
-    InferenceIterator<EnergyFunction> inference(&energyFun, &featuresPx, &featuresCluster, eps, maxIter);
-    auto result = inference.run();
+    InferenceIterator<EnergyFunction> inference(&energyFun, &sample.featuresPx, &sample.featuresCluster, eps, maxIter, shortlist);
+    return inference.run();
+}
 
+void write(InferredSample const& sample, std::string const& spOutPath, std::string const& labelOutPath,
+           helper::image::ColorMap const& cmap, ClusterId numClusters)
+{
     // Write results to disk
     boost::filesystem::path spPath(spOutPath);
     boost::filesystem::create_directories(spPath);
     boost::filesystem::path labelPath(labelOutPath);
     boost::filesystem::create_directories(labelPath);
-//    boost::filesystem::path margPath(margOutPath);
-//    boost::filesystem::create_directories(margPath);
-    helper::image::writePalettePNG(labelPath.string() + filename + ".png", result.labeling, cmap);
+    helper::image::writePalettePNG(labelPath.string() + sample.filename + ".png", sample.result.labeling, cmap);
     if(numClusters > 0)
     {
-        helper::image::writePalettePNG(spPath.string() + filename + ".png", result.clustering, cmap);
-        helper::clustering::write(spPath.string() + filename + ".dat", result.clustering, result.clusters);
+        helper::image::writePalettePNG(spPath.string() + sample.filename + ".png", sample.result.clustering, cmap);
+        helper::clustering::write(spPath.string() + sample.filename + ".dat", sample.result.clustering, sample.result.clusters);
     }
-//    result.marginals.write(margPath.string() + filename + ".mat");
-
-    res.okay = true;
-    return res;
 }
 
 std::vector<std::string> readFileNames(std::string const& listFile)
@@ -177,7 +218,24 @@ int main(int argc, char** argv)
         weights.randomize();
     }
 
-    helper::image::ColorMap const cmap = helper::image::generateColorMapVOC(256ul);
+    FeatureImage::Precision featurePrecision;
+    if(!FeatureImage::parsePrecision(properties.featurePrecision, featurePrecision))
+    {
+        std::cerr << "Invalid feature precision \"" << properties.featurePrecision << "\"" << std::endl;
+        return INVALID_FEATURE_PRECISION;
+    }
+
+    // Any of these being 0 would stall the pipeline forever
+    if(properties.numThreads == 0 || properties.numLoaderThreads == 0 || properties.numWriterThreads == 0 ||
+       properties.prefetch == 0)
+    {
+        std::cerr << "numThreads, numLoaderThreads, numWriterThreads and prefetch have to be at least 1" << std::endl;
+        return INVALID_PIPELINE_SIZE;
+    }
+
+    // Jobs only get handles to these, so they aren't copied for every image
+    WeightsSnapshot const pWeights = weights.snapshot();
+    auto const pCmap = std::make_shared<helper::image::ColorMap const>(helper::image::generateColorMapVOC(256ul));
 
     // Read in file names to process
     auto filenames = readFileNames(properties.datasetPx.list);
@@ -203,45 +261,185 @@ int main(int argc, char** argv)
         boost::filesystem::remove_all(marginalsPath);
     }
 
-    ThreadPool pool(properties.numThreads);
-    std::deque<std::future<Result>> futures;
-
-    // Iterate all files
+    // Find out which files still have to be done
+    std::vector<std::string> todo;
     for(auto const& f : filenames)
     {
-        std::string const& imageFilename = properties.datasetPx.path.img + f + properties.datasetPx.extension.img;
-        std::string const& imageClusterFilename = properties.datasetCluster.path.img + f + properties.datasetCluster.extension.img;
-        std::string const& rgbFilename = properties.datasetPx.path.rgb + f + properties.datasetPx.extension.rgb;
+        std::string const imageFilename = properties.datasetPx.path.img + f + properties.datasetPx.extension.img;
         std::string filename = boost::filesystem::path(imageFilename).stem().string();
         if(boost::filesystem::exists(spPath / (filename + ".dat")) && boost::filesystem::exists(labelPath / (filename + ".png")))
         {
             std::cout << "Skipping " << f << "." << std::endl;
             continue;
         }
-        auto&& fut = pool.enqueue(process, imageFilename, imageClusterFilename, rgbFilename, weights, spPath.string(), labelPath.string(), marginalsPath.string(), cmap, properties.param.numClusters, properties.param.eps, properties.param.maxIter, properties.scaleToRgb, properties.param.usePairwise, properties.scaleFactor);
-        futures.push_back(std::move(fut));
+        todo.push_back(f);
+    }
 
-        // Wait for some threads to finish if the queue gets too long
-        while(pool.queued() > properties.numThreads)
+    // Large images are started first, so none of them is left over while the other workers are idle already. Their
+    // size is read from the variable header, thus this doesn't cost a full read.
+    if(properties.largestFirst)
+    {
+        std::vector<size_t> costs(todo.size(), 0);
+        size_t numUnknown = 0;
+        for(size_t i = 0; i < todo.size(); ++i)
         {
-            Result res = futures.front().get();
-            if(!res.okay)
-                std::cerr << "Couldn't process image \"" + res.filename + "\"" << std::endl;
+            std::string const imageFilename = properties.datasetPx.path.img + todo[i] + properties.datasetPx.extension.img;
+            Coord width, height, dim;
+            if(FeatureImage::readDimensions(imageFilename, width, height, dim))
+                costs[i] = static_cast<size_t>(width) * height;
             else
-                std::cout << "Done with \"" + res.filename + "\"" << std::endl;
-            futures.pop_front();
+                numUnknown++;
         }
+        if(numUnknown > 0)
+            std::cerr << "Couldn't read the size of " << numUnknown << " images, they are processed last." << std::endl;
+
+        std::vector<std::string> scheduled;
+        scheduled.reserve(todo.size());
+        for(size_t i : helper::schedule::largestFirst(costs))
+            scheduled.push_back(std::move(todo[i]));
+        todo = std::move(scheduled);
     }
 
-    // Wait for remaining threads to finish
-    for(size_t i = 0; i < futures.size(); ++i)
+    MetricsLog metrics(properties.metrics, todo.size(), properties.progressEvery);
+    if(!metrics.good())
     {
-        Result res = futures[i].get();
-        if(!res.okay)
-            std::cerr << "Couldn't process image \"" + res.filename + "\"" << std::endl;
-        else
-            std::cout << "Done with \"" + res.filename + "\"" << std::endl;
+        std::cerr << "Couldn't open metrics file \"" << properties.metrics << "\"" << std::endl;
+        return CANT_OPEN_METRICS;
     }
 
+    // A sample is only handed on if its estimated memory fits into the budget. This throttles the loaders, thus there
+    // are at most numLoaderThreads samples in memory beyond the budget.
+    MemoryBudget memoryBudget(properties.memoryBudgetMB * 1024 * 1024);
+    MemoryEstimator const memoryEstimator(properties.datasetPx.constants.featDim,
+                                          properties.datasetCluster.constants.featDim,
+                                          properties.datasetPx.constants.numClasses, properties.param.numClusters,
+                                          properties.param.shortlist, properties.param.usePairwise,
+                                          featurePrecision);
+
+    // Loaders fill the prefetch queue, inference workers take samples from it and hand the results to the writers
+    BoundedQueue<std::shared_ptr<LoadedSample>> loaded(properties.prefetch);
+    BoundedQueue<std::shared_ptr<InferredSample>> inferred(properties.prefetch);
+    std::atomic<size_t> nextFile{0};
+
+    auto loadStage = [&]()
+    {
+        for(size_t i = nextFile++; i < todo.size(); i = nextFile++)
+        {
+            std::string const& f = todo[i];
+            std::string const imageFilename = properties.datasetPx.path.img + f + properties.datasetPx.extension.img;
+            std::string const imageClusterFilename = properties.datasetCluster.path.img + f + properties.datasetCluster.extension.img;
+            std::string const rgbFilename = properties.datasetPx.path.rgb + f + properties.datasetPx.extension.rgb;
+            auto pSample = std::make_shared<LoadedSample>();
+            Timer timer(true);
+            bool success;
+            try
+            {
+                success = load(imageFilename, imageClusterFilename, rgbFilename, properties.scaleToRgb,
+                               properties.scaleFactor, featurePrecision, *pSample);
+            }
+            catch(std::exception const& e)
+            {
+                std::cerr << e.what() << std::endl;
+                success = false;
+            }
+            if(!success)
+            {
+                std::cerr << "Couldn't process image \"" + f + "\"" << std::endl;
+                MetricsLog::Record record("error");
+                metrics.write(record.set("filename", f).set("stage", "load"));
+                metrics.itemDone();
+                continue;
+            }
+            pSample->loadMs = timer.elapsed<Timer::microseconds>().count() / 1e3f;
+            size_t const bytes = memoryEstimator.estimate(pSample->featuresPx.width(), pSample->featuresPx.height());
+            pSample->pReservation = std::make_shared<MemoryBudget::Reservation>(memoryBudget.acquire(bytes));
+            if(!loaded.push(std::move(pSample)))
+                break;
+        }
+    };
+    auto inferStage = [&]()
+    {
+        std::shared_ptr<LoadedSample> pSample;
+        while(loaded.pop(pSample))
+        {
+            // The sample has been loaded on another thread, copy it to the node of this one
+            if(properties.numa)
+            {
+                pSample = Topology::localCopy(*pSample);
+                pSample->featuresPx.detach();
+                pSample->featuresCluster.detach();
+            }
+            auto pInferred = std::make_shared<InferredSample>();
+            pInferred->filename = pSample->filename;
+            pInferred->loadMs = pSample->loadMs;
+            pInferred->pReservation = pSample->pReservation;
+            pInferred->worker = ThreadPool::currentIndex();
+            Timer timer(true);
+            pInferred->result = infer(*pSample, pWeights, properties.param.numClusters, properties.param.eps,
+                                      properties.param.maxIter, properties.param.usePairwise, properties.param.shortlist);
+            pInferred->inferMs = timer.elapsed<Timer::microseconds>().count() / 1e3f;
+            pSample.reset();
+            if(!inferred.push(std::move(pInferred)))
+                break;
+        }
+    };
+    auto writeStage = [&]()
+    {
+        std::shared_ptr<InferredSample> pInferred;
+        while(inferred.pop(pInferred))
+        {
+            Timer timer(true);
+            write(*pInferred, spPath.string(), labelPath.string(), *pCmap, properties.param.numClusters);
+            float const writeMs = timer.elapsed<Timer::microseconds>().count() / 1e3f;
+            std::cout << "Done with \"" + pInferred->filename + "\"" << std::endl;
+
+            InferenceResult const& result = pInferred->result;
+            MetricsLog::Record record("image");
+            record.set("filename", pInferred->filename)
+                  .set("worker", pInferred->worker)
+                  .set("width", result.labeling.width())
+                  .set("height", result.labeling.height())
+                  .set("load_ms", pInferred->loadMs)
+                  .set("infer_ms", pInferred->inferMs)
+                  .set("write_ms", writeMs)
+                  .set("iterations", result.numIter)
+                  .set("trws_iterations", result.numTrwsIter)
+                  .set("energy", result.energy)
+                  .set("lower_bound", result.lowerBound)
+                  .set("peak_rss_mb", MetricsLog::peakRss() / (1024. * 1024.));
+            metrics.write(record);
+            metrics.itemDone();
+            pInferred.reset();
+        }
+    };
+
+    ThreadPool loaderPool(properties.numLoaderThreads);
+    ThreadPool inferencePool(properties.numThreads, 0, properties.numa);
+    ThreadPool writerPool(properties.numWriterThreads);
+    std::vector<std::future<void>> loaders, workers, writers;
+    for(size_t i = 0; i < loaderPool.size(); ++i)
+        loaders.push_back(loaderPool.enqueue(loadStage));
+    for(size_t i = 0; i < inferencePool.size(); ++i)
+        workers.push_back(inferencePool.enqueue(inferStage));
+    for(size_t i = 0; i < writerPool.size(); ++i)
+        writers.push_back(writerPool.enqueue(writeStage));
+
+    // Shut down the stages in order
+    for(auto& f : loaders)
+        f.get();
+    loaded.close();
+    for(auto& f : workers)
+        f.get();
+    inferred.close();
+    for(auto& f : writers)
+        f.get();
+
+    std::cout << "Prefetch queue (" << loaderPool.size() << " loaders -> " << inferencePool.size() << " workers): "
+              << loaded.stats() << std::endl;
+    std::cout << "Output queue (" << inferencePool.size() << " workers -> " << writerPool.size() << " writers): "
+              << inferred.stats() << std::endl;
+    if(properties.memoryBudgetMB > 0)
+        std::cout << "Memory budget: " << memoryBudget.stats() << std::endl;
+
     return SUCCESS;
 }
\ No newline at end of file
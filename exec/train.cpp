@@ -2,15 +2,35 @@
 // Created by jan on 29.08.16.
 //
 
+#include <atomic>
+#include <cstring>
+#include <deque>
+#include <limits>
+#include <map>
+#include <numeric>
+#include <sstream>
 #include <BaseProperties.h>
 #include <Energy/Weights.h>
 #include <Energy/LossAugmentedEnergyFunction.h>
 #include <helper/image_helper.h>
 #include <Inference/InferenceIterator.h>
 #include <Threading/ThreadPool.h>
+#include <Threading/Topology.h>
+#include <Threading/BoundedQueue.h>
+#include <Threading/MemoryBudget.h>
 #include <Energy/IStepSizeRule.h>
 #include <Energy/AdamStepSizeRule.h>
 #include <Energy/DiminishingStepSizeRule.h>
+#include <Energy/BCFWStepSizeRule.h>
+#include <Energy/ConstraintCache.h>
+#include <Energy/TrainingCheckpoint.h>
+#include <Energy/AsyncWeights.h>
+#include <Dataset/DatasetCache.h>
+#include <Inference/LatentStateStore.h>
+#include <Inference/MemoryEstimator.h>
+#include <helper/schedule_helper.h>
+#include <Network/Socket.h>
+#include <MetricsLog.h>
 
 PROPERTIES_DEFINE(Train,
                   GROUP_DEFINE(datasetPx,
@@ -47,6 +67,16 @@ PROPERTIES_DEFINE(Train,
                                PROP_DEFINE_A(float, C, 0.1, -C)
                                PROP_DEFINE_A(bool, useClusterLoss, true, --useClusterLoss)
                                PROP_DEFINE_A(size_t, batchSize, 0, --batchSize)
+                               PROP_DEFINE_A(bool, warmStart, false, --warmStart)
+                               PROP_DEFINE_A(bool, useBCFW, false, --use_bcfw)
+                               PROP_DEFINE_A(float, gapEps, 0, --gapEps)
+                               PROP_DEFINE_A(bool, async, false, --async)
+                               PROP_DEFINE_A(size_t, maxStaleness, 0, --maxStaleness)
+                               GROUP_DEFINE(constraints,
+                                            PROP_DEFINE_A(size_t, size, 0, --constraints)
+                                            PROP_DEFINE_A(float, minViolation, 0, --minViolation)
+                                            PROP_DEFINE_A(uint32_t, oracleEvery, 5, --oracleEvery)
+                               )
                                GROUP_DEFINE(iter,
                                             PROP_DEFINE_A(uint32_t, start, 0, --start)
                                             PROP_DEFINE_A(uint32_t, end, 1000, --end)
@@ -64,15 +94,35 @@ PROPERTIES_DEFINE(Train,
                                PROP_DEFINE_A(bool, usePairwise, false, --usePairwise)
                                PROP_DEFINE_A(float, eps, 0, --eps)
                                PROP_DEFINE_A(float, maxIter, 50, --max_iter)
+                               PROP_DEFINE_A(ClusterId, shortlist, 0, --shortlist)
                   )
                   PROP_DEFINE_A(std::string, in, "", -i)
                   PROP_DEFINE_A(std::string, out, "", -o)
                   PROP_DEFINE_A(std::string, outDir, "", --outDir)
                   PROP_DEFINE_A(float, scaleFactor, 1.f, --scaleFactor)
+                  PROP_DEFINE_A(std::string, cacheDir, "", --cacheDir)
+                  PROP_DEFINE_A(size_t, cacheResidentMB, 4096, --cacheResidentMB)
+                  PROP_DEFINE_A(size_t, latentStateMB, 1024, --latentStateMB)
+                  PROP_DEFINE_A(std::string, latentSpillDir, "", --latentSpillDir)
                   PROP_DEFINE_A(size_t, saveEvery, 1, --saveEvery)
                   PROP_DEFINE_A(size_t, logEvery, 1, --logEvery)
                   PROP_DEFINE_A(std::string, log, "train.log", --log)
                   PROP_DEFINE_A(uint32_t, numThreads, 4, --numThreads)
+                  PROP_DEFINE_A(uint32_t, numLoaderThreads, 1, --numLoaderThreads)
+                  PROP_DEFINE_A(size_t, prefetch, 8, --prefetch)
+                  PROP_DEFINE_A(std::string, featurePrecision, "single", --featurePrecision)
+                  PROP_DEFINE_A(bool, numa, false, --numa)
+                  PROP_DEFINE_A(std::string, metrics, "", --metrics)
+                  PROP_DEFINE_A(float, progressEvery, 30, --progressEvery)
+                  PROP_DEFINE_A(size_t, memoryBudgetMB, 0, --memoryBudgetMB)
+                  PROP_DEFINE_A(bool, largestFirst, true, --largestFirst)
+                  PROP_DEFINE_A(uint32_t, costBuckets, 0, --costBuckets)
+                  GROUP_DEFINE(distributed,
+                               PROP_DEFINE_A(std::string, role, "", --role)
+                               PROP_DEFINE_A(std::string, address, "unix:/tmp/hseg_train.sock", --address)
+                               PROP_DEFINE_A(uint32_t, numWorkers, 1, --numWorkers)
+                               PROP_DEFINE_A(uint64_t, maxMessageMB, 1024, --maxMessageMB)
+                  )
                   PROP_DEFINE_A(std::string, propertiesFile, "properties/hseg_train.info", -p)
 )
 
@@ -94,107 +144,125 @@ struct SampleResult
 {
     Weights gradient{21ul, 0, 0};
     Cost upperBound = 0;
+    Cost loss = 0;
     bool valid = false;
     uint32_t numIter = 0;
     uint32_t numIterGt = 0;
+    bool cached = false;
     std::string filename;
     size_t num = 0;
+    size_t version = 0; //< Version of the weights the result was computed on, only used in asynchronous mode
+    uint32_t numTrwsIter = 0; //< TRW-S iterations of the loss-augmented prediction
+    Cost energy = 0; //< Loss-augmented energy of the prediction
+    Cost lowerBound = 0; //< Lower bound of the last TRW-S run of the prediction
+    uint32_t width = 0;
+    uint32_t height = 0;
+    float inferMs = 0; //< Time spent in processSample()
+    int32_t worker = -1; //< Index of the thread that processed the sample
+};
+
+/**
+ * A preprocessed sample as it is handed from the loader threads to the workers
+ */
+struct LoadedTrainingSample
+{
+    std::string filename;
+    std::shared_ptr<TrainingSample const> pSample; //< Null if the sample couldn't be loaded
+    float loadMs = 0;
 };
 
-SampleResult processSample(std::string const& filename, Weights const& curWeights, size_t num, TrainProperties const& properties)
+std::shared_ptr<TrainingSample const> loadSample(std::string const& filename, TrainingSampleSource const& source,
+                                                 DatasetCache const* pCache)
 {
+    if(pCache != nullptr)
+    {
+        auto pSample = pCache->get(filename);
+        if(!pSample)
+            std::cerr << "Sample \"" << filename << "\" is not in the dataset cache" << std::endl;
+        return pSample;
+    }
+
+    auto pLoaded = std::make_shared<TrainingSample>();
+    if(!DatasetCache::preprocess(source, filename, *pLoaded))
+        return nullptr;
+    return pLoaded;
+}
+
+SampleResult processSample(std::string const& filename, std::shared_ptr<TrainingSample const> const& pSample,
+                           WeightsSnapshot const& pCurWeights, size_t num, TrainProperties const& properties,
+                           unsigned int numEnergyThreads, LatentStateStore* pLatentStore,
+                           ConstraintCache* pConstraintCache)
+{
+    Timer timer(true);
+    Weights const& curWeights = *pCurWeights;
     SampleResult sampleResult;
     sampleResult.filename = filename;
     sampleResult.num = num;
+    sampleResult.worker = ThreadPool::currentIndex();
 
-    // Load images etc...
-    std::string pxFeatFilename = properties.datasetPx.path.img + filename + properties.datasetPx.extension.img;
-    std::string clusterFeatFilename = properties.datasetCluster.path.img + filename + properties.datasetCluster.extension.img;
-    std::string gtFilename = properties.datasetPx.path.gt + filename + properties.datasetPx.extension.gt;
-
-    FeatureImage pxFeatures;
-    if(!pxFeatures.read(pxFeatFilename))
-    {
-        std::cerr << "Unable to read features from \"" << pxFeatFilename << "\"" << std::endl;
-        return sampleResult;
-    }
-    FeatureImage clusterFeatures;
-    if(!clusterFeatures.read(clusterFeatFilename))
-    {
-        std::cerr << "Unable to read features from \"" << clusterFeatFilename << "\"" << std::endl;
-        return sampleResult;
-    }
-    if(clusterFeatures.width() != pxFeatures.width() || clusterFeatures.height() != pxFeatures.height())
+    // Use the most violated cached constraint instead of doing inference, unless it is time for a real oracle call or
+    // the cached constraints aren't violated enough anymore
+    if(pConstraintCache != nullptr)
     {
-        if(static_cast<float>(clusterFeatures.width()) / clusterFeatures.height() ==
-                static_cast<float>(pxFeatures.width()) / pxFeatures.height())
-            clusterFeatures.rescale(pxFeatures.width(), pxFeatures.height(), true);
-        else
+        size_t const visits = pConstraintCache->visit(filename);
+        uint32_t const oracleEvery = properties.train.constraints.oracleEvery;
+        bool const forceOracle = oracleEvery > 0 && visits % oracleEvery == 0;
+        Cost loss = 0, violation = 0;
+        if(!forceOracle && pConstraintCache->mostViolated(filename, curWeights, sampleResult.gradient, loss, violation)
+           && violation >= properties.train.constraints.minViolation)
         {
-            std::cerr << "Cluster and pixel feature map size don't match up: "
-                      << "(" << clusterFeatures.width() << "," << clusterFeatures.height() << ") vs. "
-                      << "(" << pxFeatures.width() << "," << pxFeatures.height() << ")." << std::endl;
+            sampleResult.upperBound = violation;
+            sampleResult.loss = loss;
+            sampleResult.cached = true;
+            sampleResult.valid = true;
+            sampleResult.inferMs = timer.elapsed<Timer::microseconds>().count() / 1e3f;
             return sampleResult;
         }
     }
 
-    LabelImage gt;
-    auto errCode = helper::image::readPalettePNG(gtFilename, gt, nullptr);
-    if(errCode != helper::image::PNGError::Okay)
-    {
-        std::cerr << "Unable to read ground truth from \"" << gtFilename << "\". Error Code: " << (int) errCode << std::endl;
+    // The sample has been loaded by one of the loader threads
+    if(!pSample)
         return sampleResult;
-    }
-    pxFeatures.rescale(properties.scaleFactor, true);
-    clusterFeatures.rescale(properties.scaleFactor, true);
-    gt.rescale(pxFeatures.width(), pxFeatures.height(), false);
-
-    // Crop to valid region
-    cv::Rect bb = helper::image::computeValidBox(gt, properties.datasetPx.constants.numClasses);
-    FeatureImage px_features_cropped(bb.width, bb.height, pxFeatures.dim());
-    FeatureImage cluster_features_cropped(bb.width, bb.height, clusterFeatures.dim());
-    LabelImage gt_cropped(bb.width, bb.height);
-    for(Coord x = bb.x; x < bb.width; ++x)
-    {
-        for (Coord y = bb.y; y < bb.height; ++y)
-        {
-            gt_cropped.at(x - bb.x, y - bb.y) = gt.at(x, y);
-            px_features_cropped.at(x - bb.x, y - bb.y) = pxFeatures.at(x, y);
-            cluster_features_cropped.at(x - bb.x, y - bb.y) = clusterFeatures.at(x, y);
-        }
-    }
-
-    gt = gt_cropped;
-    pxFeatures = px_features_cropped;
-    clusterFeatures = cluster_features_cropped;
 
-    if(gt.height() == 0 || gt.width() == 0 || gt.height() != pxFeatures.height() || gt.width() != pxFeatures.width()
-            || gt.height() != clusterFeatures.height() || gt.width() != clusterFeatures.width())
+    // Inference reads the features many times, so it pays off to copy them to the node of this thread first
+    std::shared_ptr<TrainingSample const> pLocalSample = pSample;
+    if(properties.numa)
     {
-        std::cerr << "Invalid ground truth or features. Dimensions: (" << gt.width() << "x" << gt.height()
-                  << ") vs. ("
-                  << pxFeatures.width() << "x" << pxFeatures.height() << ") vs. ("
-                  << clusterFeatures.width() << "x" << clusterFeatures.height() << ")." << std::endl;
-        return sampleResult;
+        auto pCopy = Topology::localCopy(*pSample);
+        pCopy->pxFeatures.detach();
+        pCopy->clusterFeatures.detach();
+        pLocalSample = std::move(pCopy);
     }
+    FeatureImage const& pxFeatures = pLocalSample->pxFeatures;
+    FeatureImage const& clusterFeatures = pLocalSample->clusterFeatures;
+    LabelImage const& gt = pLocalSample->gt;
+    sampleResult.width = gt.width();
+    sampleResult.height = gt.height();
 
+    // Start from the latent variables of the last time this sample was seen, if there are any
+    LatentState state;
+    if(pLatentStore != nullptr)
+        pLatentStore->get(filename, state);
 
     // Find latent variables that best explain the ground truth
     EnergyFunction energy(&curWeights, properties.param.numClusters, properties.param.usePairwise);
-    InferenceIterator<EnergyFunction> gtInference(&energy, &pxFeatures, &clusterFeatures, properties.param.eps, properties.param.maxIter);
-    InferenceResult gtResult = gtInference.runOnGroundTruth(gt);
+    InferenceIterator<EnergyFunction> gtInference(&energy, &pxFeatures, &clusterFeatures, properties.param.eps, properties.param.maxIter, properties.param.shortlist);
+    InferenceResult gtResult = gtInference.runOnGroundTruth(gt, state.gt);
     sampleResult.numIterGt = gtResult.numIter;
 
     // Predict with loss-augmented energy
     LossAugmentedEnergyFunction lossEnergy(&curWeights, &gt, properties.param.numClusters, properties.param.usePairwise, properties.train.useClusterLoss);
-    InferenceIterator<LossAugmentedEnergyFunction> inference(&lossEnergy, &pxFeatures, &clusterFeatures, properties.param.eps, properties.param.maxIter);
-    InferenceResult result = inference.run();
+    InferenceIterator<LossAugmentedEnergyFunction> inference(&lossEnergy, &pxFeatures, &clusterFeatures, properties.param.eps, properties.param.maxIter, properties.param.shortlist);
+    InferenceResult result = inference.run(state.prediction);
     sampleResult.numIter = result.numIter;
+    sampleResult.numTrwsIter = result.numTrwsIter;
+    sampleResult.energy = result.energy;
+    sampleResult.lowerBound = result.lowerBound;
 
     // Compute energy without weights on the ground truth
-    auto gtEnergy = energy.giveEnergyByWeight(pxFeatures, clusterFeatures, gt, gtResult.clustering, gtResult.clusters, &gt);
+    auto gtEnergy = energy.giveEnergyByWeight(pxFeatures, clusterFeatures, gt, gtResult.clustering, gtResult.clusters, &gt, numEnergyThreads);
     // Compute energy without weights on the prediction
-    auto predEnergy = energy.giveEnergyByWeight(pxFeatures, clusterFeatures, result.labeling, result.clustering, result.clusters, &gt);
+    auto predEnergy = energy.giveEnergyByWeight(pxFeatures, clusterFeatures, result.labeling, result.clustering, result.clusters, &gt, numEnergyThreads);
 
     //std::cout << gtEnergy.sum() << ", " << predEnergy.sum() << ", " << curWeights.sum() << std::endl;
 
@@ -205,6 +273,7 @@ SampleResult processSample(std::string const& filename, Weights const& curWeight
     float loss = LossAugmentedEnergyFunction::computeLoss(result.labeling, result.clustering, gt, result.clusters,
                                                           lossFactor, properties.datasetPx.constants.numClasses, properties.train.useClusterLoss);
     sampleResult.upperBound = (loss - predEnergyCur) + gtEnergyCur;
+    sampleResult.loss = loss;
 
     //std::cout << "Upper bound: (" << loss << " - " << predEnergyCur << ") + " << gtEnergyCur << " = " << loss - predEnergyCur << " + " << gtEnergyCur << " = " << sampleResult.upperBound << std::endl;
 
@@ -212,10 +281,271 @@ SampleResult processSample(std::string const& filename, Weights const& curWeight
     gtEnergy -= predEnergy;
     sampleResult.gradient = gtEnergy;
 
+    if(pConstraintCache != nullptr)
+        pConstraintCache->add(filename, sampleResult.gradient, loss);
+
+    if(pLatentStore != nullptr)
+    {
+        state.gt = std::move(gtResult);
+        state.prediction = std::move(result);
+        pLatentStore->put(filename, std::move(state));
+    }
+
     sampleResult.valid = true;
+    sampleResult.inferMs = timer.elapsed<Timer::microseconds>().count() / 1e3f;
     return sampleResult;
 }
 
+/**
+ * @return Estimated memory needed to process a sample whose features are in memory already
+ */
+size_t estimateSampleMemory(TrainProperties const& properties, TrainingSample const& sample)
+{
+    MemoryEstimator const estimator(properties.datasetPx.constants.featDim,
+                                    properties.datasetCluster.constants.featDim,
+                                    properties.datasetPx.constants.numClasses, properties.param.numClusters,
+                                    properties.param.shortlist, properties.param.usePairwise,
+                                    sample.pxFeatures.precision());
+    Coord const width = sample.gt.width();
+    Coord const height = sample.gt.height();
+
+    // The features only take up additional memory if they are copied to the node of the worker. The ground truth
+    // inference keeps its cluster search while the prediction runs.
+    return estimator.inference(width, height) + estimator.clusterSearch(width, height)
+           + (properties.numa ? estimator.features(width, height) : 0);
+}
+
+/**
+ * Messages exchanged between coordinator and workers in distributed training
+ */
+enum TrainMessage : uint32_t
+{
+    MSG_SHARD = 1, //< Coordinator -> worker: indices of all samples the worker is responsible for
+    MSG_READY, //< Worker -> coordinator: all samples of the shard have been loaded
+    MSG_WEIGHTS, //< Coordinator -> worker: full weights the first time, afterwards the difference to the last ones
+    MSG_SAMPLE, //< Coordinator -> worker: sample to process with the current weights
+    MSG_RESULT, //< Worker -> coordinator: result of a sample, gradient is sparse
+    MSG_STOP, //< Coordinator -> worker: training is done
+};
+
+template<typename T>
+void writePod(std::ostream& out, T const& value)
+{
+    out.write(reinterpret_cast<char const*>(&value), sizeof(T));
+}
+
+template<typename T>
+bool readPod(std::istream& in, T& outValue)
+{
+    in.read(reinterpret_cast<char*>(&outValue), sizeof(T));
+    return static_cast<bool>(in);
+}
+
+std::string encodeResult(SampleResult const& result, uint32_t sampleIndex)
+{
+    std::ostringstream out(std::ios::out | std::ios::binary);
+    writePod<uint32_t>(out, sampleIndex);
+    writePod<uint64_t>(out, result.num);
+    writePod(out, result.upperBound);
+    writePod(out, result.loss);
+    writePod<uint8_t>(out, result.valid);
+    writePod(out, result.numIter);
+    writePod(out, result.numIterGt);
+    writePod<uint8_t>(out, result.cached);
+    writePod(out, result.numTrwsIter);
+    writePod(out, result.energy);
+    writePod(out, result.lowerBound);
+    writePod(out, result.width);
+    writePod(out, result.height);
+    writePod(out, result.inferMs);
+    writePod(out, result.worker);
+    result.gradient.writeSparse(out);
+    return out.str();
+}
+
+bool decodeResult(std::string const& payload, std::vector<std::string> const& filenames, SampleResult& outResult)
+{
+    std::istringstream in(payload, std::ios::in | std::ios::binary);
+    uint32_t sampleIndex;
+    uint64_t num;
+    uint8_t valid, cached;
+    if(!readPod(in, sampleIndex) || sampleIndex >= filenames.size() || !readPod(in, num)
+       || !readPod(in, outResult.upperBound) || !readPod(in, outResult.loss) || !readPod(in, valid)
+       || !readPod(in, outResult.numIter) || !readPod(in, outResult.numIterGt) || !readPod(in, cached)
+       || !readPod(in, outResult.numTrwsIter) || !readPod(in, outResult.energy) || !readPod(in, outResult.lowerBound)
+       || !readPod(in, outResult.width) || !readPod(in, outResult.height) || !readPod(in, outResult.inferMs)
+       || !readPod(in, outResult.worker))
+        return false;
+    outResult.filename = filenames[sampleIndex];
+    outResult.num = num;
+    outResult.valid = valid != 0;
+    outResult.cached = cached != 0;
+    return outResult.gradient.readSparse(in);
+}
+
+/**
+ * Coordinator side of distributed training. Samples are sharded among the workers by their index in the file list,
+ * and every worker keeps its shard in memory. Only weight deltas and sparse gradients go over the wire. Results are
+ * pushed into the same completion queue local jobs use.
+ */
+class TrainingCoordinator
+{
+public:
+    TrainingCoordinator(BoundedQueue<SampleResult>& completed, std::vector<std::string> const& filenames,
+                        Weights const& prototype)
+            : m_completed(completed),
+              m_filenames(filenames),
+              m_prototype(prototype),
+              m_sent(prototype)
+    {
+    }
+
+    ~TrainingCoordinator()
+    {
+        stop();
+    }
+
+    /**
+     * Waits for all workers to connect, hands out the shards and waits until they are loaded
+     * @param address Address to listen on
+     * @param numWorkers Amount of workers to wait for
+     * @param maxMessageSize Messages from workers larger than this many bytes are rejected
+     * @return True in case of success, otherwise false
+     */
+    bool start(std::string const& address, size_t numWorkers, uint64_t maxMessageSize)
+    {
+        if(!m_server.listen(address))
+        {
+            std::cerr << "Unable to listen on \"" << address << "\"" << std::endl;
+            return false;
+        }
+
+        std::cout << "Waiting for " << numWorkers << " workers on \"" << address << "\"..." << std::endl;
+        for(size_t w = 0; w < numWorkers; ++w)
+        {
+            Socket worker = m_server.accept();
+            worker.setMaxMessageSize(maxMessageSize);
+            std::ostringstream shard(std::ios::out | std::ios::binary);
+            for(uint32_t i = w; i < m_filenames.size(); i += numWorkers)
+                writePod(shard, i);
+            if(!worker.send(MSG_SHARD, shard.str()))
+                return false;
+            m_workers.push_back(std::move(worker));
+        }
+
+        for(size_t w = 0; w < m_workers.size(); ++w)
+        {
+            uint32_t type;
+            std::string payload;
+            if(!m_workers[w].receive(type, payload) || type != MSG_READY)
+            {
+                std::cerr << "Worker " << w << " failed to load its shard" << std::endl;
+                return false;
+            }
+        }
+        std::cout << "All workers are ready." << std::endl;
+
+        m_pReceivers = std::make_unique<ThreadPool>(m_workers.size());
+        for(size_t w = 0; w < m_workers.size(); ++w)
+            m_pReceivers->enqueue([this, w] { receive(w); });
+        return true;
+    }
+
+    /**
+     * Sends the weights to use from now on to all workers. Must not be called while there are samples in flight.
+     * @param weights Current weights
+     * @return True in case of success, otherwise false
+     */
+    bool sendWeights(Weights const& weights)
+    {
+        std::ostringstream out(std::ios::out | std::ios::binary);
+        if(!m_sentOnce)
+        {
+            writePod<uint8_t>(out, 1);
+            weights.write(out);
+            m_sent = weights;
+            m_sentOnce = true;
+        }
+        else
+        {
+            // Workers apply the very same delta, thus they end up with exactly the same weights as m_sent
+            Weights delta = weights;
+            delta -= m_sent;
+            writePod<uint8_t>(out, 0);
+            delta.writeSparse(out);
+            m_sent += delta;
+        }
+
+        std::string const payload = out.str();
+        for(auto& worker : m_workers)
+            if(!worker.send(MSG_WEIGHTS, payload))
+                return false;
+        return true;
+    }
+
+    /**
+     * Hands a sample to the worker responsible for it
+     * @param sampleIndex Index of the sample in the file list
+     * @param num Index of the sample in the batch
+     * @return True in case of success, otherwise false
+     */
+    bool submit(uint32_t sampleIndex, size_t num)
+    {
+        std::ostringstream out(std::ios::out | std::ios::binary);
+        writePod(out, sampleIndex);
+        writePod<uint64_t>(out, num);
+        return m_workers[sampleIndex % m_workers.size()].send(MSG_SAMPLE, out.str());
+    }
+
+    /**
+     * Tells all workers to quit and waits until the connections are closed
+     */
+    void stop()
+    {
+        if(m_stopping.exchange(true))
+            return;
+        for(auto& worker : m_workers)
+        {
+            worker.send(MSG_STOP, "");
+            worker.shutdown();
+        }
+        m_pReceivers.reset();
+    }
+
+private:
+    BoundedQueue<SampleResult>& m_completed;
+    std::vector<std::string> const& m_filenames;
+    Weights const m_prototype; //< Gradients are decoded into copies of this
+    Weights m_sent; //< Weights the workers currently have
+    bool m_sentOnce = false;
+    ServerSocket m_server;
+    std::vector<Socket> m_workers;
+    std::unique_ptr<ThreadPool> m_pReceivers;
+    std::atomic_bool m_stopping{false};
+
+    void receive(size_t w)
+    {
+        uint32_t type;
+        std::string payload;
+        while(m_workers[w].receive(type, payload))
+        {
+            SampleResult result;
+            result.gradient = m_prototype;
+            if(type != MSG_RESULT || !decodeResult(payload, m_filenames, result))
+                break;
+            m_completed.push(std::move(result));
+        }
+
+        // An invalid result makes training stop
+        if(!m_stopping)
+        {
+            SampleResult result;
+            result.filename = "<lost connection to worker " + std::to_string(w) + ">";
+            m_completed.push(std::move(result));
+        }
+    }
+};
+
 size_t getNumberOfDigits (size_t i)
 {
     return i > 0 ? (size_t) log10 ((double) i) + 1 : 1;
@@ -232,8 +562,141 @@ enum ERROR_CODE
     NO_VALID_SAMPLES,
     CANT_READ_PX_FEATURES,
     CANT_READ_CLU_FEATURES,
+    INVALID_FEATURE_PRECISION,
+    CANT_BUILD_CACHE,
+    CANT_READ_CHECKPOINT,
+    NETWORK_ERROR,
+    INVALID_ROLE,
+    CANT_OPEN_METRICS,
+    INVALID_PIPELINE_SIZE,
+    LOADING_STOPPED,
 };
 
+/**
+ * Worker side of distributed training. Loads the shard it is assigned, then processes samples as the coordinator
+ * hands them out until it is told to stop.
+ */
+int runWorker(TrainProperties const& properties, std::vector<std::string> const& filenames,
+              TrainingSampleSource const& source, DatasetCache const* pCache)
+{
+    // The coordinator might not be up yet
+    Socket socket;
+    for(size_t attempt = 0; attempt < 60 && !socket.valid(); ++attempt)
+    {
+        if(attempt > 0)
+            std::this_thread::sleep_for(std::chrono::seconds(1));
+        socket = Socket::connect(properties.distributed.address);
+    }
+    if(!socket.valid())
+    {
+        std::cerr << "Unable to connect to coordinator at \"" << properties.distributed.address << "\"" << std::endl;
+        return NETWORK_ERROR;
+    }
+    socket.setMaxMessageSize(properties.distributed.maxMessageMB * 1024 * 1024);
+
+    uint32_t type;
+    std::string payload;
+    if(!socket.receive(type, payload) || type != MSG_SHARD)
+    {
+        std::cerr << "Didn't receive a shard from the coordinator" << std::endl;
+        return NETWORK_ERROR;
+    }
+
+    // Keep the whole shard in memory
+    std::vector<uint32_t> shard(payload.size() / sizeof(uint32_t));
+    std::memcpy(shard.data(), payload.data(), shard.size() * sizeof(uint32_t));
+    std::vector<std::shared_ptr<TrainingSample const>> samples(filenames.size());
+    {
+        ThreadPool loaderPool(properties.numThreads);
+        std::vector<std::future<void>> loaded;
+        for(uint32_t i : shard)
+        {
+            if(i >= filenames.size())
+                return NETWORK_ERROR;
+            loaded.push_back(loaderPool.enqueue([&, i] { samples[i] = loadSample(filenames[i], source, pCache); }));
+        }
+        for(auto& f : loaded)
+            f.get();
+    }
+    std::cout << "Loaded " << shard.size() << " samples." << std::endl;
+    if(!socket.send(MSG_READY, ""))
+        return NETWORK_ERROR;
+
+    std::unique_ptr<LatentStateStore> pLatentStore;
+    if(properties.train.warmStart)
+        pLatentStore = std::make_unique<LatentStateStore>(properties.latentStateMB * 1024 * 1024,
+                                                          properties.latentSpillDir);
+    std::unique_ptr<ConstraintCache> pConstraintCache;
+    if(properties.train.constraints.size > 0)
+        pConstraintCache = std::make_unique<ConstraintCache>(properties.train.constraints.size);
+
+    Weights weights(properties.datasetPx.constants.numClasses, properties.datasetPx.constants.featDim,
+                    properties.datasetCluster.constants.featDim);
+    Weights delta = weights;
+    WeightsSnapshot weightsSnapshot = weights.snapshot();
+    size_t const numInFlight = std::min<size_t>(properties.numThreads, std::max<size_t>(shard.size(), 1));
+    unsigned int const numEnergyThreads = std::max<size_t>(1, properties.numThreads / numInFlight);
+    std::mutex sendMutex;
+    MemoryBudget memoryBudget(properties.memoryBudgetMB * 1024 * 1024);
+    ThreadPool pool(properties.numThreads, 0, properties.numa);
+
+    while(socket.receive(type, payload))
+    {
+        std::istringstream in(payload, std::ios::in | std::ios::binary);
+        if(type == MSG_WEIGHTS)
+        {
+            uint8_t full = 0;
+            if(!readPod(in, full) || !(full ? weights.read(in) : delta.readSparse(in)))
+                return NETWORK_ERROR;
+            if(!full)
+                weights += delta;
+            weightsSnapshot = weights.snapshot();
+        }
+        else if(type == MSG_SAMPLE)
+        {
+            uint32_t sampleIndex;
+            uint64_t num;
+            if(!readPod(in, sampleIndex) || !readPod(in, num) || sampleIndex >= filenames.size())
+                return NETWORK_ERROR;
+            MemoryBudget::Reservation reservation;
+            if(samples[sampleIndex])
+                reservation = memoryBudget.acquire(estimateSampleMemory(properties, *samples[sampleIndex]));
+            pool.post([&, sampleIndex, num, weightsSnapshot, reservation = std::move(reservation)]
+                      {
+                          // The coordinator waits for a result of every sample, an invalid one makes it stop
+                          SampleResult result;
+                          try
+                          {
+                              result = processSample(filenames[sampleIndex], samples[sampleIndex], weightsSnapshot,
+                                                     num, properties, numEnergyThreads, pLatentStore.get(),
+                                                     pConstraintCache.get());
+                          }
+                          catch (std::exception const& e)
+                          {
+                              std::cerr << "Processing \"" << filenames[sampleIndex] << "\" failed: " << e.what()
+                                        << std::endl;
+                              result.filename = filenames[sampleIndex];
+                          }
+                          catch (...)
+                          {
+                              std::cerr << "Processing \"" << filenames[sampleIndex] << "\" failed" << std::endl;
+                              result.filename = filenames[sampleIndex];
+                          }
+                          std::string const encoded = encodeResult(result, sampleIndex);
+                          std::lock_guard<std::mutex> lock(sendMutex);
+                          socket.send(MSG_RESULT, encoded);
+                      });
+        }
+        else if(type == MSG_STOP)
+            return SUCCESS;
+        else
+            return NETWORK_ERROR;
+    }
+
+    std::cerr << "Lost connection to the coordinator" << std::endl;
+    return NETWORK_ERROR;
+}
+
 int main(int argc, char** argv)
 {
     // Read properties
@@ -257,6 +720,20 @@ int main(int argc, char** argv)
     }
     uint32_t T = properties.train.iter.end - properties.train.iter.start;
 
+    FeatureImage::Precision featurePrecision;
+    if(!FeatureImage::parsePrecision(properties.featurePrecision, featurePrecision))
+    {
+        std::cerr << "Invalid feature precision \"" << properties.featurePrecision << "\"" << std::endl;
+        return INVALID_FEATURE_PRECISION;
+    }
+
+    // Any of these being 0 would stall the pipeline forever
+    if(properties.numThreads == 0 || properties.numLoaderThreads == 0 || properties.prefetch == 0)
+    {
+        std::cerr << "numThreads, numLoaderThreads and prefetch have to be at least 1" << std::endl;
+        return INVALID_PIPELINE_SIZE;
+    }
+
     // Test feature maps
     {
         std::string pxFeatFilename = properties.datasetPx.path.img + filenames[0] + properties.datasetPx.extension.img;
@@ -277,23 +754,97 @@ int main(int argc, char** argv)
         std::cout << "Cluster featuremap [0]: " << clusterFeatures.width() << "x" << clusterFeatures.height() << std::endl;
     }
 
-    Weights curWeights(properties.datasetPx.constants.numClasses, properties.datasetPx.constants.featDim, properties.datasetCluster.constants.featDim);
-    if(!curWeights.read(properties.in))
-        std::cout << "Couldn't read in initial weights from \"" << properties.in << "\". Using zero." << std::endl;
+    TrainingSampleSource source;
+    source.pxPath = properties.datasetPx.path.img;
+    source.pxExtension = properties.datasetPx.extension.img;
+    source.clusterPath = properties.datasetCluster.path.img;
+    source.clusterExtension = properties.datasetCluster.extension.img;
+    source.gtPath = properties.datasetPx.path.gt;
+    source.gtExtension = properties.datasetPx.extension.gt;
+    source.scaleFactor = properties.scaleFactor;
+    source.numClasses = properties.datasetPx.constants.numClasses;
+    source.precision = featurePrecision;
 
-    std::string weightCopyFilename = properties.outDir + std::to_string(properties.train.iter.start) + ".dat";
-    if(!curWeights.write(weightCopyFilename))
+    bool const isCoordinator = properties.distributed.role == "coordinator";
+    bool const isWorker = properties.distributed.role == "worker";
+    if(!properties.distributed.role.empty() && !isCoordinator && !isWorker)
     {
-        std::cerr << "Couldn't write initial weights to file \"" << weightCopyFilename << "\"" << std::endl;
-        return CANT_WRITE_RESULT_BACKUP;
+        std::cerr << "Invalid role \"" << properties.distributed.role << "\"" << std::endl;
+        return INVALID_ROLE;
     }
 
-    ThreadPool pool(properties.numThreads);
-    std::deque<std::future<SampleResult>> futures;
+    // Preprocess the dataset once if a cache directory is given. The coordinator doesn't need it, and workers would
+    // race building the same file, so they only use an existing one.
+    DatasetCache cache;
+    DatasetCache const* pCache = nullptr;
+    if(!properties.cacheDir.empty() && !isCoordinator)
+    {
+        std::string const cacheFile = DatasetCache::cacheFilename(properties.cacheDir, source, filenames);
+        size_t const residentBudget = properties.cacheResidentMB * 1024 * 1024;
+        bool opened = cache.open(cacheFile, residentBudget);
+        if(!opened && isWorker)
+            std::cout << "Dataset cache \"" << cacheFile << "\" doesn't exist. Loading samples directly." << std::endl;
+        else if(!opened)
+        {
+            std::cout << "Building dataset cache \"" << cacheFile << "\"..." << std::endl;
+            if(!DatasetCache::build(cacheFile, source, filenames, properties.numThreads) ||
+               !cache.open(cacheFile, residentBudget))
+            {
+                std::cerr << "Unable to build dataset cache \"" << cacheFile << "\"" << std::endl;
+                return CANT_BUILD_CACHE;
+            }
+            opened = true;
+        }
+        if(opened)
+        {
+            std::cout << "Using dataset cache \"" << cacheFile << "\" with " << cache.size() << " samples ("
+                      << (cache.resident() ? "resident" : "memory mapped") << ")." << std::endl;
+            pCache = &cache;
+        }
+    }
+
+    if(isWorker)
+        return runWorker(properties, filenames, source, pCache);
+
+    // Latent variables of every sample are kept to warm-start the next iteration
+    std::unique_ptr<LatentStateStore> pLatentStateStore;
+    if(properties.train.warmStart)
+        pLatentStateStore = std::make_unique<LatentStateStore>(properties.latentStateMB * 1024 * 1024,
+                                                               properties.latentSpillDir);
+    LatentStateStore* pLatentStore = pLatentStateStore.get();
+
+    // Working set of loss-augmented predictions of every sample
+    std::unique_ptr<ConstraintCache> pConstraintCache;
+    if(properties.train.constraints.size > 0)
+        pConstraintCache = std::make_unique<ConstraintCache>(properties.train.constraints.size);
+
+    Weights curWeights(properties.datasetPx.constants.numClasses, properties.datasetPx.constants.featDim, properties.datasetCluster.constants.featDim);
+    bool const readInitialWeights = curWeights.read(properties.in);
+    if(!readInitialWeights)
+        std::cout << "Couldn't read in initial weights from \"" << properties.in << "\". Using zero." << std::endl;
+
+    // Submission is bounded so that jobs don't pile up, results are collected in completion order. The completion
+    // queue never holds more than one batch. Everything jobs refer to has to outlive the pool.
+    BoundedQueue<SampleResult> completed(std::numeric_limits<size_t>::max());
+    std::unique_ptr<AsyncWeights> pAsyncWeights;
+    MemoryBudget memoryBudget(properties.memoryBudgetMB * 1024 * 1024);
+    ThreadPool pool(properties.numThreads, properties.numThreads, properties.numa);
 
     // Initialize step size rule
     std::unique_ptr<IStepSizeRule> pStepSizeRule;
-    if (properties.train.rate.useAdam)
+    BCFWStepSizeRule* pBCFW = nullptr;
+    if (properties.train.useBCFW)
+    {
+        auto pRule = std::make_unique<BCFWStepSizeRule>(properties.train.C,
+                                                        filenames.size(),
+                                                        properties.datasetPx.constants.numClasses,
+                                                        properties.datasetPx.constants.featDim,
+                                                        properties.datasetCluster.constants.featDim,
+                                                        properties.train.iter.start);
+        pBCFW = pRule.get();
+        pStepSizeRule = std::move(pRule);
+    }
+    else if (properties.train.rate.useAdam)
         pStepSizeRule = std::make_unique<AdamStepSizeRule>(properties.train.rate.alpha,
                                                            properties.train.rate.beta1,
                                                            properties.train.rate.beta2,
@@ -305,9 +856,61 @@ int main(int argc, char** argv)
     else
         pStepSizeRule = std::make_unique<DiminishingStepSizeRule>(properties.train.rate.alpha,
                                                                   properties.train.iter.start);
-    if(!pStepSizeRule->read(properties.outDir, properties.train.iter.start))
+
+    // Samples are visited in the order of the file list first, then in random order
+    TrainingCursor cursor;
+    cursor.order.resize(filenames.size());
+    std::iota(cursor.order.begin(), cursor.order.end(), 0);
+    auto randomEngine = std::default_random_engine{};
+    bool restoredStepSizeRule = false;
+
+    // Resume from a checkpoint if there is one, otherwise fall back to the separate files of older versions
+    std::string const checkpointFilename = TrainingCheckpoint::filename(properties.outDir, properties.train.iter.start);
+    if(std::ifstream(checkpointFilename).is_open())
+    {
+        if(!TrainingCheckpoint::read(checkpointFilename, curWeights, *pStepSizeRule, cursor)
+           || cursor.order.size() != filenames.size() || cursor.pos > cursor.order.size()
+           || std::any_of(cursor.order.begin(), cursor.order.end(), [&](uint32_t i) { return i >= filenames.size(); }))
+        {
+            std::cerr << "Couldn't read checkpoint \"" << checkpointFilename << "\". It might have been written with "
+                      << "different settings or another file list." << std::endl;
+            return CANT_READ_CHECKPOINT;
+        }
+        std::istringstream rngState(cursor.rngState);
+        rngState >> randomEngine;
+        restoredStepSizeRule = true;
+        std::cout << "Resuming from checkpoint \"" << checkpointFilename << "\"." << std::endl;
+        if(pLatentStore != nullptr || pConstraintCache != nullptr)
+            std::cout << "Latent states and cached constraints aren't part of the checkpoint. They start empty, thus "
+                      << "training doesn't continue exactly as it would have without the interruption." << std::endl;
+    }
+    else if(pStepSizeRule->read(properties.outDir, properties.train.iter.start))
+        restoredStepSizeRule = true;
+    else
         std::cout << "Couldn't read in initial step size meta data from \"" << properties.outDir << "\". Using default." << std::endl;
 
+    // BCFW keeps its own representation of the weights, which starts at the origin of the regularizer. Arbitrary
+    // weights don't correspond to any set of dual blocks, thus initial weights can't be used without the BCFW state.
+    if(pBCFW != nullptr)
+    {
+        if(readInitialWeights && !restoredStepSizeRule)
+            std::cerr << "Warning: BCFW can't start from the weights in \"" << properties.in << "\" without its dual "
+                      << "blocks. They are ignored, training starts at the origin of the regularizer." << std::endl;
+        pBCFW->initialize(curWeights);
+    }
+
+    std::string weightCopyFilename = properties.outDir + std::to_string(properties.train.iter.start) + ".dat";
+    if(!curWeights.write(weightCopyFilename))
+    {
+        std::cerr << "Couldn't write initial weights to file \"" << weightCopyFilename << "\"" << std::endl;
+        return CANT_WRITE_RESULT_BACKUP;
+    }
+
+    // Per-sample rules need to identify the sample independently of the order it is visited in
+    std::unordered_map<std::string, size_t> sampleIndex;
+    for(size_t i = 0; i < filenames.size(); ++i)
+        sampleIndex[filenames[i]] = i;
+
     auto mode = std::ios::out;
     if(properties.train.iter.start == 0)
         mode |= std::ios::trunc;
@@ -353,73 +956,252 @@ int main(int argc, char** argv)
             << std::setw(12) << "total min" << "\t;"
             << std::setw(12) << "total mag" << std::endl;
     }
-    auto randomEngine = std::default_random_engine{};
-
     if(properties.train.batchSize == 0)
         properties.train.batchSize = filenames.size();
-    size_t curFileIdx = 0;
+
+    // If there are more threads than images in flight, use the spare ones to compute the energies
+    size_t const numInFlight = std::min<size_t>(properties.numThreads, properties.train.batchSize);
+    unsigned int const numEnergyThreads = std::max<size_t>(1, properties.numThreads / std::max<size_t>(numInFlight, 1));
     auto nextFile = [&]()
     {
-        if(curFileIdx >= filenames.size())
+        if(cursor.pos >= cursor.order.size())
         {
-            std::shuffle(filenames.begin(), filenames.end(), randomEngine);
-            curFileIdx = 0;
+            std::shuffle(cursor.order.begin(), cursor.order.end(), randomEngine);
+            cursor.pos = 0;
         }
-        return filenames[curFileIdx++];
+        return filenames[cursor.order[cursor.pos++]];
     };
 
-    // Iterate T times
-    for(uint32_t t = properties.train.iter.start; t < properties.train.iter.start + T; ++t)
+    // The samples of a batch are submitted largest first, so a large one doesn't hold up the end of the batch. Their
+    // size is taken from the cache or from the variable header of the feature file, thus this doesn't cost a full read.
+    std::vector<size_t> sampleCosts;
+    if(properties.largestFirst)
     {
-        uint32_t N = 0;
-        Weights sum(properties.datasetPx.constants.numClasses, properties.datasetPx.constants.featDim, properties.datasetCluster.constants.featDim); // All zeros
-        Cost iterationEnergy = 0;
-        futures.clear();
+        sampleCosts.resize(filenames.size(), 0);
+        size_t numUnknown = 0;
+        for(size_t i = 0; i < filenames.size(); ++i)
+        {
+            Coord width, height, dim;
+            if((pCache && pCache->dimensions(filenames[i], width, height))
+               || FeatureImage::readDimensions(source.pxPath + filenames[i] + source.pxExtension, width, height, dim))
+                sampleCosts[i] = static_cast<size_t>(width) * height;
+            else
+                numUnknown++;
+        }
+        if(numUnknown > 0)
+            std::cerr << "Couldn't read the size of " << numUnknown << " samples, they are submitted last." << std::endl;
+    }
+    std::deque<std::string> batchQueue; //< Remaining samples of the current batch in the order they are submitted
+    auto nextScheduledFile = [&]()
+    {
+        if(!properties.largestFirst)
+            return nextFile();
 
-        // Iterate over all images
-        for (size_t i = 0; i < properties.train.batchSize; ++i)
+        // Batches are drawn as a whole, thus a batch still contains the same samples as it would without reordering
+        if(batchQueue.empty())
+        {
+            std::vector<std::string> batch;
+            std::vector<size_t> costs;
+            for(size_t i = 0; i < properties.train.batchSize; ++i)
+            {
+                batch.push_back(nextFile());
+                costs.push_back(sampleCosts[sampleIndex.at(batch.back())]);
+            }
+            for(size_t i : helper::schedule::largestFirst(costs, properties.costBuckets))
+                batchQueue.push_back(std::move(batch[i]));
+        }
+        std::string filename = std::move(batchQueue.front());
+        batchQueue.pop_front();
+        return filename;
+    };
+
+    // Samples are processed by remote workers instead of the local thread pool
+    std::unique_ptr<TrainingCoordinator> pCoordinator;
+    if(isCoordinator)
+    {
+        pCoordinator = std::make_unique<TrainingCoordinator>(completed, filenames, curWeights);
+        if(!pCoordinator->start(properties.distributed.address, properties.distributed.numWorkers,
+                                 properties.distributed.maxMessageMB * 1024 * 1024))
+            return NETWORK_ERROR;
+    }
+
+    // Loader threads preprocess the samples of all iterations in the order they are going to be visited and keep the
+    // prefetch queue filled. The coordinator only needs the order, workers load the samples themselves.
+    BoundedQueue<LoadedTrainingSample> prefetchQueue(properties.prefetch);
+    size_t const numSamplesTotal = static_cast<size_t>(T) * properties.train.batchSize;
+    MetricsLog metrics(properties.metrics, numSamplesTotal, properties.progressEvery);
+    if(!metrics.good())
+    {
+        std::cerr << "Couldn't open metrics file \"" << properties.metrics << "\"" << std::endl;
+        return CANT_OPEN_METRICS;
+    }
+    std::unordered_map<std::string, float> loadMs; //< Load times of the samples in flight
+    size_t numSamplesRequested = 0;
+    std::mutex nextFileMutex;
+    std::map<uint32_t, TrainingCursor> iterationCursors; //< Cursor after the last sample of an iteration
+    auto loadStage = [&]()
+    {
+        while(true)
         {
-            std::string const& filename = nextFile();
-            auto&& fut = pool.enqueue(processSample, filename, curWeights, i, properties);
-            futures.push_back(std::move(fut));
+            LoadedTrainingSample sample;
+            {
+                std::lock_guard<std::mutex> lock(nextFileMutex);
+                if(numSamplesRequested >= numSamplesTotal)
+                    return;
+                numSamplesRequested++;
+                sample.filename = nextScheduledFile();
 
-            // Wait for some threads to finish if the queue gets too long
-            while(pool.queued() > properties.numThreads)
+                // Loaders run ahead of training, thus the cursor that belongs to a checkpoint has to be remembered
+                if(numSamplesRequested % properties.train.batchSize == 0)
+                {
+                    uint32_t const t = properties.train.iter.start + numSamplesRequested / properties.train.batchSize - 1;
+                    std::ostringstream rngState;
+                    rngState << randomEngine;
+                    iterationCursors[t] = cursor;
+                    iterationCursors[t].rngState = rngState.str();
+                }
+            }
+            if(!pCoordinator)
             {
-                auto sampleResult = futures.front().get();
-                if(!sampleResult.valid)
+                // A sample that can't be loaded is still handed on, so that every requested sample arrives
+                Timer timer(true);
+                try
                 {
-                    std::cerr << "Sample result was invalid. Cannot continue." << std::endl;
-                    return INFERRED_INVALID;
+                    sample.pSample = loadSample(sample.filename, source, pCache);
                 }
-
-                // Filter out bad results
-                if (sampleResult.upperBound >= 0)
+                catch(std::exception const& e)
                 {
-                    sum += sampleResult.gradient;
-                    iterationEnergy += sampleResult.upperBound;
-                    N++;
+                    std::cerr << "Couldn't load sample \"" << sample.filename << "\": " << e.what() << std::endl;
                 }
+                sample.loadMs = timer.elapsed<Timer::microseconds>().count() / 1e3f;
+            }
+            if(!prefetchQueue.push(std::move(sample)))
+                return;
+        }
+    };
+    ThreadPool loaderPool(properties.numLoaderThreads);
+    std::vector<std::future<void>> loaders;
+    for(size_t i = 0; i < loaderPool.size(); ++i)
+        loaders.push_back(loaderPool.enqueue(loadStage));
+
+    // Loaders might be blocked on a full queue if training ends early, this wakes them up before the pool is destroyed
+    struct CloseOnExit
+    {
+        BoundedQueue<LoadedTrainingSample>& queue;
+        ~CloseOnExit()
+        {
+            queue.close();
+        }
+    } closePrefetchQueue{prefetchQueue};
+
+    // Checkpoints are written in the background. There is at most one write in flight, which is waited for before
+    // training ends.
+    ThreadPool checkpointPool(1);
+    std::future<bool> pendingCheckpoint;
+    struct WaitOnExit
+    {
+        std::future<bool>& future;
+        ~WaitOnExit()
+        {
+            if(future.valid())
+                future.wait();
+        }
+    } waitForCheckpoint{pendingCheckpoint};
+    auto writeCheckpoint = [&properties](std::string checkpoint, std::string weights, uint32_t t)
+    {
+        bool success = true;
+        auto write = [&success](std::string const& filename, std::string const& bytes)
+        {
+            if(!TrainingCheckpoint::writeAtomic(filename, bytes))
+            {
+                std::cerr << "Couldn't write to file \"" << filename << "\"" << std::endl;
+                success = false;
+            }
+        };
+        write(properties.out, weights);
+        write(properties.outDir + std::to_string(t) + ".dat", weights);
+        write(TrainingCheckpoint::filename(properties.outDir, t), checkpoint);
+        return success;
+    };
 
-                std::cout << "> " << std::setw(4) << t << " ("
-                          << std::setw(getNumberOfDigits(properties.train.batchSize)) << sampleResult.num + 1 << "/"
-                          << std::setw(getNumberOfDigits(properties.train.batchSize)) << properties.train.batchSize << "): "
-                          << std::setw(30) << sampleResult.filename << "\t"
-                          << std::setw(12) << sampleResult.upperBound << "\t"
-                          << std::setw(2) << sampleResult.numIter << "\t"
-                          << std::setw(2) << sampleResult.numIterGt << std::endl;
-                futures.pop_front();
+    // In asynchronous mode, every result is applied as soon as it is done and jobs always start from the latest
+    // weights, instead of waiting for the whole batch
+    bool const async = properties.train.async && !pStepSizeRule->perSample() && !pCoordinator;
+    if(properties.train.async && !async)
+        std::cout << "Asynchronous mode is only supported for local training without BCFW. Ignoring." << std::endl;
+    std::unordered_map<size_t, Weights> asyncGradients; //< Gradients of results that haven't been applied yet
+    size_t nextAsyncId = 0;
+    if(async)
+        pAsyncWeights = std::make_unique<AsyncWeights>(curWeights, properties.train.maxStaleness);
+    auto applyAsync = [&]()
+    {
+        std::vector<size_t> ids;
+        while(pAsyncWeights->nextGroup(ids))
+        {
+            Weights gradient = curWeights;
+            gradient *= 0.f;
+            uint32_t numValid = 0;
+            for(size_t id : ids)
+            {
+                auto iter = asyncGradients.find(id);
+                if(iter == asyncGradients.end())
+                    continue;
+                gradient += iter->second;
+                numValid++;
+                asyncGradients.erase(iter);
             }
+            if(numValid == 0)
+                continue;
+
+            gradient *= properties.train.C / numValid;
+            gradient += curWeights.regularized();
+            pStepSizeRule->update(curWeights, gradient);
+            curWeights.clampToFeasible();
+            pAsyncWeights->publish(curWeights);
         }
+    };
+    auto processSampleAsync = [&pAsyncWeights, &properties, numEnergyThreads, pLatentStore, &pConstraintCache]
+            (std::string const& filename, std::shared_ptr<TrainingSample const> const& pSample, size_t num)
+    {
+        size_t version;
+        WeightsSnapshot pWeights = pAsyncWeights->acquire(version);
+        SampleResult result = processSample(filename, pSample, pWeights, num, properties, numEnergyThreads,
+                                            pLatentStore, pConstraintCache.get());
+        result.version = version;
+        return result;
+    };
+
+    // Iterate T times
+    size_t numOutstanding = 0;
+    for(uint32_t t = properties.train.iter.start; t < properties.train.iter.start + T; ++t)
+    {
+        uint32_t N = 0;
+        Weights sum(properties.datasetPx.constants.numClasses, properties.datasetPx.constants.featDim, properties.datasetCluster.constants.featDim); // All zeros
+        Cost iterationEnergy = 0;
 
-        // Wait for remaining threads to finish
-        for(size_t n = 0; n < futures.size(); ++n)
+        // Accumulates the result of a single sample
+        bool weightsUpdated = false; // Per-sample updates since the last snapshot
+        auto consume = [&](SampleResult& sampleResult)
         {
-            auto sampleResult = futures[n].get();
             if(!sampleResult.valid)
             {
                 std::cerr << "Sample result \"" << sampleResult.filename << "\" was invalid. Cannot continue." << std::endl;
-                return INFERRED_INVALID;
+                return false;
+            }
+
+            // Filter out bad results
+            if (sampleResult.upperBound >= 0)
+            {
+                if(!async)
+                    sum += sampleResult.gradient;
+                iterationEnergy += sampleResult.upperBound;
+                N++;
+                if(pStepSizeRule->perSample())
+                {
+                    pStepSizeRule->updateSample(curWeights, sampleIndex[sampleResult.filename],
+                                                sampleResult.gradient, sampleResult.loss);
+                    weightsUpdated = true;
+                }
             }
 
             std::cout << "> " << std::setw(4) << t << " ("
@@ -428,17 +1210,113 @@ int main(int argc, char** argv)
                       << std::setw(30) << sampleResult.filename << "\t"
                       << std::setw(12) << sampleResult.upperBound << "\t"
                       << std::setw(2) << sampleResult.numIter << "\t"
-                      << std::setw(2) << sampleResult.numIterGt << std::endl;
+                      << std::setw(2) << sampleResult.numIterGt
+                      << (sampleResult.cached ? "\t(cached)" : "") << std::endl;
 
-            // Filter out bad results
-            if (sampleResult.upperBound >= 0)
+            MetricsLog::Record record("sample");
+            record.set("filename", sampleResult.filename)
+                  .set("iteration", t)
+                  .set("num", sampleResult.num)
+                  .set("worker", sampleResult.worker)
+                  .set("width", sampleResult.width)
+                  .set("height", sampleResult.height)
+                  .set("load_ms", loadMs[sampleResult.filename])
+                  .set("infer_ms", sampleResult.inferMs)
+                  .set("cached", sampleResult.cached)
+                  .set("iterations", sampleResult.numIter)
+                  .set("iterations_gt", sampleResult.numIterGt)
+                  .set("trws_iterations", sampleResult.numTrwsIter)
+                  .set("energy", sampleResult.energy)
+                  .set("lower_bound", sampleResult.lowerBound)
+                  .set("upper_bound", sampleResult.upperBound)
+                  .set("loss", sampleResult.loss)
+                  .set("peak_rss_mb", MetricsLog::peakRss() / (1024. * 1024.));
+            metrics.write(record);
+            metrics.itemDone();
+            loadMs.erase(sampleResult.filename);
+
+            if(async)
             {
-                sum += sampleResult.gradient;
-                iterationEnergy += sampleResult.upperBound;
-                N++;
+                size_t const id = nextAsyncId++;
+                if (sampleResult.upperBound >= 0)
+                    asyncGradients.emplace(id, std::move(sampleResult.gradient));
+                pAsyncWeights->finish(sampleResult.version, id);
+                applyAsync();
+            }
+            return true;
+        };
+
+        // All jobs of this iteration share the same immutable copy of the weights, unless they are updated per sample.
+        // Workers only receive new weights once per iteration.
+        WeightsSnapshot weightsSnapshot = curWeights.snapshot();
+        if(pCoordinator && !pCoordinator->sendWeights(curWeights))
+        {
+            std::cerr << "Couldn't send weights to the workers" << std::endl;
+            return NETWORK_ERROR;
+        }
+
+        // Iterate over all images. Results are consumed in the order they are done, so a slow image doesn't hold up
+        // the ones after it.
+        SampleResult sampleResult;
+        for (size_t i = 0; i < properties.train.batchSize; ++i)
+        {
+            LoadedTrainingSample sample;
+            if(!prefetchQueue.pop(sample))
+            {
+                std::cerr << "Sample loading stopped before all samples have been loaded" << std::endl;
+                return LOADING_STOPPED;
+            }
+            loadMs[sample.filename] = sample.loadMs;
+            // Snapshots copy all weights, only take a new one if a result has changed them since the last one
+            if(weightsUpdated)
+            {
+                weightsSnapshot = curWeights.snapshot();
+                weightsUpdated = false;
+            }
+
+            // Blocks if too many jobs are queued already
+            if(pCoordinator)
+            {
+                if(!pCoordinator->submit(sampleIndex[sample.filename], i))
+                {
+                    std::cerr << "Couldn't send sample \"" << sample.filename << "\" to its worker" << std::endl;
+                    return NETWORK_ERROR;
+                }
+            }
+            else
+            {
+                // Blocks until the sample fits into the memory budget. Its reservation is released by the job.
+                MemoryBudget::Reservation reservation;
+                if(sample.pSample)
+                    reservation = memoryBudget.acquire(estimateSampleMemory(properties, *sample.pSample));
+                if(async)
+                    pool.enqueueTo(completed, MemoryBudget::bind(std::move(reservation), processSampleAsync),
+                                   std::move(sample.filename), std::move(sample.pSample), i);
+                else
+                    pool.enqueueTo(completed, MemoryBudget::bind(std::move(reservation), processSample),
+                                   std::move(sample.filename), std::move(sample.pSample), weightsSnapshot, i,
+                                   std::cref(properties), numEnergyThreads, pLatentStore, pConstraintCache.get());
+            }
+            numOutstanding++;
+
+            while(completed.tryPop(sampleResult))
+            {
+                numOutstanding--;
+                if(!consume(sampleResult))
+                    return INFERRED_INVALID;
             }
         }
 
+        // Wait for remaining jobs to finish. In asynchronous mode they keep running into the next iteration, only wait
+        // until there is something to report.
+        bool const lastIteration = t + 1 == properties.train.iter.start + T;
+        for(; numOutstanding > 0 && (!async || lastIteration || N == 0); --numOutstanding)
+        {
+            completed.pop(sampleResult);
+            if(!consume(sampleResult))
+                return INFERRED_INVALID;
+        }
+
         if(N <= 0)
         {
             std::cerr << "There were no valid samples. Terminating..." << std::endl;
@@ -451,6 +1329,10 @@ int main(int argc, char** argv)
         auto regularizerCost = curWeights.regularized().sqNorm() / 2.f;
         iterationEnergy += regularizerCost;
         std::cout << "Current training energy: " << regularizerCost << " + " << upperBoundCost << " = " << iterationEnergy << std::endl;
+        std::cout << "Prefetch queue (" << loaderPool.size() << " loaders -> " << pool.size() << " workers): "
+                  << prefetchQueue.stats() << std::endl;
+        if(properties.memoryBudgetMB > 0)
+            std::cout << "Memory budget: " << memoryBudget.stats() << std::endl;
 
         // Log results of last iteration
         if(t % properties.logEvery == 0)
@@ -487,36 +1369,61 @@ int main(int argc, char** argv)
                 << std::setw(12) << stats.total.mag << std::endl;
         }
 
-        // Compute gradient
-        sum *= properties.train.C / N;
-        sum += curWeights.regularized();
-        // ... and update
-        pStepSizeRule->update(curWeights, sum);
+        if(!async)
+        {
+            // Compute gradient
+            sum *= properties.train.C / N;
+            sum += curWeights.regularized();
+            // ... and update
+            pStepSizeRule->update(curWeights, sum);
 
-        // Project onto the feasible set
-        curWeights.clampToFeasible();
+            // Project onto the feasible set. Not done for per-sample rules, as they rely on the weights being exactly
+            // the ones they computed.
+            if(!pStepSizeRule->perSample())
+                curWeights.clampToFeasible();
+        }
+        else
+            std::cout << "Updates applied so far: " << pAsyncWeights->version() << std::endl;
 
-        // Save to hard disk
+        // Save to hard disk. Only serialization happens here, writing is done in the background.
+        TrainingCursor iterationCursor;
+        {
+            std::lock_guard<std::mutex> lock(nextFileMutex);
+            iterationCursor = std::move(iterationCursors[t]);
+            iterationCursors.erase(iterationCursors.begin(), iterationCursors.upper_bound(t));
+        }
         if(t % properties.saveEvery == 0)
         {
-            if (!curWeights.write(properties.out))
+            if(pendingCheckpoint.valid() && !pendingCheckpoint.get())
             {
-                std::cerr << "Couldn't write weights to file \"" << properties.out << "\"" << std::endl;
                 log.close();
                 return CANT_WRITE_RESULT;
             }
-            std::string weightCopyFilename = properties.outDir + std::to_string(t + 1) + ".dat";
-            if(!curWeights.write(weightCopyFilename))
+            std::ostringstream weights(std::ios::out | std::ios::binary);
+            curWeights.write(weights);
+            pendingCheckpoint = checkpointPool.enqueue(writeCheckpoint,
+                                                       TrainingCheckpoint::serialize(curWeights, *pStepSizeRule,
+                                                                                     iterationCursor),
+                                                       weights.str(), t + 1);
+        }
+
+        // Stop once the duality gap is small enough. It only covers all samples once each of them has been visited.
+        if(pBCFW != nullptr)
+        {
+            float const gap = pBCFW->dualityGap();
+            std::cout << "Duality gap: " << gap << (pBCFW->allVisited() ? "" : " (not all samples visited yet)") << std::endl;
+            if(properties.train.gapEps > 0 && pBCFW->allVisited() && gap <= properties.train.gapEps)
             {
-                std::cerr << "Couldn't write weights to file \"" << weightCopyFilename << "\"" << std::endl;
-                log.close();
-                return CANT_WRITE_RESULT_BACKUP;
+                std::cout << "Duality gap is below " << properties.train.gapEps << ". Terminating..." << std::endl;
+                break;
             }
-            pStepSizeRule->write(properties.outDir);
         }
     }
 
     log.close();
 
+    if(pendingCheckpoint.valid() && !pendingCheckpoint.get())
+        return CANT_WRITE_RESULT;
+
     return SUCCESS;
 }
@@ -111,12 +111,13 @@ int main(int argc, char* argv[])
     cv::Rect bb = helper::image::computeValidBox(gt, properties.dataset.constants.numClasses);
     FeatureImage features_cropped(bb.width, bb.height, features.dim());
     LabelImage gt_cropped(bb.width, bb.height);
+    Feature scratch;
     for(Coord x = bb.x; x < bb.width; ++x)
     {
         for (Coord y = bb.y; y < bb.height; ++y)
         {
             gt_cropped.at(x - bb.x, y - bb.y) = gt.at(x, y);
-            features_cropped.at(x - bb.x, y - bb.y) = features.at(x, y);
+            features_cropped.at(x - bb.x, y - bb.y) = features.at(x, y, scratch);
         }
     }
 
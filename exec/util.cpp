@@ -35,6 +35,7 @@ PROPERTIES_DEFINE(Util,
                                PROP_DEFINE_A(std::string, stitchMarginals, "", --stitchMarginals)
                                PROP_DEFINE_A(std::string, createBasicFeatures, "", --createBasicFeatures)
                                PROP_DEFINE_A(std::string, mergeFeatures, "", --mergeFeatures)
+                               PROP_DEFINE_A(std::string, convertFeatures, "", --convertFeatures)
                                PROP_DEFINE_A(std::string, testIterationProgress, "", --testIterationProgress)
                                PROP_DEFINE_A(std::string, symmetryCheck, "", --symmetryCheck)
                                PROP_DEFINE_A(std::string, prepCityscapesGt, "", --prepCityscapesGt)
@@ -80,6 +81,10 @@ PROPERTIES_DEFINE(Util,
                           PROP_DEFINE_A(std::string, first, "", --first)
                           PROP_DEFINE_A(std::string, second, "", --second)
                   )
+                  GROUP_DEFINE(convertFeatures,
+                          PROP_DEFINE_A(std::string, precision, "single", --precision)
+                          PROP_DEFINE_A(std::string, extension, ".hsegfeat", --ext)
+                  )
                   GROUP_DEFINE(figureGroundToPascal,
                           PROP_DEFINE_A(Label, groundLabel, 0, --ground)
                           PROP_DEFINE_A(Label, figureLabel, 1, --figure)
@@ -1152,10 +1157,11 @@ bool mergeFeatures(UtilProperties const& properties)
         }
 
         FeatureImage res(feat1.width(), feat1.height(), feat1.dim() + feat2.dim());
+        Feature scratch1, scratch2;
         for(size_t i = 0; i < res.height() * res.width(); ++i)
         {
             Feature f = Feature::Zero(res.dim());
-            f << feat1.atSite(i) , feat2.atSite(i);
+            f << feat1.atSite(i, scratch1) , feat2.atSite(i, scratch2);
             res.atSite(i) = f;
         }
 
@@ -1173,6 +1179,45 @@ bool mergeFeatures(UtilProperties const& properties)
     return true;
 }
 
+bool convertFeatures(UtilProperties const& properties)
+{
+    FeatureImage::Precision precision;
+    if(!FeatureImage::parsePrecision(properties.convertFeatures.precision, precision))
+    {
+        std::cerr << "Invalid feature precision \"" << properties.convertFeatures.precision << "\"" << std::endl;
+        return false;
+    }
+
+    // Read in file names
+    std::vector<std::string> listfile = readLines(properties.job.convertFeatures);
+    std::cout << listfile.size() << " images." << std::endl;
+
+    for(auto const& filename : listfile)
+    {
+        std::cout << filename << ": ";
+
+        std::string const inFilename = properties.in + filename + properties.datasetPx.extension.img;
+        FeatureImage features;
+        if(!features.read(inFilename, precision))
+        {
+            std::cerr << "Unable to read features from \"" << inFilename << "\"" << std::endl;
+            return false;
+        }
+
+        std::string const outFilename = properties.out + filename + properties.convertFeatures.extension;
+        if(!features.writeNative(outFilename))
+        {
+            std::cout << "ERROR" << std::endl;
+            std::cerr << "Unable to write feature map \"" << outFilename << "\"." << std::endl;
+            return false;
+        }
+
+        std::cout << " OK!" << std::endl;
+    }
+
+    return true;
+}
+
 bool testIterationProgress(UtilProperties const& properties)
 {
     // Read in file names
@@ -1226,13 +1271,14 @@ bool testIterationProgress(UtilProperties const& properties)
         FeatureImage features_cropped(bb.width, bb.height, featuresPx.dim());
         FeatureImage features_cluster_cropped(bb.width, bb.height, featuresCluster.dim());
         LabelImage gt_cropped(bb.width, bb.height);
+        Feature scratch;
         for(Coord x = bb.x; x < bb.width; ++x)
         {
             for (Coord y = bb.y; y < bb.height; ++y)
             {
                 gt_cropped.at(x - bb.x, y - bb.y) = gt.at(x, y);
-                features_cropped.at(x - bb.x, y - bb.y) = featuresPx.at(x, y);
-                features_cluster_cropped.at(x - bb.x, y - bb.y) = featuresCluster.at(x, y);
+                features_cropped.at(x - bb.x, y - bb.y) = featuresPx.at(x, y, scratch);
+                features_cluster_cropped.at(x - bb.x, y - bb.y) = featuresCluster.at(x, y, scratch);
             }
         }
 
@@ -1519,6 +1565,9 @@ int main(int argc, char** argv)
     if(!properties.job.mergeFeatures.empty())
         mergeFeatures(properties);
 
+    if(!properties.job.convertFeatures.empty())
+        convertFeatures(properties);
+
     if(!properties.job.testIterationProgress.empty())
         testIterationProgress(properties);
 
@@ -0,0 +1,161 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#ifndef HSEG_DATASETCACHE_H
+#define HSEG_DATASETCACHE_H
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <unordered_map>
+#include <Image/FeatureImage.h>
+#include <Image/Image.h>
+
+/**
+ * A training sample after preprocessing, i.e. rescaled and cropped to the region with valid ground truth
+ */
+struct TrainingSample
+{
+    FeatureImage pxFeatures;
+    FeatureImage clusterFeatures;
+    LabelImage gt;
+};
+
+/**
+ * Describes where the raw samples are located and how they are preprocessed
+ */
+struct TrainingSampleSource
+{
+    std::string pxPath;
+    std::string pxExtension;
+    std::string clusterPath;
+    std::string clusterExtension;
+    std::string gtPath;
+    std::string gtExtension;
+    float scaleFactor = 1.f;
+    Label numClasses = 21;
+    FeatureImage::Precision precision = FeatureImage::Precision::Single;
+};
+
+/**
+ * Stores preprocessed training samples in a binary file, such that reading, rescaling and cropping only has to be done
+ * once. The file name contains a hash of the sample paths, and a hash of the preprocessing configuration and of the file
+ * list, thus a cache is never reused if either of them changes. Building a cache removes the ones it supersedes, i.e.
+ * those of the same sample paths.
+ *
+ * Samples are either served from a memory mapping of the file or, if there is enough memory available, kept resident.
+ * Mapped samples reference the features within the mapping instead of copying them.
+ */
+class DatasetCache
+{
+public:
+    DatasetCache() = default;
+
+    DatasetCache(DatasetCache const&) = delete;
+
+    DatasetCache& operator=(DatasetCache const&) = delete;
+
+    ~DatasetCache();
+
+    /**
+     * Reads and preprocesses a single sample from the raw files
+     * @param source Sample source
+     * @param filename Name of the sample (without path or extension)
+     * @param outSample The preprocessed sample is stored here
+     * @return True in case of success, otherwise false
+     */
+    static bool preprocess(TrainingSampleSource const& source, std::string const& filename, TrainingSample& outSample);
+
+    /**
+     * Computes the name of the cache file for a given configuration
+     * @param cacheDir Directory to store cache files in
+     * @param source Sample source
+     * @param filenames List of samples
+     * @return The file name
+     */
+    static std::string cacheFilename(std::string const& cacheDir, TrainingSampleSource const& source,
+                                     std::vector<std::string> const& filenames);
+
+    /**
+     * Preprocesses all samples and writes them to a cache file. The file is written to a temporary location first and
+     * only moved to \p cacheFile when complete. Afterwards, other caches of the same sample paths are deleted.
+     * @param cacheFile File to write
+     * @param source Sample source
+     * @param filenames List of samples
+     * @param numThreads Amount of threads to use for preprocessing
+     * @return True in case of success, otherwise false
+     */
+    static bool build(std::string const& cacheFile, TrainingSampleSource const& source,
+                      std::vector<std::string> const& filenames, uint32_t numThreads);
+
+    /**
+     * Opens a cache file
+     * @param cacheFile File to open
+     * @param residentBudget If the file is smaller than this amount of bytes and there is enough physical memory
+     *                       available, all samples are decoded and kept in memory
+     * @return True in case of success, otherwise false
+     */
+    bool open(std::string const& cacheFile, size_t residentBudget);
+
+    /**
+     * Closes the cache
+     */
+    void close();
+
+    /**
+     * Provides a sample. Samples of a mapped cache keep the mapping alive, even if the cache is closed.
+     * @param filename Name of the sample
+     * @return The sample or nullptr if it is not in the cache
+     */
+    std::shared_ptr<TrainingSample const> get(std::string const& filename) const;
+
+    /**
+     * Provides the size of a sample without decoding it
+     * @param filename Name of the sample
+     * @param outWidth Width of the preprocessed sample
+     * @param outHeight Height of the preprocessed sample
+     * @return False if the sample is not in the cache, otherwise true
+     */
+    bool dimensions(std::string const& filename, Coord& outWidth, Coord& outHeight) const;
+
+    /**
+     * @return Amount of samples in the cache
+     */
+    size_t size() const;
+
+    /**
+     * @return True if all samples are held in memory
+     */
+    bool resident() const;
+
+private:
+    struct Entry
+    {
+        uint64_t offset;
+        uint64_t size;
+    };
+
+    std::shared_ptr<void const> m_pMapping;
+    char const* m_pData = nullptr;
+    size_t m_dataSize = 0;
+    std::unordered_map<std::string, Entry> m_index;
+    std::unordered_map<std::string, std::shared_ptr<TrainingSample const>> m_resident;
+
+    /**
+     * @param source Sample source
+     * @return Beginning of the names of all cache files of the sample paths of \p source
+     */
+    static std::string cachePrefix(TrainingSampleSource const& source);
+
+    /**
+     * Reads a sample from the mapped file
+     * @param entry Location of the sample
+     * @param outSample The sample is stored here
+     * @param copy If true, the features are copied. Otherwise they reference the mapping.
+     * @return True in case of success, otherwise false
+     */
+    bool decode(Entry const& entry, TrainingSample& outSample, bool copy) const;
+};
+
+#endif //HSEG_DATASETCACHE_H
@@ -25,6 +25,10 @@ public:
 
     bool read(std::string const& folder, size_t t) override;
 
+    bool writeState(std::ostream& out) const override;
+
+    bool readState(std::istream& in) override;
+
 private:
     float const m_alpha;
     float const m_beta1;
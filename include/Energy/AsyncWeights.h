@@ -0,0 +1,74 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#ifndef HSEG_ASYNCWEIGHTS_H
+#define HSEG_ASYNCWEIGHTS_H
+
+#include <map>
+#include <set>
+#include <mutex>
+#include <vector>
+#include "Weights.h"
+
+/**
+ * Weights that are shared between one thread applying updates and many jobs computing gradients asynchronously.
+ * Jobs pull the latest published snapshot when they start, the updating thread publishes a new one after every update.
+ *
+ * Staleness of a gradient is the amount of updates published between the start of its job and the time it is
+ * applied. If it is bounded, updates are held back while a job is about to exceed the bound. Results that were
+ * computed on the same version are applied as a single update, which keeps this free of deadlocks.
+ */
+class AsyncWeights
+{
+public:
+    /**
+     * Constructor
+     * @param initial Initial weights
+     * @param maxStaleness Maximum staleness of an applied gradient. 0 means unbounded.
+     */
+    AsyncWeights(Weights const& initial, size_t maxStaleness);
+
+    /**
+     * Called by a job before it starts computing
+     * @param outVersion Version of the returned weights. Has to be handed to finish() once the job is done.
+     * @return The latest weights
+     */
+    WeightsSnapshot acquire(size_t& outVersion);
+
+    /**
+     * Marks the result of a job as ready to be applied
+     * @param version Version the job has been started with
+     * @param id Identifies the result for the caller
+     */
+    void finish(size_t version, size_t id);
+
+    /**
+     * Determines the next results that can be applied without exceeding the staleness bound. They are removed from
+     * the set of pending results.
+     * @param outIds Ids of the results to apply as a single update
+     * @return True if there are results to apply, otherwise false
+     */
+    bool nextGroup(std::vector<size_t>& outIds);
+
+    /**
+     * Publishes updated weights to jobs starting from now on
+     * @param weights New weights
+     */
+    void publish(Weights const& weights);
+
+    /**
+     * @return Amount of updates published so far
+     */
+    size_t version() const;
+
+private:
+    size_t const m_maxStaleness;
+    size_t m_version = 0;
+    WeightsSnapshot m_latest;
+    std::multiset<size_t> m_running; //< Versions of all jobs that have been started but are not finished
+    std::multimap<size_t, size_t> m_pending; //< Maps version to ids of finished results not applied yet
+    mutable std::mutex m_mutex;
+};
+
+#endif //HSEG_ASYNCWEIGHTS_H
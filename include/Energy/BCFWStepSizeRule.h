@@ -0,0 +1,85 @@
+/**********************************************************
+ * @file   BCFWStepSizeRule.h
+ * @author jan
+ * @date   18.10.26
+ * ********************************************************
+ * @brief
+ * @details
+ **********************************************************/
+#ifndef HSEG_BCFWSTEPSIZERULE_H
+#define HSEG_BCFWSTEPSIZERULE_H
+
+#include <memory>
+#include <vector>
+#include "Energy/Weights.h"
+#include <Energy/IStepSizeRule.h>
+#include <cstddef>
+
+/**
+ * Block-coordinate Frank-Wolfe (Lacoste-Julien et al., 2013) on the SSVM objective
+ *     1/2 ||w - w0||^2 + C/n sum_i H_i(w)
+ * where w0 is the origin of the regularizer (see Weights::regularized()). Every sample owns a dual block (v_i, l_i),
+ * the weights are w = w0 + sum_i v_i. Every oracle call is followed by an exact line search on its block, which never
+ * decreases the dual objective. The sum of the per-block gaps is an estimate of the duality gap.
+ */
+class BCFWStepSizeRule : public IStepSizeRule
+{
+public:
+    BCFWStepSizeRule(float C, size_t numSamples, size_t numClasses, size_t featDimPx, size_t featDimCluster,
+                     size_t t = 0) noexcept;
+
+    /**
+     * Only marks the end of an iteration, all updates are done in updateSample()
+     */
+    void update(Weights& w, Weights const& gradient) override;
+
+    bool perSample() const override;
+
+    void updateSample(Weights& w, size_t sample, Weights const& gradient, Cost loss) override;
+
+    bool write(std::string const& folder) override;
+
+    bool read(std::string const& folder, size_t t) override;
+
+    bool writeState(std::ostream& out) const override;
+
+    bool readState(std::istream& in) override;
+
+    /**
+     * Replaces the weights by the ones represented by the dual blocks
+     * @param w Weights to overwrite
+     */
+    void initialize(Weights& w) const;
+
+    /**
+     * @return Sum of the gaps of all blocks, each one computed the last time the block has been visited
+     */
+    float dualityGap() const;
+
+    /**
+     * @return True if every block has been visited at least once, i.e. dualityGap() covers all samples
+     */
+    bool allVisited() const;
+
+private:
+    float const m_C;
+    size_t const m_numClasses;
+    size_t const m_featDimPx;
+    size_t const m_featDimCluster;
+    size_t m_t = 0;
+    Weights m_w0; //< Origin of the regularizer
+    Weights m_v; //< Sum of all blocks
+    std::vector<std::unique_ptr<Weights>> m_blocks; //< Null until a block is visited for the first time
+    std::vector<Cost> m_blockLoss;
+    std::vector<Cost> m_blockGap;
+    size_t m_numVisited = 0;
+
+    Weights zero() const;
+
+    bool writeBlocks(std::ostream& out) const;
+
+    bool readBlocks(std::istream& in);
+};
+
+
+#endif //HSEG_BCFWSTEPSIZERULE_H
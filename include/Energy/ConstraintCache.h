@@ -0,0 +1,75 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#ifndef HSEG_CONSTRAINTCACHE_H
+#define HSEG_CONSTRAINTCACHE_H
+
+#include <string>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include "SparseWeights.h"
+
+/**
+ * Working set of the most recent loss-augmented predictions of every training image. Every constraint consists of the
+ * difference of the joint features of ground truth and prediction and the loss of the prediction, thus its violation
+ * for any weights is just a dot product away. All methods are thread-safe.
+ */
+class ConstraintCache
+{
+public:
+    /**
+     * Constructor
+     * @param maxConstraints Maximum amount of constraints per image. If exceeded, the oldest one is dropped.
+     */
+    explicit ConstraintCache(size_t maxConstraints);
+
+    /**
+     * Registers a visit of an image
+     * @param name Name of the image
+     * @return Amount of previous visits
+     */
+    size_t visit(std::string const& name);
+
+    /**
+     * Finds the cached constraint of an image with the largest violation
+     * @param name Name of the image
+     * @param w Current weights
+     * @param outGradient Joint feature difference of the constraint is stored here
+     * @param outLoss Loss of the constraint is stored here
+     * @param outViolation Violation of the constraint, i.e. loss + w * gradient, is stored here
+     * @return True if there was a constraint for this image, otherwise false
+     */
+    bool mostViolated(std::string const& name, Weights const& w, Weights& outGradient, Cost& outLoss,
+                      Cost& outViolation) const;
+
+    /**
+     * Adds a constraint to the working set of an image
+     * @param name Name of the image
+     * @param gradient Difference of the joint features of ground truth and prediction
+     * @param loss Loss of the prediction
+     */
+    void add(std::string const& name, Weights const& gradient, Cost loss);
+
+private:
+    struct Constraint
+    {
+        SparseWeights gradient;
+        Cost loss;
+    };
+
+    struct Entry
+    {
+        std::deque<std::shared_ptr<Constraint const>> constraints;
+        size_t visits = 0;
+    };
+
+    size_t m_maxConstraints;
+    std::unordered_map<std::string, Entry> m_entries;
+    mutable std::mutex m_mutex;
+};
+
+
+#endif //HSEG_CONSTRAINTCACHE_H
@@ -23,6 +23,10 @@ public:
 
     bool read(std::string const& folder, size_t t) override;
 
+    bool writeState(std::ostream& out) const override;
+
+    bool readState(std::istream& in) override;
+
 private:
     size_t m_t = 0;
     float const m_base = 1.f;
@@ -38,13 +38,20 @@ public:
     /**
      * Computes the overall energy by weights. I.e. to compute the actual energy, the result needs to be multiplied by
      * the weights vector.
+     * @details Sites are split into blocks of at most s_reductionGrain sites by recursive halving. Every block is
+     *          accumulated into its own (thread-local) weights vector, and the blocks are summed up along the same
+     *          binary tree. The shape of that tree only depends on the amount of pixels, therefore the result is
+     *          bit-identical regardless of \p numThreads. If called from a job of a ThreadPool, the blocks are run as
+     *          tasks of that pool rather than on new threads.
      * @param pxFeat Feature image
      * @param labeling Labeling of the image
      * @param clustering Clustering of the image
      * @param clusters Cluster data
+     * @param gt Ground truth. Pixels that are invalid in the ground truth are ignored. Set to nullptr to consider all.
+     * @param numThreads Amount of threads to split the sites across
      * @return The energy of the given configuration by weights
      */
-    Weights giveEnergyByWeight(FeatureImage const& pxFeat, FeatureImage const& clusterFeat, LabelImage const& labeling, LabelImage const& clustering, std::vector<Cluster> const& clusters, LabelImage const* gt = nullptr) const;
+    Weights giveEnergyByWeight(FeatureImage const& pxFeat, FeatureImage const& clusterFeat, LabelImage const& labeling, LabelImage const& clustering, std::vector<Cluster> const& clusters, LabelImage const* gt = nullptr, unsigned int numThreads = 1) const;
 
     /**
     * Computes the unary energy by weights
@@ -80,8 +87,23 @@ public:
      * @param clustering Clustering of the image
      * @param clusters Cluster data
      * @param features Image features
+     * @param numThreads Amount of threads to split the sites across. Every thread writes to a disjoint slice of
+     *                   \p outGradients.
      */
-    void computeFeatureGradient(FeatureImage& outGradients, LabelImage const& labeling, LabelImage const& clustering, std::vector<Cluster> const& clusters, FeatureImage const& features) const;
+    void computeFeatureGradient(FeatureImage& outGradients, LabelImage const& labeling, LabelImage const& clustering, std::vector<Cluster> const& clusters, FeatureImage const& features, unsigned int numThreads = 1) const;
+
+    /**
+     * Computes the gradient of the energy function with respect to the features. Sites are grouped by the labels of
+     * themselves, their neighbors and their cluster. All sites of a group share the same sum of weight slices, so it
+     * is computed only once per group and the feature dependent part is applied to the whole group at once.
+     * @param outGradients Gradients are stored here, one column per site. Will be resized if necessary.
+     * @param labeling Class labeling
+     * @param clustering Clustering of the image
+     * @param clusters Cluster data
+     * @param features Image features
+     * @param numThreads Amount of threads to split the sites across
+     */
+    void computeFeatureGradient(Eigen::MatrixXf& outGradients, LabelImage const& labeling, LabelImage const& clustering, std::vector<Cluster> const& clusters, FeatureImage const& features, unsigned int numThreads = 1) const;
 
     /**
      * @return Amount of classes
@@ -195,7 +217,20 @@ public:
         return m_usePairwise;
     }
 
+    /**
+     * Maximum amount of sites that are accumulated serially by giveEnergyByWeight()
+     */
+    static constexpr SiteId s_reductionGrain = 16384;
+
 protected:
+    void computeUnaryEnergyByWeight(SiteId begin, SiteId end, FeatureImage const& features, LabelImage const& labeling, Weights& energyW, LabelImage const* gt) const;
+
+    void computePairwiseEnergyByWeight(SiteId begin, SiteId end, FeatureImage const& features, LabelImage const& labeling, Weights& energyW, LabelImage const* gt) const;
+
+    void computeHigherOrderEnergyByWeight(SiteId begin, SiteId end, FeatureImage const& features, LabelImage const& labeling, LabelImage const& clustering, std::vector<Cluster> const& clusters, Weights& energyW, LabelImage const* gt) const;
+
+    void computeFeatureGradient(SiteId i, Feature& outGradient, LabelImage const& labeling, LabelImage const& clustering, std::vector<Cluster> const& clusters, FeatureImage const& features, Feature& scratch) const;
+
     Weights const* m_pWeights;
     ClusterId m_numClusters;
     bool m_usePairwise;
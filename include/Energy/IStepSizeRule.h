@@ -9,6 +9,10 @@
 #ifndef HSEG_ISTEPSIZERULE_H
 #define HSEG_ISTEPSIZERULE_H
 
+#include <string>
+#include <iosfwd>
+#include <typedefs.h>
+
 class Weights;
 
 class IStepSizeRule
@@ -16,9 +20,42 @@ class IStepSizeRule
 public:
     virtual void update(Weights& w, Weights const& gradient) = 0;
 
+    /**
+     * @return True if the rule updates the weights after every sample via updateSample() instead of once per batch
+     */
+    virtual bool perSample() const
+    {
+        return false;
+    }
+
+    /**
+     * Updates the weights with the oracle result of a single sample. Only called if perSample() returns true.
+     * @param w Weights to update
+     * @param sample Index of the sample in the training set
+     * @param gradient Difference of the joint features of ground truth and loss-augmented prediction
+     * @param loss Loss of the loss-augmented prediction
+     */
+    virtual void updateSample(Weights& /*w*/, size_t /*sample*/, Weights const& /*gradient*/, Cost /*loss*/)
+    {
+    }
+
     virtual bool write(std::string const& folder) = 0;
 
     virtual bool read(std::string const& folder, size_t t) = 0;
+
+    /**
+     * Writes the complete state of the rule, including the iteration counter, to a binary stream
+     * @param out Stream to write to
+     * @return True in case of success, otherwise false
+     */
+    virtual bool writeState(std::ostream& out) const = 0;
+
+    /**
+     * Restores a state written by writeState()
+     * @param in Stream to read from
+     * @return True in case of success, otherwise false
+     */
+    virtual bool readState(std::istream& in) = 0;
 };
 
 #endif //HSEG_ISTEPSIZERULE_H
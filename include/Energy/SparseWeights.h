@@ -0,0 +1,51 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#ifndef HSEG_SPARSEWEIGHTS_H
+#define HSEG_SPARSEWEIGHTS_H
+
+#include <vector>
+#include <utility>
+#include "Weights.h"
+
+/**
+ * Sparse representation of a weights vector that only keeps weight vectors which are not all zero. Joint feature
+ * vectors of a single image usually only touch the weights of the few classes that occur in it.
+ */
+class SparseWeights
+{
+public:
+    SparseWeights() = default;
+
+    /**
+     * Constructs the sparse representation of dense weights
+     * @param dense Dense weights
+     */
+    explicit SparseWeights(Weights const& dense);
+
+    /**
+     * Dot-product
+     * @param dense Dense weights, must have the dimensions of the weights this has been constructed from
+     * @return Result
+     */
+    Weight operator*(Weights const& dense) const;
+
+    /**
+     * Adds these weights to dense weights
+     * @param dense Dense weights to add to
+     * @param factor Factor to multiply every weight with before adding
+     */
+    void addTo(Weights& dense, float factor = 1.f) const;
+
+    /**
+     * @return Approximate amount of memory used in bytes
+     */
+    size_t bytes() const;
+
+private:
+    std::vector<std::pair<uint32_t, WeightVec>> m_vectors; //< Non-zero vectors and their index
+};
+
+
+#endif //HSEG_SPARSEWEIGHTS_H
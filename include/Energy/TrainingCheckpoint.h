@@ -0,0 +1,73 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#ifndef HSEG_TRAININGCHECKPOINT_H
+#define HSEG_TRAININGCHECKPOINT_H
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "Weights.h"
+#include "IStepSizeRule.h"
+
+/**
+ * Position in the stream of training samples
+ */
+struct TrainingCursor
+{
+    std::vector<uint32_t> order; //< Permutation of the training set that is currently visited
+    uint64_t pos = 0; //< Index into order of the next sample
+    std::string rngState; //< Textual state of the random engine used for shuffling
+};
+
+/**
+ * Single file that holds everything needed to resume training exactly where it stopped: weights, state of the step
+ * size rule and the sample cursor. Every part is stored as a length-prefixed section, so a checkpoint that was written
+ * with a different step size rule is detected.
+ * The latent states kept for warm starts (LatentStateStore) and the cached constraints (ConstraintCache) are not part
+ * of the checkpoint. After resuming, inference starts cold and the constraint caches are empty, thus resuming is only
+ * exact with train.warmStart disabled and train.constraints.size set to 0.
+ */
+class TrainingCheckpoint
+{
+public:
+    /**
+     * @param folder Output folder
+     * @param t Iteration the checkpoint resumes at
+     * @return Filename of the checkpoint
+     */
+    static std::string filename(std::string const& folder, size_t t);
+
+    /**
+     * Serializes a checkpoint into memory. This is cheap compared to writing it to disk, thus it can be done on the
+     * training thread while the actual write happens in the background.
+     * @param weights Current weights
+     * @param rule Current step size rule
+     * @param cursor Cursor of the next sample
+     * @return The serialized checkpoint
+     */
+    static std::string serialize(Weights const& weights, IStepSizeRule const& rule, TrainingCursor const& cursor);
+
+    /**
+     * Reads a checkpoint
+     * @param filename File to read from
+     * @param outWeights Weights are stored here. Dimensions have to match.
+     * @param outRule The state of the step size rule is restored here
+     * @param outCursor The cursor is stored here
+     * @return True in case of success, otherwise false
+     */
+    static bool read(std::string const& filename, Weights& outWeights, IStepSizeRule& outRule,
+                     TrainingCursor& outCursor);
+
+    /**
+     * Writes data to a temporary file next to the target, syncs it and renames it to the target. Readers will either
+     * see the old or the new file, never a partially written one.
+     * @param filename Target file
+     * @param bytes Data to write
+     * @return True in case of success, otherwise false
+     */
+    static bool writeAtomic(std::string const& filename, std::string const& bytes);
+};
+
+#endif //HSEG_TRAININGCHECKPOINT_H
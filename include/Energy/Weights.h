@@ -7,6 +7,7 @@
 
 #include <iostream>
 #include <vector>
+#include <memory>
 #include <Image/Image.h>
 #include <typedefs.h>
 
@@ -43,8 +44,24 @@ private:
     std::vector<WeightVec> m_featureWeights;
 
     friend class EnergyFunction;
+    friend class SparseWeights;
     friend std::ostream& operator<<(std::ostream& stream, Weights const& weights);
 
+    /**
+     * @return Amount of weight vectors in all groups together
+     */
+    size_t numVectors() const;
+
+    /**
+     * Accesses weight vectors by an index that runs over unary, pairwise, higher order and feature weights in this
+     * order
+     * @param i Index
+     * @return The weight vector
+     */
+    WeightVec const& vector(size_t i) const;
+
+    WeightVec& vector(size_t i);
+
 public:
     /**
      * Default-constructs a weights vector (all zeros)
@@ -67,6 +84,22 @@ public:
         return m_unaryWeights.size();
     }
 
+    /**
+     * @return Dimensionality of the pixel features
+     */
+    inline size_t featDimPx() const
+    {
+        return m_unaryWeights[0].size() - 1;
+    }
+
+    /**
+     * @return Dimensionality of the cluster features
+     */
+    inline size_t featDimCluster() const
+    {
+        return m_featureWeights[0].size();
+    }
+
     /**
      * Weight of the unary term
      * @param l Class label
@@ -144,6 +177,11 @@ public:
         return m_featureWeights[index];
     }
 
+    /**
+     * Sets all elements to zero
+     */
+    void setZero();
+
     /**
      * Sqares all elements;
      */
@@ -188,6 +226,35 @@ public:
      */
     bool read(std::string const& filename);
 
+    /**
+     * Writes the weights vector to a binary stream, in the same format as write(std::string const&)
+     * @param out Stream to write to
+     * @return True in case of success, otherwise false
+     */
+    bool write(std::ostream& out) const;
+
+    /**
+     * Reads the weights vector from a binary stream
+     * @param in Stream to read from
+     * @return True in case of success, otherwise false
+     */
+    bool read(std::istream& in);
+
+    /**
+     * Writes only the weight vectors that are not all zero to a binary stream
+     * @param out Stream to write to
+     * @return True in case of success, otherwise false
+     */
+    bool writeSparse(std::ostream& out) const;
+
+    /**
+     * Reads weights written by writeSparse(). Dimensions have to match the ones of this object. Vectors that are not
+     * contained in the stream are set to zero.
+     * @param in Stream to read from
+     * @return True in case of success, otherwise false
+     */
+    bool readSparse(std::istream& in);
+
     /**
      * Provides the mean values of the unary, pairwise, label consistency, feature similarity, and total weights
      * @return Mean weights
@@ -289,8 +356,18 @@ public:
      * @return true if feature weights are symmetric
      */
     bool isFeatureSymmetric() const;
+
+    /**
+     * @return An immutable copy of the current weights that can be shared among threads
+     */
+    std::shared_ptr<Weights const> snapshot() const;
 };
 
+/**
+ * Immutable, reference counted weights. Cheap to copy, therefore it can be handed to every job of a thread pool.
+ */
+using WeightsSnapshot = std::shared_ptr<Weights const>;
+
 std::ostream& operator<<(std::ostream& stream, Weights const& weights);
 
 
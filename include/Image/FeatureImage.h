@@ -7,6 +7,8 @@
 
 #include <string>
 #include <vector>
+#include <memory>
+#include <ostream>
 #include <typedefs.h>
 #include <opencv2/opencv.hpp>
 #include "Feature.h"
@@ -14,16 +16,105 @@
 class FeatureImage
 {
 public:
+    /**
+     * Storage precision of the features. Computations are always carried out in single precision, reduced precision
+     * features are widened on access.
+     */
+    enum class Precision
+    {
+        Single,   //< 32 bit IEEE float
+        Half,     //< 16 bit IEEE float
+        BFloat16, //< 16 bit brain float (float with truncated mantissa)
+    };
+
     FeatureImage() = default;
 
     FeatureImage(Coord width, Coord height, Coord dim);
 
-    FeatureImage(std::string const& filename);
+    FeatureImage(std::string const& filename, Precision precision = Precision::Single);
+
+    /**
+     * Reads a feature map from a native feature file (see writeNative()) or, if it isn't one, from a .mat file. Native
+     * files that already have the requested precision are mapped into memory and used as storage directly, the
+     * features are only copied once the image is modified.
+     * @param filename File to read from
+     * @param precision Precision to store the features in
+     * @return True in case of success, otherwise false
+     */
+    bool read(std::string const& filename, Precision precision = Precision::Single);
+
+    /**
+     * Writes the feature map in the native format: A small header followed by the features of all pixels in their
+     * storage precision, pixel after pixel. Such a file can be mapped into memory and read without reordering.
+     * @param filename File to write to
+     * @return True in case of success, otherwise false
+     */
+    bool writeNative(std::string const& filename) const;
+
+    /**
+     * Checks whether a file is a native feature file by looking at its header
+     * @param filename File to check
+     * @return True if the file is a native feature file, otherwise false
+     */
+    static bool isNative(std::string const& filename);
 
-    bool read(std::string const& filename);
+    /**
+     * Reads the dimensions of a feature map from the header of a native feature file or from the variable header of a
+     * .mat file without reading the features
+     * @param filename File to read from
+     * @param outWidth Width of the feature map
+     * @param outHeight Height of the feature map
+     * @param outDim Feature dimensionality
+     * @return True in case of success, otherwise false
+     */
+    static bool readDimensions(std::string const& filename, Coord& outWidth, Coord& outHeight, Coord& outDim);
 
     bool write(std::string const& filename);
 
+    /**
+     * Writes the features in their storage precision to a binary stream
+     * @param out Stream to write to
+     * @return True in case of success, otherwise false
+     */
+    bool writeBinary(std::ostream& out) const;
+
+    /**
+     * Reads features written by writeBinary() from memory
+     * @param data Buffer to read from
+     * @param size Size of the buffer in bytes
+     * @return Amount of bytes consumed, or 0 in case of failure
+     */
+    size_t readBinary(char const* data, size_t size);
+
+    /**
+     * Views features written by writeBinary() in memory that is kept alive by \p pOwner, without copying them. The
+     * image behaves like one mapped from a native file. If the features aren't suitably aligned, they are copied.
+     * @param pOwner Owner of the memory \p data points into
+     * @param data Buffer to read from
+     * @param size Size of the buffer in bytes
+     * @return Amount of bytes consumed, or 0 in case of failure
+     */
+    size_t readBinary(std::shared_ptr<void const> pOwner, char const* data, size_t size);
+
+    /**
+     * Converts the stored features to another precision
+     * @param precision New precision
+     */
+    void convert(Precision precision);
+
+    /**
+     * @return The precision the features are stored in
+     */
+    Precision precision() const;
+
+    /**
+     * Parses a precision from its name ("single", "half" or "bfloat16")
+     * @param name Name of the precision
+     * @param outPrecision The parsed precision is stored here
+     * @return True in case of success, otherwise false
+     */
+    static bool parsePrecision(std::string const& name, Precision& outPrecision);
+
     Coord width() const;
 
     Coord height() const;
@@ -34,18 +125,43 @@ public:
      */
     Coord dim() const;
 
+    /**
+     * Direct access to a feature. Only available if the features are stored in single precision, otherwise
+     * std::logic_error is thrown. Read-only access also throws for features mapped from a native file, as they aren't
+     * stored as Feature objects. Write access copies mapped features into the own storage first.
+     * @param x X coordinate
+     * @param y Y coordinate
+     * @return The feature at the given coordinate
+     */
     Feature const& at(Coord x, Coord y) const;
 
     Feature& at(Coord x, Coord y);
 
+    /**
+     * Read access to a feature that works with every precision
+     * @param x X coordinate
+     * @param y Y coordinate
+     * @param scratch Buffer to widen reduced precision features into
+     * @return The feature at the given coordinate. Either references \p scratch or the stored feature. Mapped features
+     *         are always copied into \p scratch.
+     */
+    Feature const& at(Coord x, Coord y, Feature& scratch) const;
+
     Feature const& atSite(SiteId i) const;
 
     Feature& atSite(SiteId i);
 
+    Feature const& atSite(SiteId i, Feature& scratch) const;
+
     std::vector<Feature>& data();
 
     std::vector<Feature> const& data() const;
 
+    /**
+     * Subtracts \p other from this image. Only available if both images are stored in single precision, otherwise
+     * std::logic_error is thrown.
+     * @param other Image to subtract
+     */
     void subtract(FeatureImage const& other);
 
     explicit operator cv::Mat() const;
@@ -70,7 +186,17 @@ public:
     void flipHorizontally();
 
     /**
-     * Copy features from \p other to destination, adding them to old values. Ignores features that would be out of bounds.
+     * Crops the image to the given rectangle. Works with every precision.
+     * @param x Left border
+     * @param y Top border
+     * @param w Width
+     * @param h Height
+     */
+    void crop(Coord x, Coord y, Coord w, Coord h);
+
+    /**
+     * Copy features from \p other to destination, adding them to old values. Ignores features that would be out of
+     * bounds. Only available if both images are stored in single precision, otherwise std::logic_error is thrown.
      * @param other Features to copy from
      * @param x Destination x
      * @param y Destination y
@@ -80,15 +206,74 @@ public:
     void addFrom(FeatureImage const& other, int x, int y, int w, int h);
 
     /**
-     * Normalizes the feature map such that every feature sums up to one
+     * Normalizes the feature map such that every feature sums up to one. Only available if the features are stored in
+     * single precision, otherwise std::logic_error is thrown.
      */
     void normalize();
 
+    /**
+     * Copies mapped features into the own storage, so they can be modified. Copies of a mapped image share the
+     * mapping, thus this is also needed to place the features on the NUMA node of the calling thread.
+     */
+    void detach();
+
 protected:
-    Coord m_width;
-    Coord m_height;
-    Coord m_dim;
-    std::vector<Feature> m_features;
+    using HalfStorage = Eigen::Matrix<Eigen::half, Eigen::Dynamic, Eigen::Dynamic>;
+    using BFloat16Storage = Eigen::Matrix<Eigen::bfloat16, Eigen::Dynamic, Eigen::Dynamic>;
+    using SingleView = Eigen::Map<Eigen::MatrixXf const>;
+    using HalfView = Eigen::Map<HalfStorage const>;
+    using BFloat16View = Eigen::Map<BFloat16Storage const>;
+
+    Coord m_width = 0;
+    Coord m_height = 0;
+    Coord m_dim = 0;
+    Precision m_precision = Precision::Single;
+    std::vector<Feature> m_features; //< Used for single precision
+    HalfStorage m_halfFeatures; //< Used for half precision, one column per site
+    BFloat16Storage m_bfloat16Features; //< Used for bfloat16 precision, one column per site
+    std::shared_ptr<void const> m_pMapping; //< Mapped file holding the features, shared between copies of the image
+    void const* m_pMappedFeatures = nullptr; //< Features within m_pMapping, one column per site
+
+    void assign(cv::Mat const& mat);
+
+    /**
+     * @return Single precision features from the mapped file. Only valid if there is one.
+     */
+    SingleView mappedSingleFeatures() const;
+
+    /**
+     * @return Half precision features, either from the mapped file or from m_halfFeatures
+     */
+    HalfView halfFeatures() const;
+
+    /**
+     * @return BFloat16 features, either from the mapped file or from m_bfloat16Features
+     */
+    BFloat16View bfloat16Features() const;
+
+    /**
+     * Drops the mapped file without keeping its features
+     */
+    void unmap();
+
+    /**
+     * @throws std::logic_error if the features aren't stored in single precision
+     */
+    void requireSingle() const;
+
+    /**
+     * @throws std::logic_error if the features aren't stored in single precision Feature objects
+     */
+    void requireOwnedSingle() const;
+
+    /**
+     * Reads a native feature file by mapping it into memory. The mapping is kept as storage if the file has the
+     * requested precision, otherwise the features are converted.
+     * @param filename File to read from
+     * @param precision Precision to store the features in
+     * @return True in case of success, otherwise false
+     */
+    bool readNative(std::string const& filename, Precision precision);
 };
 
 
@@ -5,16 +5,20 @@
 #ifndef HSEG_INFERENCEITERATOR_H
 #define HSEG_INFERENCEITERATOR_H
 
+#include <memory>
+#include <numeric>
 #include <Energy/EnergyFunction.h>
 #include <Image/FeatureImage.h>
 #include <MRFEnergy.h>
 #include <typeGeneral.h>
 #include <Image/Image.h>
 #include <helper/coordinate_helper.h>
-#include <Timer.h>
+#include <Profiler.h>
+#include <Threading/Parallel.h>
 #include "InferenceResult.h"
 #include "InferenceResultDetails.h"
 #include "Cluster.h"
+#include "QuantizedClusterSearch.h"
 
 /**
  * Infers both class labels and superpixels on an image
@@ -28,8 +32,13 @@ public:
      * @param e Energy function
      * @param pPxFeat Pixel features
      * @param pClusterFeat Cluster features
+     * @param eps Maximum change of energy to be considered small enough to terminate inference
+     * @param maxIter Maximum number of iterations
+     * @param shortlist If non-zero, the cluster affiliation is found by ranking all clusters with a quantized
+     *                  approximation of the cost and only evaluating the best \p shortlist candidates exactly
      */
-    InferenceIterator(EnergyFun const* e, FeatureImage const* pPxFeat, FeatureImage const* pClusterFeat, float eps = 1e-5f, uint32_t maxIter = 50);
+    InferenceIterator(EnergyFun const* e, FeatureImage const* pPxFeat, FeatureImage const* pClusterFeat, float eps = 1e-5f,
+                      uint32_t maxIter = 50, ClusterId shortlist = 0);
 
     /**
      * Does the actual inference
@@ -38,6 +47,14 @@ public:
      */
     InferenceResult run(uint32_t numIter = 0);
 
+    /**
+     * Does the actual inference, starting from a previous result
+     * @param init Previous result. If it doesn't fit the current problem, the default initialization is used instead.
+     * @param numIter Amount of iterations to do. If 0, run until convergence.
+     * @return Resulting labeling and segmentation
+     */
+    InferenceResult run(InferenceResult const& init, uint32_t numIter = 0);
+
     /**
      * Does inference and saves detailed results
      * @param numIter Amount of iterations to do. If 0, run until convergence.
@@ -53,32 +70,61 @@ public:
      */
     InferenceResult runOnGroundTruth(LabelImage const& gt, uint32_t numIter = 0);
 
+    /**
+     * Does inference on a fixed labeling, starting from previous latent variables
+     * @param gt Ground truth labeling
+     * @param init Previous result. Only clustering and clusters are used. If they don't fit the current problem, the
+     *             default initialization is used instead.
+     * @param numIter Amount of iterations to do. If 0, run until convergence.
+     * @return Ground truth labeling and latent variables that best explain it
+     */
+    InferenceResult runOnGroundTruth(LabelImage const& gt, InferenceResult const& init, uint32_t numIter = 0);
+
 protected:
     EnergyFun const* m_pEnergy;
     FeatureImage const* m_pPxFeat;
     FeatureImage const* m_pClusterFeat;
     float m_eps;
     uint32_t m_maxIter;
+    ClusterId m_shortlist;
+    std::unique_ptr<QuantizedClusterSearch> m_pQuantizedSearch;
+
+    static constexpr SiteId s_affiliationGrain = 1024; //< Sites per parallel block of the exhaustive affiliation search
 
     void updateClusterAffiliation(LabelImage& outClustering, LabelImage const& labeling, std::vector<Cluster> const& clusters);
 
-    void updateLabels(LabelImage& outLabeling, std::vector<Cluster>& outClusters, LabelImage const& clustering, FeatureImage* pOutMarginals = nullptr);
+    void updateClusterAffiliationShortlist(LabelImage& outClustering, LabelImage const& labeling, std::vector<Cluster> const& clusters);
+
+    /**
+     * Solves for the labeling with TRW-S
+     * @param pOutStats If not null, TRW-S iterations are added to its numTrwsIter and the lower bound is stored
+     */
+    void updateLabels(LabelImage& outLabeling, std::vector<Cluster>& outClusters, LabelImage const& clustering,
+                      FeatureImage* pOutMarginals = nullptr, InferenceResult* pOutStats = nullptr);
 
     void updateClusterFeatures(std::vector<Cluster>& outClusters, LabelImage const& labeling, LabelImage const& clustering);
 
     void initialize(LabelImage& outLabeling, LabelImage& outClustering, std::vector<Cluster>& outClusters);
 
+    bool initializeFrom(InferenceResult const& init, LabelImage& outLabeling, LabelImage& outClustering,
+                        std::vector<Cluster>& outClusters) const;
+
     void updateLabelsOnGroundTruth(LabelImage const& gt, std::vector<Cluster>& outClusters, LabelImage const& clustering);
 
 };
 
 template<typename EnergyFun>
-InferenceIterator<EnergyFun>::InferenceIterator(EnergyFun const* e, FeatureImage const* pPxFeat, FeatureImage const* pClusterFeat, float eps, uint32_t maxIter)
+constexpr SiteId InferenceIterator<EnergyFun>::s_affiliationGrain;
+
+template<typename EnergyFun>
+InferenceIterator<EnergyFun>::InferenceIterator(EnergyFun const* e, FeatureImage const* pPxFeat, FeatureImage const* pClusterFeat, float eps,
+                                                uint32_t maxIter, ClusterId shortlist)
         : m_pEnergy(e),
           m_pPxFeat(pPxFeat),
           m_pClusterFeat(pClusterFeat),
           m_eps(eps),
-          m_maxIter(maxIter)
+          m_maxIter(maxIter),
+          m_shortlist(shortlist)
 {
 }
 
@@ -87,30 +133,96 @@ void InferenceIterator<EnergyFun>::updateClusterAffiliation(LabelImage& outClust
 {
     PROFILE_THIS
 
-    // Exhaustive search
-    for(SiteId i = 0; i < m_pClusterFeat->width() * m_pClusterFeat->height(); ++i)
+    if(m_shortlist > 0 && m_shortlist < clusters.size())
     {
-        Feature const& f1 = m_pClusterFeat->atSite(i);
-        Label l1 = labeling.atSite(i);
-        Feature const& f2 = clusters[0].m_feature;
-        Label const l2 = clusters[0].m_label;
+        updateClusterAffiliationShortlist(outClustering, labeling, clusters);
+        return;
+    }
+
+    // Exhaustive search. Sites are independent, thus blocks of them are spread over the pool this runs on, if any.
+    auto updateBlock = [&](SiteId begin, SiteId end)
+    {
+        Feature scratch;
+        for(SiteId i = begin; i < end; ++i)
+        {
+            Feature const& f1 = m_pClusterFeat->atSite(i, scratch);
+            Label l1 = labeling.atSite(i);
+            Feature const& f2 = clusters[0].m_feature;
+            Label const l2 = clusters[0].m_label;
 
-        bool invalidSite = l1 >= m_pEnergy->numClasses();
+            bool invalidSite = l1 >= m_pEnergy->numClasses();
 
-        // If the pixel label is invalid just pretend that it has the same label as the cluster
-        if(invalidSite)
-            l1 = l2;
+            // If the pixel label is invalid just pretend that it has the same label as the cluster
+            if(invalidSite)
+                l1 = l2;
+
+            Cost minCost = m_pEnergy->higherOrderCost(f1, f2, l1, l2) + m_pEnergy->featureCost(f1, f2, l1, l2) + m_pEnergy->higherOrderSpecialUnaryCost(i, l2);
+            ClusterId minCluster = 0;
+            for(ClusterId k = 1; k < clusters.size(); ++k)
+            {
+                Feature const& f2 = clusters[k].m_feature;
+                Label const l2 = clusters[k].m_label;
+                if(invalidSite) // See comment above
+                    l1 = l2;
+                Cost c = m_pEnergy->higherOrderCost(f1, f2, l1, l2) + m_pEnergy->featureCost(f1, f2, l1, l2) + m_pEnergy->higherOrderSpecialUnaryCost(i, l2);
+                if(c < minCost)
+                {
+                    minCost = c;
+                    minCluster = k;
+                }
+            }
 
-        Cost minCost = m_pEnergy->higherOrderCost(f1, f2, l1, l2) + m_pEnergy->featureCost(f1, f2, l1, l2) + m_pEnergy->higherOrderSpecialUnaryCost(i, l2);
+            outClustering.atSite(i) = minCluster;
+        }
+    };
+
+    SiteId const numSites = m_pClusterFeat->width() * m_pClusterFeat->height();
+    if(ThreadPool::current() != nullptr)
+        parallelFor(*ThreadPool::current(), SiteId(0), numSites, s_affiliationGrain, updateBlock);
+    else
+        updateBlock(0, numSites);
+}
+
+template<typename EnergyFun>
+void InferenceIterator<EnergyFun>::updateClusterAffiliationShortlist(LabelImage& outClustering, LabelImage const& labeling, std::vector<Cluster> const& clusters)
+{
+    PROFILE_THIS
+
+    // The quantized features only depend on the feature map, the rest needs to be redone for every call
+    if(!m_pQuantizedSearch)
+        m_pQuantizedSearch = std::make_unique<QuantizedClusterSearch>(*m_pClusterFeat);
+    m_pQuantizedSearch->prepare(m_pEnergy->weights(), clusters, labeling);
+
+    std::vector<Cost> approxCost(clusters.size());
+    std::vector<ClusterId> candidates(clusters.size());
+    Feature scratch;
+    for(SiteId i = 0; i < m_pClusterFeat->width() * m_pClusterFeat->height(); ++i)
+    {
+        Label l1 = labeling.atSite(i);
+        bool const invalidSite = l1 >= m_pEnergy->numClasses();
+
+        // Rank all clusters by their approximate cost
+        m_pQuantizedSearch->approximateCosts(i, l1, approxCost.data());
+        for(ClusterId k = 0; k < clusters.size(); ++k)
+            approxCost[k] += m_pEnergy->higherOrderSpecialUnaryCost(i, clusters[k].m_label);
+        std::iota(candidates.begin(), candidates.end(), 0);
+        std::nth_element(candidates.begin(), candidates.begin() + m_shortlist - 1, candidates.end(),
+                         [&](ClusterId a, ClusterId b) { return approxCost[a] < approxCost[b]; });
+
+        // Evaluate the exact cost on the shortlist only. Ties are resolved towards the lower cluster id, just like the
+        // exhaustive search does.
+        Feature const& f1 = m_pClusterFeat->atSite(i, scratch);
+        Cost minCost = std::numeric_limits<Cost>::max();
         ClusterId minCluster = 0;
-        for(ClusterId k = 1; k < clusters.size(); ++k)
+        for(auto it = candidates.begin(); it != candidates.begin() + m_shortlist; ++it)
         {
+            ClusterId const k = *it;
             Feature const& f2 = clusters[k].m_feature;
             Label const l2 = clusters[k].m_label;
-            if(invalidSite) // See comment above
+            if(invalidSite) // If the pixel label is invalid just pretend that it has the same label as the cluster
                 l1 = l2;
             Cost c = m_pEnergy->higherOrderCost(f1, f2, l1, l2) + m_pEnergy->featureCost(f1, f2, l1, l2) + m_pEnergy->higherOrderSpecialUnaryCost(i, l2);
-            if(c < minCost)
+            if(c < minCost || (c == minCost && k < minCluster))
             {
                 minCost = c;
                 minCluster = k;
@@ -122,7 +234,9 @@ void InferenceIterator<EnergyFun>::updateClusterAffiliation(LabelImage& outClust
 }
 
 template<typename EnergyFun>
-void InferenceIterator<EnergyFun>::updateLabels(LabelImage& outLabeling, std::vector<Cluster>& outClusters, LabelImage const& clustering, FeatureImage* pOutMarginals)
+void InferenceIterator<EnergyFun>::updateLabels(LabelImage& outLabeling, std::vector<Cluster>& outClusters,
+                                                LabelImage const& clustering, FeatureImage* pOutMarginals,
+                                                InferenceResult* pOutStats)
 {
     PROFILE_THIS
 
@@ -151,9 +265,10 @@ void InferenceIterator<EnergyFun>::updateLabels(LabelImage& outLabeling, std::ve
     }
 
     // Unary term for each pixel
+    Feature scratch, scratchNeighbor, scratchClus;
     for (SiteId i = 0; i < numPx; ++i)
     {
-        Feature const& f = m_pPxFeat->atSite(i);
+        Feature const& f = m_pPxFeat->atSite(i, scratch);
         std::vector<TypeGeneral::REAL> confidences(numClasses, 0.f);
         for (Label l = 0; l < numClasses; ++l)
             confidences[l] = m_pEnergy->unaryCost(i, f, l);
@@ -178,7 +293,7 @@ void InferenceIterator<EnergyFun>::updateLabels(LabelImage& outLabeling, std::ve
     for (SiteId i = 0; i < numPx; ++i)
     {
         auto coords = helper::coord::siteTo2DCoordinate(i, outLabeling.width());
-        Feature const& f = m_pPxFeat->atSite(i);
+        Feature const& f = m_pPxFeat->atSite(i, scratch);
 
         // Set up pixel neighbor connections
         if(m_pEnergy->usePairwise())
@@ -188,7 +303,7 @@ void InferenceIterator<EnergyFun>::updateLabels(LabelImage& outLabeling, std::ve
             if (coordsR.x() < outLabeling.width())
             {
                 SiteId siteR = helper::coord::coordinateToSite(coordsR.x(), coordsR.y(), outLabeling.width());
-                Feature const& fR = m_pPxFeat->atSite(siteR);
+                Feature const& fR = m_pPxFeat->atSite(siteR, scratchNeighbor);
                 std::vector<TypeGeneral::REAL> costMat(numClasses * numClasses, 0.f);
                 for(Label l1 = 0; l1 < numClasses; ++l1)
                 {
@@ -204,7 +319,7 @@ void InferenceIterator<EnergyFun>::updateLabels(LabelImage& outLabeling, std::ve
             if (coordsD.y() < outLabeling.height())
             {
                 SiteId siteD = helper::coord::coordinateToSite(coordsD.x(), coordsD.y(), outLabeling.width());
-                Feature const& fD = m_pPxFeat->atSite(siteD);
+                Feature const& fD = m_pPxFeat->atSite(siteD, scratchNeighbor);
                 std::vector<TypeGeneral::REAL> costMat(numClasses * numClasses, 0.f);
                 for(Label l1 = 0; l1 < numClasses; ++l1)
                 {
@@ -220,7 +335,7 @@ void InferenceIterator<EnergyFun>::updateLabels(LabelImage& outLabeling, std::ve
         }
 
         // Set up connection to auxiliary nodes
-        Feature const& fClus = m_pClusterFeat->atSite(i);
+        Feature const& fClus = m_pClusterFeat->atSite(i, scratchClus);
         if(numClusters > 0)
         {
             ClusterId k = clustering.atSite(i);
@@ -244,7 +359,16 @@ void InferenceIterator<EnergyFun>::updateLabels(LabelImage& outLabeling, std::ve
     MRFEnergy<TypeGeneral>::Options options;
     options.m_eps = 0.01f;
     MRFEnergy<TypeGeneral>::REAL lowerBound = 0, energy = 0;
-    mrfEnergy.Minimize_TRW_S(options, lowerBound, energy);
+    int numTrwsIter;
+    {
+        PROFILE_SCOPE("TRW-S")
+        numTrwsIter = mrfEnergy.Minimize_TRW_S(options, lowerBound, energy);
+    }
+    if(pOutStats != nullptr)
+    {
+        pOutStats->numTrwsIter += numTrwsIter;
+        pOutStats->lowerBound = lowerBound;
+    }
 
 //    std::cout << "TRW-S : lower bound = " << lowerBound << ", energy = " << energy << std::endl;
 
@@ -288,6 +412,7 @@ void InferenceIterator<EnergyFun>::updateClusterFeatures(std::vector<Cluster>& o
         c.m_feature = Feature::Zero(c.m_feature.size());
 
     // Do one sweep over the image and update the cluster features on the fly
+    Feature scratch;
     for(SiteId i = 0; i < labeling.pixels(); ++i)
     {
         ClusterId k = clustering.atSite(i);
@@ -303,7 +428,7 @@ void InferenceIterator<EnergyFun>::updateClusterFeatures(std::vector<Cluster>& o
 
         // Update feature
         Feature& f = outClusters[k].m_feature;
-        Feature const& fPx = m_pClusterFeat->atSite(i);
+        Feature const& fPx = m_pClusterFeat->atSite(i, scratch);
         auto const sigmaInv = m_pEnergy->weights().feature(l1, l2).cwiseInverse().asDiagonal();
         auto const& w = m_pEnergy->weights().higherOrder(l1, l2);
         auto const wTail = w.segment(f.size(), f.size());
@@ -350,14 +475,15 @@ void InferenceIterator<EnergyFun>::initialize(LabelImage& outLabeling, LabelImag
     std::vector<allocation> clAlloc; // Distance to closest cluster center
     clAlloc.reserve(outLabeling.pixels());
     SiteId const site = distribution(generator);
+    Feature scratch;
     outClusters.emplace_back();
     outClusters.back().m_label = 0;
-    outClusters.back().m_feature = m_pClusterFeat->atSite(site);
+    outClusters.back().m_feature = m_pClusterFeat->atSite(site, scratch);
 
     // Compute the distance between each pixel and the newly created cluster center
     for(SiteId i = 0; i < outLabeling.pixels(); ++i)
     {
-        Feature const& f1 = m_pClusterFeat->atSite(i);
+        Feature const& f1 = m_pClusterFeat->atSite(i, scratch);
         Feature const& f2 = outClusters.back().m_feature;
         Label l1 = outLabeling.atSite(i);
         Label l2 = outClusters.back().m_label;
@@ -376,11 +502,11 @@ void InferenceIterator<EnergyFun>::initialize(LabelImage& outLabeling, LabelImag
         SiteId const site = distribution(generator);
         outClusters.emplace_back();
         outClusters.back().m_label = 0;
-        outClusters.back().m_feature = m_pClusterFeat->atSite(site);
+        outClusters.back().m_feature = m_pClusterFeat->atSite(site, scratch);
         // Recompute cluster distances
         for(SiteId i = 0; i < outLabeling.pixels(); ++i)
         {
-            Feature const& f1 = m_pClusterFeat->atSite(i);
+            Feature const& f1 = m_pClusterFeat->atSite(i, scratch);
             Feature const& f2 = outClusters.back().m_feature;
             Label l1 = outLabeling.atSite(i);
             Label l2 = outClusters.back().m_label;
@@ -394,6 +520,34 @@ void InferenceIterator<EnergyFun>::initialize(LabelImage& outLabeling, LabelImag
     }
 }
 
+template<typename EnergyFun>
+bool InferenceIterator<EnergyFun>::initializeFrom(InferenceResult const& init, LabelImage& outLabeling,
+                                                  LabelImage& outClustering, std::vector<Cluster>& outClusters) const
+{
+    ClusterId const numClusters = m_pEnergy->numClusters();
+    Label const numClasses = m_pEnergy->numClasses();
+    Coord const width = m_pPxFeat->width();
+    Coord const height = m_pPxFeat->height();
+
+    // Check whether the previous result belongs to the same problem
+    if(numClusters == 0 || init.clusters.size() != numClusters)
+        return false;
+    if(init.labeling.width() != width || init.labeling.height() != height || init.clustering.width() != width ||
+       init.clustering.height() != height)
+        return false;
+    for(Cluster const& c : init.clusters)
+        if(c.m_label >= numClasses || c.m_feature.size() != m_pClusterFeat->dim())
+            return false;
+    for(SiteId i = 0; i < init.clustering.pixels(); ++i)
+        if(init.labeling.atSite(i) >= numClasses || init.clustering.atSite(i) >= numClusters)
+            return false;
+
+    outLabeling = init.labeling;
+    outClustering = init.clustering;
+    outClusters = init.clusters;
+    return true;
+}
+
 template<typename EnergyFun>
 void InferenceIterator<EnergyFun>::updateLabelsOnGroundTruth(LabelImage const& gt, std::vector<Cluster>& outClusters,
                                                              LabelImage const& clustering)
@@ -410,11 +564,12 @@ void InferenceIterator<EnergyFun>::updateLabelsOnGroundTruth(LabelImage const& g
     std::vector<std::vector<Cost>> clusterCost(numClusters, std::vector<Cost>(numClasses, 0));
 
     // Every auxiliary node has just unary terms, however they are a sum of all allocated pixels
+    Feature scratch;
     for(SiteId i = 0; i < numPx; ++i)
     {
         Label const l = gt.atSite(i);
         ClusterId const k = clustering.atSite(i);
-        Feature const& f = m_pClusterFeat->atSite(i);
+        Feature const& f = m_pClusterFeat->atSite(i, scratch);
         Feature const& fClus = outClusters[k].m_feature;
 
         for (Label lClus = 0; lClus < numClasses; ++lClus)
@@ -436,18 +591,27 @@ void InferenceIterator<EnergyFun>::updateLabelsOnGroundTruth(LabelImage const& g
 
 template<typename EnergyFun>
 InferenceResult InferenceIterator<EnergyFun>::run(uint32_t numIter)
+{
+    return run(InferenceResult(), numIter);
+}
+
+template<typename EnergyFun>
+InferenceResult InferenceIterator<EnergyFun>::run(InferenceResult const& init, uint32_t numIter)
 {
     PROFILE_THIS
 
     InferenceResult result;
 
     // Initialize variables
-    initialize(result.labeling, result.clustering, result.clusters);
+    if(!initializeFrom(init, result.labeling, result.clustering, result.clusters))
+        initialize(result.labeling, result.clustering, result.clusters);
 
     // If no clusters are required, just do normal TRW-S
     if(m_pEnergy->numClusters() == 0)
     {
-        updateLabels(result.labeling, result.clusters, result.clustering/*, &result.marginals*/);
+        updateLabels(result.labeling, result.clusters, result.clustering/*, &result.marginals*/, nullptr, &result);
+        result.energy = m_pEnergy->giveEnergy(*m_pPxFeat, *m_pClusterFeat, result.labeling, result.clustering,
+                                              result.clusters);
         return result;
     }
 
@@ -476,13 +640,14 @@ InferenceResult InferenceIterator<EnergyFun>::run(uint32_t numIter)
         updateClusterFeatures(result.clusters, result.labeling, result.clustering);
 
         // Update labels
-        updateLabels(result.labeling, result.clusters, result.clustering/*, &result.marginals*/);
+        updateLabels(result.labeling, result.clusters, result.clustering/*, &result.marginals*/, nullptr, &result);
 
         // Compute current energy to check for convergence
         energy = m_pEnergy->giveEnergy(*m_pPxFeat, *m_pClusterFeat, result.labeling, result.clustering, result.clusters);
     }
 
     result.numIter = iter;
+    result.energy = energy;
     return result;
 }
 
@@ -559,6 +724,13 @@ InferenceResultDetails InferenceIterator<EnergyFun>::runDetailed(uint32_t numIte
 
 template<typename EnergyFun>
 InferenceResult InferenceIterator<EnergyFun>::runOnGroundTruth(LabelImage const& gt, uint32_t numIter)
+{
+    return runOnGroundTruth(gt, InferenceResult(), numIter);
+}
+
+template<typename EnergyFun>
+InferenceResult InferenceIterator<EnergyFun>::runOnGroundTruth(LabelImage const& gt, InferenceResult const& init,
+                                                               uint32_t numIter)
 {
     InferenceResult result;
 
@@ -569,8 +741,9 @@ InferenceResult InferenceIterator<EnergyFun>::runOnGroundTruth(LabelImage const&
         return result;
     }
 
-    // Initialize variables
-    initialize(result.labeling, result.clustering, result.clusters);
+    // Initialize variables. The labeling of a previous result doesn't matter, since it is replaced by the ground truth.
+    if(!initializeFrom(init, result.labeling, result.clustering, result.clusters))
+        initialize(result.labeling, result.clustering, result.clusters);
     assert(gt.width() == result.labeling.width() && gt.height() == result.labeling.height());
     result.labeling = gt;
 
@@ -606,6 +779,7 @@ InferenceResult InferenceIterator<EnergyFun>::runOnGroundTruth(LabelImage const&
     }
 
     result.numIter = iter;
+    result.energy = energy;
     return result;
 }
 
@@ -8,6 +8,7 @@
 #include <Image/Image.h>
 #include <Image/FeatureImage.h>
 #include "Cluster.h"
+#include <typedefs.h>
 
 /**
  * Stores the final result from inference
@@ -20,6 +21,9 @@ public:
     std::vector<Cluster> clusters; //< Cluster representatives
 //    FeatureImage marginals; //< Marginals
     uint32_t numIter = 0; //< Amount of iterations until convergence
+    uint32_t numTrwsIter = 0; //< Amount of TRW-S iterations summed up over all iterations
+    Cost energy = 0; //< Energy of the result
+    Cost lowerBound = 0; //< Lower bound on the energy found by the last TRW-S run
 };
 
 
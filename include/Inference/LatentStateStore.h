@@ -0,0 +1,107 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#ifndef HSEG_LATENTSTATESTORE_H
+#define HSEG_LATENTSTATESTORE_H
+
+#include <string>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <unordered_set>
+#include "InferenceResult.h"
+
+/**
+ * Latent variables of a training sample from the last time it was processed
+ */
+struct LatentState
+{
+    InferenceResult gt; //< Latent variables that best explained the ground truth
+    InferenceResult prediction; //< Loss-augmented prediction
+};
+
+/**
+ * Keeps the latent state of every training sample, so it can be used to warm-start inference in the next iteration.
+ * States are kept in memory up to a budget. Beyond that, the least recently used states are written to a spill
+ * directory, or dropped if there is none. Spill files are named after the process that wrote them, so files of other
+ * runs are never read, and they are removed again when the store is destroyed. All methods are thread-safe.
+ */
+class LatentStateStore
+{
+public:
+    /**
+     * Constructor
+     * @param memoryBudget Maximum amount of bytes to keep in memory
+     * @param spillDir Directory to write states to that don't fit in memory. If empty, these states are dropped.
+     */
+    explicit LatentStateStore(size_t memoryBudget, std::string spillDir = "");
+
+    LatentStateStore(LatentStateStore const&) = delete;
+
+    LatentStateStore& operator=(LatentStateStore const&) = delete;
+
+    /**
+     * Removes all spill files written by this store
+     */
+    ~LatentStateStore();
+
+    /**
+     * Retrieves the state of a sample
+     * @param name Name of the sample
+     * @param outState The state is stored here
+     * @return True if there was a state for this sample, otherwise false
+     */
+    bool get(std::string const& name, LatentState& outState);
+
+    /**
+     * Stores the state of a sample, replacing any previous state
+     * @param name Name of the sample
+     * @param state State to store
+     */
+    void put(std::string const& name, LatentState state);
+
+    /**
+     * @return Amount of bytes currently held in memory
+     */
+    size_t memoryUsage() const;
+
+private:
+    struct Entry
+    {
+        LatentState state;
+        size_t bytes;
+        std::list<std::string>::iterator lruPos;
+    };
+
+    /**
+     * An evicted state that is currently being written to disk
+     */
+    struct Spilling
+    {
+        std::shared_ptr<LatentState const> pState;
+        uint64_t generation; //< Distinguishes several spills of the same sample, only the latest one is kept
+    };
+
+    size_t m_memoryBudget;
+    std::string m_spillDir;
+    std::string m_runId; //< Prefix of the spill files of this store
+    size_t m_memoryUsage = 0;
+    std::unordered_map<std::string, Entry> m_states;
+    std::list<std::string> m_lru; //< Most recently used at the front
+    std::unordered_map<std::string, Spilling> m_spilling;
+    std::unordered_set<std::string> m_spilled; //< Samples that have a spill file
+    uint64_t m_nextGeneration = 0;
+    mutable std::mutex m_mutex;
+
+    std::string spillFilename(std::string const& name) const;
+
+    void spill(std::string const& name, Spilling const& spilling);
+
+    bool unspill(std::string const& name, LatentState& outState) const;
+
+    static size_t estimateSize(LatentState const& state);
+};
+
+#endif //HSEG_LATENTSTATESTORE_H
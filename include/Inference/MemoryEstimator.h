@@ -0,0 +1,72 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#ifndef HSEG_MEMORYESTIMATOR_H
+#define HSEG_MEMORYESTIMATOR_H
+
+#include <cstddef>
+#include <typedefs.h>
+#include <Image/FeatureImage.h>
+
+/**
+ * Estimates how much memory processing a single image takes at its peak. This is dominated by the two feature maps
+ * and by the TRW-S graph, which stores a dense cost matrix with numClasses^2 entries for every edge.
+ */
+class MemoryEstimator
+{
+public:
+    /**
+     * Constructor
+     * @param featDimPx Dimensionality of the pixel features
+     * @param featDimCluster Dimensionality of the cluster features
+     * @param numClasses Amount of classes
+     * @param numClusters Amount of clusters
+     * @param shortlist Shortlist size of the cluster affiliation search, 0 if it is exhaustive
+     * @param usePairwise Whether the pixel neighborhood is part of the graph
+     * @param precision Storage precision of the features
+     */
+    MemoryEstimator(size_t featDimPx, size_t featDimCluster, Label numClasses, ClusterId numClusters,
+                    ClusterId shortlist, bool usePairwise, FeatureImage::Precision precision);
+
+    /**
+     * @param width Image width
+     * @param height Image height
+     * @return Estimated peak amount of bytes needed to process an image of the given size
+     */
+    size_t estimate(Coord width, Coord height) const;
+
+    /**
+     * @param width Image width
+     * @param height Image height
+     * @return Bytes taken up by the feature maps of an image of the given size
+     */
+    size_t features(Coord width, Coord height) const;
+
+    /**
+     * @param width Image width
+     * @param height Image height
+     * @return Bytes taken up by inference on an image of the given size, i.e. labelings, the TRW-S graph and the
+     *         cluster search
+     */
+    size_t inference(Coord width, Coord height) const;
+
+    /**
+     * @param width Image width
+     * @param height Image height
+     * @return Bytes taken up by the quantized features and weights of a shortlist search, or 0 if the search is
+     *         exhaustive. Every inference iterator keeps its own one.
+     */
+    size_t clusterSearch(Coord width, Coord height) const;
+
+private:
+    size_t m_featDimPx;
+    size_t m_featDimCluster;
+    Label m_numClasses;
+    ClusterId m_numClusters;
+    ClusterId m_shortlist;
+    bool m_usePairwise;
+    FeatureImage::Precision m_precision;
+};
+
+#endif //HSEG_MEMORYESTIMATOR_H
@@ -0,0 +1,83 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#ifndef HSEG_QUANTIZEDCLUSTERSEARCH_H
+#define HSEG_QUANTIZEDCLUSTERSEARCH_H
+
+#include <vector>
+#include <typedefs.h>
+#include <Energy/Weights.h>
+#include <Image/FeatureImage.h>
+#include <Image/Image.h>
+#include "Cluster.h"
+
+/**
+ * Approximates the cost of allocating a site to each cluster with 8 bit integer arithmetic.
+ *
+ * The exact cost of allocating site i with label l1 to cluster k with label l2 is
+ *     higherOrderCost(f, f_k, l1, l2) + featureCost(f, f_k, l1, l2)
+ *     = f . (wHead - 2 w_feat * f_k) + (f * f) . w_feat + c_k
+ * where c_k only depends on the cluster. The first dot product is computed per cluster, the second one only per
+ * distinct cluster label. Both are evaluated on quantized vectors: site features use per-channel scales that are
+ * computed once for the whole image, the weight vectors use one scale per vector.
+ */
+class QuantizedClusterSearch
+{
+public:
+    /**
+     * Constructor. Quantizes the features of every site.
+     * @param features Cluster feature map
+     */
+    explicit QuantizedClusterSearch(FeatureImage const& features);
+
+    /**
+     * Quantizes the per-cluster weight vectors. Has to be called whenever weights or clusters change.
+     * @param weights Weights
+     * @param clusters Clusters
+     * @param labeling Current labeling. Only rows for labels that occur in it are computed.
+     */
+    void prepare(Weights const& weights, std::vector<Cluster> const& clusters, LabelImage const& labeling);
+
+    /**
+     * Computes the approximate cost of allocating a site to every cluster. Uses internal scratch buffers, thus it must
+     * not be called concurrently on the same object.
+     * @param i Site
+     * @param l Label of the site. If it is invalid, the site is assumed to have the same label as the cluster.
+     * @param outCosts Approximate costs are written here, one per cluster
+     */
+    void approximateCosts(SiteId i, Label l, Cost* outCosts);
+
+private:
+    /**
+     * A quantized vector of length m_paddedDim, scaled by m_scale, with the sum of its elements
+     */
+    struct QuantizedRow
+    {
+        float m_scale = 0;
+        int32_t m_sum = 0;
+    };
+
+    uint32_t m_dim;
+    uint32_t m_paddedDim;
+    Label m_numClasses = 0;
+    ClusterId m_numClusters = 0;
+    std::vector<float> m_channelScale; //< Scale of the features of every channel
+    std::vector<float> m_channelScaleSq; //< Scale of the squared features of every channel
+    std::vector<uint8_t> m_features; //< Quantized features, offset by 128
+    std::vector<uint8_t> m_featuresSq; //< Quantized squared features
+    std::vector<int8_t> m_clusterRows; //< Per (pixel label, cluster) linear term
+    std::vector<QuantizedRow> m_clusterRowInfo;
+    std::vector<float> m_clusterConst; //< Per (pixel label, cluster) constant term
+    std::vector<int8_t> m_labelRows; //< Per (pixel label, cluster label) quadratic term
+    std::vector<QuantizedRow> m_labelRowInfo;
+    std::vector<Label> m_clusterLabels;
+    std::vector<Label> m_usedLabels; //< Distinct labels of the clusters
+    std::vector<Cost> m_labelCost; //< Scratch buffer for the quadratic term of every label
+
+    QuantizedRow quantizeRow(Feature const& row, int8_t* out) const;
+
+    void prepareRow(Weights const& weights, std::vector<Cluster> const& clusters, Label l1, size_t row);
+};
+
+#endif //HSEG_QUANTIZEDCLUSTERSEARCH_H
@@ -0,0 +1,121 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#ifndef HSEG_METRICSLOG_H
+#define HSEG_METRICSLOG_H
+
+#include <fstream>
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <type_traits>
+#include "Timer.h"
+
+/**
+ * Writes structured metrics as JSON lines, i.e. one JSON object per line. Additionally, it keeps track of the amount
+ * of processed items and periodically reports throughput and the estimated remaining time. All methods are
+ * thread-safe.
+ */
+class MetricsLog
+{
+public:
+    /**
+     * A single JSON object. Every record has a "type" and a "time" (seconds since the log has been created).
+     */
+    class Record
+    {
+    public:
+        /**
+         * Constructor
+         * @param type Type of the record
+         */
+        explicit Record(char const* type);
+
+        /**
+         * Adds a value. Keys are written as they are and must not need escaping.
+         * @param key Key
+         * @param value Value. Non-finite numbers are written as null.
+         * @return This record
+         */
+        Record& set(char const* key, std::string const& value);
+
+        Record& set(char const* key, char const* value);
+
+        Record& set(char const* key, bool value);
+
+        Record& set(char const* key, double value);
+
+        Record& set(char const* key, long long value);
+
+        Record& set(char const* key, unsigned long long value);
+
+        template<typename T>
+        Record& set(char const* key, T value);
+
+        /**
+         * @return The JSON object
+         */
+        std::string str() const;
+
+    private:
+        std::ostringstream m_out;
+    };
+
+    /**
+     * Constructor
+     * @param filename File to write to. If empty, records aren't written, but progress is still reported.
+     * @param total Amount of items expected, used to estimate the remaining time
+     * @param progressEvery Minimum amount of seconds between two progress reports. 0 disables them.
+     */
+    MetricsLog(std::string const& filename, size_t total, float progressEvery);
+
+    /**
+     * @return False if the file couldn't be opened, otherwise true
+     */
+    bool good() const;
+
+    /**
+     * Writes a record and flushes it, so the log can be followed while the program is running
+     * @param record Record to write
+     */
+    void write(Record& record);
+
+    /**
+     * Marks an item as done. If the last progress report is long enough ago, a new one is printed to std::cout and
+     * written as record of type "progress".
+     */
+    void itemDone();
+
+    /**
+     * @return Peak resident memory of this process in bytes
+     */
+    static size_t peakRss();
+
+private:
+    std::string m_filename;
+    std::ofstream m_out;
+    size_t m_total;
+    float m_progressEvery;
+    size_t m_numDone = 0;
+    size_t m_numDoneLastReport = 0;
+    float m_lastReport = 0;
+    Timer m_timer{true};
+    std::mutex m_mutex;
+
+    void writeLocked(Record& record);
+};
+
+template<typename T>
+MetricsLog::Record& MetricsLog::Record::set(char const* key, T value)
+{
+    static_assert(std::is_arithmetic<T>::value, "Only strings, booleans and numbers are supported");
+    if(std::is_floating_point<T>::value)
+        return set(key, static_cast<double>(value));
+    else if(std::is_signed<T>::value)
+        return set(key, static_cast<long long>(value));
+    else
+        return set(key, static_cast<unsigned long long>(value));
+}
+
+#endif //HSEG_METRICSLOG_H
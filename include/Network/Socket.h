@@ -0,0 +1,115 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#ifndef HSEG_SOCKET_H
+#define HSEG_SOCKET_H
+
+#include <string>
+#include <cstdint>
+
+/**
+ * Connected stream socket that exchanges length-prefixed messages. Addresses are either "unix:<path>" for a unix
+ * domain socket or "<host>:<port>" for TCP. The connection is unauthenticated, thus messages larger than a limit are
+ * rejected.
+ */
+class Socket
+{
+public:
+    /**
+     * Messages larger than this are rejected by default
+     */
+    static constexpr uint64_t s_defaultMaxMessageSize = 256ull * 1024 * 1024;
+
+    Socket() = default;
+
+    explicit Socket(int fd);
+
+    Socket(Socket const&) = delete;
+
+    Socket(Socket&& other);
+
+    Socket& operator=(Socket const&) = delete;
+
+    Socket& operator=(Socket&& other);
+
+    ~Socket();
+
+    /**
+     * Connects to a listening socket
+     * @param address Address to connect to
+     * @return The connected socket. Invalid if the connection failed.
+     */
+    static Socket connect(std::string const& address);
+
+    /**
+     * @return True if the socket is connected
+     */
+    bool valid() const;
+
+    /**
+     * Sends a message. Not thread-safe.
+     * @param type Message type
+     * @param payload Message content
+     * @return True in case of success, otherwise false
+     */
+    bool send(uint32_t type, std::string const& payload);
+
+    /**
+     * Blocks until a complete message has been received. Not thread-safe.
+     * @param outType Message type is stored here
+     * @param outPayload Message content is stored here
+     * @return True in case of success, false if the connection has been closed or failed. If a message exceeds the
+     *         maximum size, the connection is shut down.
+     */
+    bool receive(uint32_t& outType, std::string& outPayload);
+
+    /**
+     * @param maxMessageSize Maximum size of a received message in bytes
+     */
+    void setMaxMessageSize(uint64_t maxMessageSize);
+
+    /**
+     * Shuts down both directions of the connection, which also wakes up a thread blocked in receive()
+     */
+    void shutdown();
+
+private:
+    int m_fd = -1;
+    uint64_t m_maxMessageSize = s_defaultMaxMessageSize;
+};
+
+/**
+ * Socket that listens for incoming connections
+ */
+class ServerSocket
+{
+public:
+    ServerSocket() = default;
+
+    ServerSocket(ServerSocket const&) = delete;
+
+    ServerSocket& operator=(ServerSocket const&) = delete;
+
+    ~ServerSocket();
+
+    /**
+     * Starts listening
+     * @param address Address to listen on. For TCP, only the interface of the host is used. An empty host or "*"
+     *                listens on all interfaces.
+     * @return True in case of success, otherwise false
+     */
+    bool listen(std::string const& address);
+
+    /**
+     * Blocks until a connection comes in
+     * @return The connected socket. Invalid if accepting failed.
+     */
+    Socket accept();
+
+private:
+    int m_fd = -1;
+    std::string m_unixPath; //< Removed again on destruction
+};
+
+#endif //HSEG_SOCKET_H
@@ -0,0 +1,74 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#ifndef HSEG_PERFCOUNTERS_H
+#define HSEG_PERFCOUNTERS_H
+
+#include <array>
+#include <cstdint>
+
+/**
+ * Hardware performance counters of the calling thread, read via perf_event_open. Counters that can't be opened,
+ * e.g. because they aren't supported or because of /proc/sys/kernel/perf_event_paranoid, are reported once and read
+ * as zero afterwards.
+ */
+class PerfCounters
+{
+public:
+    enum Counter
+    {
+        Cycles = 0,
+        Instructions,
+        LlcMisses,
+        BranchMisses,
+        NumCounters
+    };
+
+    using Values = std::array<uint64_t, NumCounters>;
+
+    /**
+     * @return Counters of the calling thread. They are opened on first use and count user space only.
+     */
+    static PerfCounters& local();
+
+    ~PerfCounters();
+
+    PerfCounters(PerfCounters const&) = delete;
+
+    PerfCounters& operator=(PerfCounters const&) = delete;
+
+    /**
+     * @param c Counter
+     * @return True if the counter could be opened
+     */
+    bool available(Counter c) const;
+
+    /**
+     * @return True if at least one counter could be opened
+     */
+    bool anyAvailable() const;
+
+    /**
+     * Reads all counters at once
+     * @param outValues Current counter values. Unavailable counters are zero.
+     * @return True in case of success, otherwise false
+     */
+    bool read(Values& outValues) const;
+
+    /**
+     * @param c Counter
+     * @return Human-readable name of the counter
+     */
+    static char const* name(Counter c);
+
+private:
+    PerfCounters();
+
+    int m_leader = -1; //< All available counters form a group with this one, so they can be read with one call
+    std::array<int, NumCounters> m_fds;
+    std::array<int, NumCounters> m_slot; //< Position of every counter within a group read, -1 if unavailable
+    size_t m_numOpen = 0;
+};
+
+#endif //HSEG_PERFCOUNTERS_H
@@ -0,0 +1,93 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#ifndef HSEG_PROFILER_H
+#define HSEG_PROFILER_H
+
+#include <cstdint>
+#include <ostream>
+#include <string>
+#if defined(USE_PERF_COUNTERS)
+#include "PerfCounters.h"
+#endif
+
+/**
+ * Hierarchical profiler. Scopes are identified by static strings and recorded into per-thread buffers without any
+ * locking. Nested scopes are attributed to the scope they are called from. At the end of the program, a summary is
+ * printed and a Chrome trace (chrome://tracing) is written to "profile.json", if anything has been recorded.
+ * Recorded events are kept until then, therefore only enable it for profiling runs (USE_PROFILER). With
+ * USE_PERF_COUNTERS, hardware counters are sampled around every scope as well, see PerfCounters.
+ */
+namespace Profiler
+{
+    /**
+     * Records the time between its construction and destruction
+     */
+    class ScopeTracer
+    {
+    public:
+        /**
+         * Constructor
+         * @param name Name of the scope. Must be a string with static storage duration, e.g. a literal.
+         */
+        explicit ScopeTracer(char const* name) noexcept;
+
+        ~ScopeTracer() noexcept;
+
+        ScopeTracer(ScopeTracer const&) = delete;
+
+        ScopeTracer& operator=(ScopeTracer const&) = delete;
+
+    private:
+        char const* m_name;
+        uint64_t m_begin;
+#if defined(USE_PERF_COUNTERS)
+        PerfCounters::Values m_counters;
+#endif
+    };
+
+    /**
+     * @return Nanoseconds since the profiler has been initialized
+     */
+    uint64_t now() noexcept;
+
+    /**
+     * Writes all events recorded so far in the Chrome trace event format
+     * @param out Stream to write to
+     */
+    void writeChromeTrace(std::ostream& out);
+
+    /**
+     * Writes all events recorded so far in the Chrome trace event format
+     * @param filename File to write to
+     * @return True in case of success, otherwise false
+     */
+    bool writeChromeTrace(std::string const& filename);
+
+    /**
+     * Writes the call tree of all scopes recorded so far, with total and self time, calls and average time. If
+     * hardware counters have been recorded, they are listed for every scope, and for every scope per thread.
+     * @param out Stream to write to
+     */
+    void writeSummary(std::ostream& out);
+}
+
+#if defined(__GNUC__)
+#define CUR_FUNCTION __PRETTY_FUNCTION__
+#else
+#define CUR_FUNCTION __func__
+#endif
+
+#define PROFILE_CONCAT_IMPL(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_IMPL(a, b)
+
+#if defined(USE_PROFILER)
+#define PROFILE_THIS Profiler::ScopeTracer const profiler_tracer_(CUR_FUNCTION);
+#define PROFILE_SCOPE(name) Profiler::ScopeTracer const PROFILE_CONCAT(profiler_scope_, __LINE__)(name);
+#else
+#define PROFILE_THIS
+#define PROFILE_SCOPE(name)
+#endif
+
+#endif //HSEG_PROFILER_H
@@ -0,0 +1,104 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#ifndef HSEG_BOUNDEDQUEUE_H
+#define HSEG_BOUNDEDQUEUE_H
+
+#include <deque>
+#include <mutex>
+#include <chrono>
+#include <ostream>
+#include <condition_variable>
+
+/**
+ * @brief Occupancy statistics of a BoundedQueue
+ */
+struct BoundedQueueStats
+{
+    size_t capacity = 0; //< Maximum size
+    size_t numPopped = 0; //< Amount of elements that have been taken out
+    float meanSize = 0; //< Average size of the queue as seen by consumers
+    float pushWaitSeconds = 0; //< Total time producers were blocked because the queue was full
+    float popWaitSeconds = 0; //< Total time consumers were blocked because the queue was empty
+};
+
+inline std::ostream& operator<<(std::ostream& out, BoundedQueueStats const& stats)
+{
+    return out << "mean occupancy " << stats.meanSize << "/" << stats.capacity << ", producers blocked "
+               << stats.pushWaitSeconds << "s, consumers blocked " << stats.popWaitSeconds << "s";
+}
+
+/**
+ * @brief A blocking first-in-first-out queue with a maximum size, used to connect the stages of a pipeline
+ * @details Producers block while the queue is full, consumers block while it is empty. After close() has been called,
+ *          push() fails and pop() only returns the remaining elements. The queue keeps track of how full it is and how
+ *          long producers and consumers had to wait, which tells whether the stages before or after it are the
+ *          bottleneck.
+ */
+template<typename T>
+class BoundedQueue
+{
+public:
+    using Stats = BoundedQueueStats;
+
+    /**
+     * @brief Constructor
+     * @param capacity Maximum amount of elements in the queue. Must be at least 1.
+     */
+    explicit BoundedQueue(size_t capacity);
+
+    /**
+     * @brief Adds an element, blocking while the queue is full
+     * @param value Element to add
+     * @return True if the element has been added, false if the queue has been closed
+     */
+    bool push(T value);
+
+    /**
+     * @brief Takes out the oldest element, blocking while the queue is empty
+     * @param outValue The element is moved here
+     * @return True if an element has been taken out, false if the queue is closed and empty
+     */
+    bool pop(T& outValue);
+
+    /**
+     * @brief Takes out the oldest element if there is one, without blocking
+     * @param outValue The element is moved here
+     * @return True if an element has been taken out, otherwise false
+     */
+    bool tryPop(T& outValue);
+
+    /**
+     * @brief Closes the queue. Wakes up all blocked producers and consumers.
+     */
+    void close();
+
+    /**
+     * @return Current amount of elements
+     */
+    size_t size() const;
+
+    /**
+     * @return Occupancy statistics since construction
+     */
+    Stats stats() const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    size_t const m_capacity;
+    std::deque<T> m_queue;
+    bool m_closed = false;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_notFull;
+    std::condition_variable m_notEmpty;
+    size_t m_numPopped = 0;
+    size_t m_sizeSum = 0;
+    Clock::duration m_pushWait{0};
+    Clock::duration m_popWait{0};
+};
+
+#include "BoundedQueue.inl"
+
+#endif //HSEG_BOUNDEDQUEUE_H
@@ -0,0 +1,99 @@
+//
+// Created by jan on 18.10.26.
+//
+
+template<typename T>
+BoundedQueue<T>::BoundedQueue(size_t capacity)
+        : m_capacity(capacity > 0 ? capacity : 1)
+{
+}
+
+template<typename T>
+bool BoundedQueue<T>::push(T value)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(m_queue.size() >= m_capacity && !m_closed)
+    {
+        auto const start = Clock::now();
+        m_notFull.wait(lock, [this] { return m_queue.size() < m_capacity || m_closed; });
+        m_pushWait += Clock::now() - start;
+    }
+    if(m_closed)
+        return false;
+
+    m_queue.push_back(std::move(value));
+    lock.unlock();
+    m_notEmpty.notify_one();
+    return true;
+}
+
+template<typename T>
+bool BoundedQueue<T>::pop(T& outValue)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(m_queue.empty() && !m_closed)
+    {
+        auto const start = Clock::now();
+        m_notEmpty.wait(lock, [this] { return !m_queue.empty() || m_closed; });
+        m_popWait += Clock::now() - start;
+    }
+    if(m_queue.empty())
+        return false;
+
+    m_sizeSum += m_queue.size();
+    m_numPopped++;
+    outValue = std::move(m_queue.front());
+    m_queue.pop_front();
+    lock.unlock();
+    m_notFull.notify_one();
+    return true;
+}
+
+template<typename T>
+bool BoundedQueue<T>::tryPop(T& outValue)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(m_queue.empty())
+        return false;
+
+    m_sizeSum += m_queue.size();
+    m_numPopped++;
+    outValue = std::move(m_queue.front());
+    m_queue.pop_front();
+    lock.unlock();
+    m_notFull.notify_one();
+    return true;
+}
+
+template<typename T>
+void BoundedQueue<T>::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_closed = true;
+    }
+    m_notFull.notify_all();
+    m_notEmpty.notify_all();
+}
+
+template<typename T>
+size_t BoundedQueue<T>::size() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_queue.size();
+}
+
+template<typename T>
+typename BoundedQueue<T>::Stats BoundedQueue<T>::stats() const
+{
+    using Seconds = std::chrono::duration<float>;
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    Stats stats;
+    stats.capacity = m_capacity;
+    stats.numPopped = m_numPopped;
+    stats.meanSize = m_numPopped > 0 ? static_cast<float>(m_sizeSum) / m_numPopped : 0.f;
+    stats.pushWaitSeconds = std::chrono::duration_cast<Seconds>(m_pushWait).count();
+    stats.popWaitSeconds = std::chrono::duration_cast<Seconds>(m_popWait).count();
+    return stats;
+}
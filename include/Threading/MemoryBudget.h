@@ -0,0 +1,129 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#ifndef HSEG_MEMORYBUDGET_H
+#define HSEG_MEMORYBUDGET_H
+
+#include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <ostream>
+#include <utility>
+
+/**
+ * @brief Statistics of a memory budget
+ */
+struct MemoryBudgetStats
+{
+    size_t budget = 0; //< In bytes, 0 means unlimited
+    size_t peak = 0; //< Highest amount of reserved bytes
+    size_t numAdmitted = 0;
+    size_t numOversized = 0; //< Reservations larger than the budget, which have been admitted on their own
+    double waitSeconds = 0; //< Time spent waiting for memory, summed up over all threads
+};
+
+inline std::ostream& operator<<(std::ostream& out, MemoryBudgetStats const& stats)
+{
+    return out << "peak " << stats.peak / (1024 * 1024) << "/" << stats.budget / (1024 * 1024) << "MiB, "
+               << stats.numAdmitted << " admitted (" << stats.numOversized << " oversized), blocked "
+               << stats.waitSeconds << "s";
+}
+
+/**
+ * @brief Admission control for memory hungry work items
+ * @details Before an item is started, its estimated memory is reserved. This blocks until the reservation fits into
+ *          the budget along with all others. Reservations are admitted in the order they have been requested. An item
+ *          larger than the whole budget is admitted as soon as nothing else is reserved, so it still makes progress.
+ */
+class MemoryBudget
+{
+public:
+    /**
+     * @brief Releases its bytes when destroyed
+     */
+    class Reservation
+    {
+    public:
+        Reservation() = default;
+
+        Reservation(Reservation&& other) noexcept;
+
+        Reservation& operator=(Reservation&& other) noexcept;
+
+        ~Reservation();
+
+        /**
+         * @brief Releases the reserved bytes early
+         */
+        void release();
+
+        /**
+         * @return Amount of reserved bytes
+         */
+        size_t bytes() const;
+
+    private:
+        friend class MemoryBudget;
+
+        Reservation(MemoryBudget* pBudget, size_t bytes);
+
+        MemoryBudget* m_pBudget = nullptr;
+        size_t m_bytes = 0;
+    };
+
+    /**
+     * @brief Constructor
+     * @param budget Amount of bytes that may be reserved at the same time. 0 means unlimited.
+     */
+    explicit MemoryBudget(size_t budget);
+
+    /**
+     * @brief Reserves memory, blocking until it fits into the budget
+     * @param bytes Amount of bytes to reserve
+     * @return The reservation, which has to be destroyed before the budget
+     */
+    Reservation acquire(size_t bytes);
+
+    /**
+     * @return Amount of bytes currently reserved
+     */
+    size_t used() const;
+
+    MemoryBudgetStats stats() const;
+
+    /**
+     * @brief Binds a reservation to a function. The reservation is released when the returned function object is
+     *        destroyed, e.g. by the thread pool as soon as the job that calls it is done.
+     * @param reservation The reservation
+     * @param fun Function to call
+     * @return Function object forwarding its arguments to \p fun
+     */
+    template<typename Fun>
+    static auto bind(Reservation reservation, Fun fun);
+
+private:
+    size_t const m_budget;
+    size_t m_used = 0;
+    mutable std::mutex m_mutex;
+    std::condition_variable m_released;
+    size_t m_nextTicket = 0;
+    size_t m_nowServing = 0;
+    size_t m_peak = 0;
+    size_t m_numAdmitted = 0;
+    size_t m_numOversized = 0;
+    std::chrono::steady_clock::duration m_wait{0};
+
+    void release(size_t bytes);
+};
+
+template<typename Fun>
+auto MemoryBudget::bind(Reservation reservation, Fun fun)
+{
+    return [reservation = std::move(reservation), fun = std::move(fun)](auto&& ... args) mutable
+    {
+        return fun(std::forward<decltype(args)>(args)...);
+    };
+}
+
+#endif //HSEG_MEMORYBUDGET_H
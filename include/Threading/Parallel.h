@@ -0,0 +1,40 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#ifndef HSEG_PARALLEL_H
+#define HSEG_PARALLEL_H
+
+#include "TaskGroup.h"
+
+/**
+ * @brief Splits [begin, end) into blocks of at most \p grain elements and processes them on a thread pool
+ * @details The calling thread takes part in the work, so this may be called from within a job of the same pool.
+ * @param pool Pool to use
+ * @param begin First index
+ * @param end One past the last index
+ * @param grain Maximum block size
+ * @param block Functor called as block(blockBegin, blockEnd)
+ */
+template<typename Index, typename BlockFun>
+void parallelFor(ThreadPool& pool, Index begin, Index end, Index grain, BlockFun const& block);
+
+/**
+ * @brief Recursively halves [begin, end) until a block has at most \p grain elements, evaluates \p block on every such
+ *        block on a thread pool and sums up the results along the same binary tree
+ * @details The tree only depends on the range and the grain, therefore the result is the same for any amount of
+ *          threads, even for floating point types. The calling thread takes part in the work.
+ * @param pool Pool to use
+ * @param begin First index
+ * @param end One past the last index
+ * @param grain Maximum block size
+ * @param block Functor called as block(blockBegin, blockEnd). The result type needs operator+=.
+ * @return Sum of all block results
+ */
+template<typename Index, typename BlockFun>
+auto parallelReduce(ThreadPool& pool, Index begin, Index end, Index grain, BlockFun const& block)
+    -> decltype(block(begin, end));
+
+#include "Parallel.inl"
+
+#endif //HSEG_PARALLEL_H
@@ -0,0 +1,50 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#include <memory>
+#include <algorithm>
+
+template<typename Index, typename BlockFun>
+void parallelFor(ThreadPool& pool, Index begin, Index end, Index grain, BlockFun const& block)
+{
+    grain = std::max<Index>(grain, 1);
+    if (end - begin <= grain)
+    {
+        if (begin < end)
+            block(begin, end);
+        return;
+    }
+
+    // The first block is processed by the calling thread
+    TaskGroup group(pool);
+    for (Index blockBegin = begin + grain; blockBegin < end;)
+    {
+        Index const blockEnd = blockBegin + std::min<Index>(grain, end - blockBegin);
+        group.run([&block, blockBegin, blockEnd] { block(blockBegin, blockEnd); });
+        blockBegin = blockEnd;
+    }
+    block(begin, begin + grain);
+    group.wait();
+}
+
+template<typename Index, typename BlockFun>
+auto parallelReduce(ThreadPool& pool, Index begin, Index end, Index grain, BlockFun const& block)
+    -> decltype(block(begin, end))
+{
+    using Result = decltype(block(begin, end));
+
+    grain = std::max<Index>(grain, 1);
+    if (end - begin <= grain)
+        return block(begin, end);
+
+    // Results aren't required to be default constructible, thus the right half is stored on the heap
+    Index const mid = begin + (end - begin) / 2;
+    std::unique_ptr<Result> pRight;
+    TaskGroup group(pool);
+    group.run([&] { pRight = std::make_unique<Result>(parallelReduce(pool, mid, end, grain, block)); });
+    Result left = parallelReduce(pool, begin, mid, grain, block);
+    group.wait();
+    left += *pRight;
+    return left;
+}
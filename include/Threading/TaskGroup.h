@@ -0,0 +1,86 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#ifndef HSEG_TASKGROUP_H
+#define HSEG_TASKGROUP_H
+
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <exception>
+#include "ThreadPool.h"
+
+/**
+ * @brief A set of tasks on a thread pool that can be waited for as a whole
+ * @details Tasks are kept in a list of the group, and every task posts a job to the pool that runs one of them. The
+ *          waiting thread works off the tasks that haven't been started yet itself, and then sleeps until those running
+ *          on other threads are done. It never picks up unrelated jobs of the pool. Thus a job may spawn a task group
+ *          and wait for it without deadlocking, even if all threads of the pool are waiting for nested groups.
+ */
+class TaskGroup
+{
+public:
+    /**
+     * @brief Constructor
+     * @param pool Pool to run the tasks on
+     */
+    explicit TaskGroup(ThreadPool& pool);
+
+    TaskGroup(TaskGroup const&) = delete;
+
+    TaskGroup& operator=(TaskGroup const&) = delete;
+
+    /**
+     * @brief Waits for all tasks. Exceptions are dropped, call wait() to get them.
+     */
+    ~TaskGroup();
+
+    /**
+     * @brief Adds a task to the group
+     * @param fun Function to execute. It is moved into the job if passed as rvalue.
+     */
+    template<typename Fun>
+    void run(Fun&& fun);
+
+    /**
+     * @brief Runs the tasks of this group that haven't been started yet on the calling thread, then waits for the rest
+     * @details If a task threw an exception, the first one is rethrown here
+     */
+    void wait();
+
+private:
+    /**
+     * @brief State shared with the jobs posted to the pool, which may outlive the group
+     */
+    struct State
+    {
+        std::mutex mutex;
+        std::condition_variable done;
+        std::deque<ThreadPool::Job*> tasks; //< Tasks that haven't been started yet
+        size_t numPending = 0; //< Tasks that haven't finished yet
+        std::exception_ptr exception;
+
+        ~State();
+
+        /**
+         * @brief Runs one of the tasks that haven't been started yet
+         * @return True if a task has been run, false if there was none left
+         */
+        bool runOne();
+
+        /**
+         * @brief Marks a task as done
+         * @param e Exception thrown by the task, if any
+         */
+        void finish(std::exception_ptr e);
+    };
+
+    ThreadPool& m_pool;
+    std::shared_ptr<State> m_pState;
+};
+
+#include "TaskGroup.inl"
+
+#endif //HSEG_TASKGROUP_H
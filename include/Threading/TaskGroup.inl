@@ -0,0 +1,31 @@
+//
+// Created by jan on 19.10.26.
+//
+
+template<typename Fun>
+void TaskGroup::run(Fun&& fun)
+{
+    State* pState = m_pState.get();
+    ThreadPool::Job* task = ThreadPool::JobAllocator::allocate();
+    task->assign([pState, fun = std::forward<Fun>(fun)]() mutable
+                 {
+                     std::exception_ptr e;
+                     try
+                     {
+                         fun();
+                     }
+                     catch (...)
+                     {
+                         e = std::current_exception();
+                     }
+                     pState->finish(e);
+                 });
+    {
+        std::lock_guard<std::mutex> lock(m_pState->mutex);
+        m_pState->tasks.push_back(task);
+        m_pState->numPending++;
+    }
+
+    // The task might have been run by the waiting thread already when the job is picked up
+    m_pool.post([pState = m_pState] { pState->runOne(); });
+}
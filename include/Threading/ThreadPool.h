@@ -12,15 +12,25 @@
 #define DBGL_THREADPOOL_H
 
 #include <future>
+#include <tuple>
+#include <utility>
+#include <type_traits>
+#include <cstddef>
 #include <thread>
 #include <functional>
 #include <mutex>
 #include <vector>
-#include <deque>
+#include <memory>
+#include <atomic>
+#include <condition_variable>
+#include "BoundedQueue.h"
 
 /**
- * @brief A thread pool which works off its jobs on a first-come-first-served basis
- * @details If the thread pool is getting destructed before all the jobs are done, then it will finish all the
+ * @brief A thread pool which works off its jobs roughly on a first-come-first-served basis
+ * @details Every thread owns a job queue. Jobs are distributed round-robin among them, jobs enqueued from within a
+ *          job go to the queue of the current thread. Threads that run out of work steal from the others, and park on
+ *          a condition variable if there is nothing left. Enqueueing is lock-free unless threads have to be woken up.
+ *          If the thread pool is getting destructed before all the jobs are done, then it will finish all the
  *          computations that have already been started, and then skips anything left in the queue. Thus it's the
  *          programmers responsibility to keep the thread pool alive as long as needed.
  */
@@ -42,41 +52,185 @@ private:
          * @brief Executes the job
          */
         virtual void execute() = 0;
+
+        std::atomic<IJob*> m_next{nullptr}; //< Link within a job queue
     };
 
     /**
-     * @brief Actual job implementation
+     * @brief Placeholder that is always part of a job queue, so the queue never becomes empty
      */
-    template<typename R>
-    class Job : public IJob
+    class StubJob : public IJob
     {
+    public:
+        virtual void execute()
+        {
+        }
+    };
+
+    /**
+     * @brief Intrusive multi-producer queue (Vyukov). Pushing is lock-free, popping needs to be serialized.
+     */
+    class JobQueue
+    {
+    public:
+        JobQueue();
+
+        /**
+         * @brief Appends a job. May be called from any thread at any time.
+         */
+        void push(IJob* job);
+
+        /**
+         * @brief Removes the oldest job. Only one thread may pop at a time, see m_popMutex.
+         * @return The job or nullptr, if the queue is empty or a concurrent push hasn't completed yet
+         */
+        IJob* pop();
+
+        std::mutex m_popMutex;
+
     private:
-        std::packaged_task<R()> m_task;
+        std::atomic<IJob*> m_head;
+        IJob* m_tail;
+        StubJob m_stub;
+    };
+
+    /**
+     * @brief Actual job implementation, holding any callable without a return value
+     * @details Callables up to s_inlineSize bytes are stored within the job itself, larger ones on the heap. Jobs
+     *          are recycled by the JobAllocator, thus submitting a small job doesn't allocate at all.
+     */
+    class Job : public IJob
+    {
     public:
         /**
-         * @brief Constructs a job from a task
-         * @param fun Function to execute
+         * @brief Destructor
          */
-        template<typename T>
-        Job(T fun);
+        virtual ~Job();
 
         /**
-         * @copydoc IJob::execute()
+         * @brief Stores a callable in this job
+         * @param fun Callable to store. The job must not hold a callable already.
+         */
+        template<typename Fun>
+        void assign(Fun&& fun);
+
+        /**
+         * @brief Executes and destroys the callable
          */
         virtual void execute();
 
         /**
-         * @brief Retrieves the future object
+         * @brief Destroys the callable without executing it
+         */
+        void reset();
+
+        static constexpr size_t s_inlineSize = 128;
+
+    private:
+        using Storage = std::aligned_storage<s_inlineSize, alignof(std::max_align_t)>::type;
+
+        Storage m_storage;
+        void* m_pFun = nullptr; //< Points to the callable, either within m_storage or on the heap
+        void (* m_pInvoke)(void*) = nullptr;
+        void (* m_pDestroy)(void*) = nullptr;
+
+        template<typename F, typename Fun>
+        void emplace(Fun&& fun, std::true_type);
+
+        template<typename F, typename Fun>
+        void emplace(Fun&& fun, std::false_type);
+    };
+
+    /**
+     * @brief Hands out recycled jobs
+     * @details Every thread keeps a cache of free jobs. Surplus jobs are exchanged in batches with a shared depot, so
+     *          that jobs freed by the workers can be reused by a thread that only submits.
+     */
+    class JobAllocator
+    {
+    public:
+        /**
+         * @return An empty job
+         */
+        static Job* allocate();
+
+        /**
+         * @brief Returns a job for reuse. A callable still stored in the job is destroyed without executing it.
+         * @param job The job
          */
-        auto getFuture() -> decltype(m_task.get_future());
+        static void release(Job* job);
+
+    private:
+        struct Cache
+        {
+            std::vector<Job*> jobs;
+
+            ~Cache();
+        };
+
+        struct Depot
+        {
+            std::mutex mutex;
+            std::vector<std::vector<Job*>> batches;
+
+            ~Depot();
+        };
+
+        static thread_local Cache s_cache;
+        static Depot s_depot;
     };
 
+    /**
+     * @brief A function together with its arguments, which are passed as rvalues when it is invoked
+     * @details Function and arguments are decayed copies (or moved in), which allows for move-only types. The task
+     *          may only be invoked once.
+     */
+    template<typename Fun, typename... Args>
+    class Task
+    {
+    public:
+        template<typename F, typename... A>
+        explicit Task(F&& fun, A&& ... args);
+
+        auto operator()() -> std::result_of_t<Fun(Args...)>;
+
+    private:
+        Fun m_fun;
+        std::tuple<Args...> m_args;
+
+        template<size_t... I>
+        auto invoke(std::index_sequence<I...>) -> std::result_of_t<Fun(Args...)>;
+    };
+
+    template<typename Fun, typename... Args>
+    using TaskOf = Task<std::decay_t<Fun>, std::decay_t<Args>...>;
+
+    template<typename Fun, typename... Args>
+    using ResultOf = std::result_of_t<std::decay_t<Fun>(std::decay_t<Args>...)>;
+
+    template<typename R, typename T>
+    static void fulfill(std::promise<R>& promise, T& task);
+
+    template<typename T>
+    static void fulfill(std::promise<void>& promise, T& task);
+
+    /**
+     * @brief Reports the exception that is currently being handled to std::cerr
+     */
+    static void reportException();
+
+    friend class TaskGroup; // Keeps its own tasks in recycled jobs
+
 public:
     /**
      * @brief Creates a thread pool with a number of threads
      * @param threads Amount of threads to generate
+     * @param maxQueued Maximum amount of queued jobs. If the queue is full, enqueueing blocks until a thread picks up
+     *                  a job. 0 means unbounded. Jobs enqueued from within a job of this pool are never blocked.
+     * @param pinThreads If true, threads are distributed over the NUMA nodes and pinned to the CPUs of their node.
+     *                   Idle threads then prefer to steal jobs from threads of the same node.
      */
-    explicit ThreadPool(unsigned int threads);
+    explicit ThreadPool(unsigned int threads, size_t maxQueued = 0, bool pinThreads = false);
 
     /**
      * @brief Destructor
@@ -85,13 +239,51 @@ public:
 
     /**
      * @brief Enqueue a job to the thread pool
-     * @details As soon as there is a thread available, the job will be processed
+     * @details As soon as there is a thread available, the job will be processed. Function and arguments are moved
+     *          into the job if they are passed as rvalues, and copied otherwise. They are passed to the function as
+     *          rvalues. If the pool is destroyed before the job has been started, the future reports a
+     *          std::future_error with std::future_errc::broken_promise.
      * @param fun Function executing the job
      * @param args Arguments to pass to \p fun
      * @returns A std::future which can be used to access the computation result
      */
     template<typename Fun, typename... Args>
-    auto enqueue(Fun fun, Args... args) -> std::future<decltype(fun(args...))>;
+    auto enqueue(Fun&& fun, Args&& ... args) -> std::future<ResultOf<Fun, Args...>>;
+
+    /**
+     * @brief Enqueue a job whose result is pushed to a completion queue as soon as it is done
+     * @details This allows to consume results in the order they are completed instead of the order they have been
+     *          enqueued in. The completion queue has to be large enough to hold all results that aren't consumed
+     *          yet, otherwise threads of this pool block.
+     *          Every job pushes exactly one result, so consumers can count them. If \p fun throws, the exception is
+     *          reported to std::cerr and a value-initialized R is pushed instead. R has to be default constructible,
+     *          and its default value should mark the result as failed.
+     * @param completionQueue Queue to push the result to
+     * @param fun Function executing the job
+     * @param args Arguments to pass to \p fun
+     */
+    template<typename R, typename Fun, typename... Args>
+    void enqueueTo(BoundedQueue<R>& completionQueue, Fun&& fun, Args&& ... args);
+
+    /**
+     * @brief Enqueue a job without a way to retrieve its result
+     * @details This is the cheapest way to submit a job, as there is no shared state for a future. Arguments are
+     *          treated like in enqueue(). Exceptions escaping the job are reported on std::cerr and dropped.
+     * @param fun Function executing the job
+     * @param args Arguments to pass to \p fun
+     */
+    template<typename Fun, typename... Args>
+    void post(Fun&& fun, Args&& ... args);
+
+    /**
+     * @return The pool the calling thread belongs to, or nullptr if it isn't a thread of any pool
+     */
+    static ThreadPool* current();
+
+    /**
+     * @return Index of the calling thread within its pool, or -1 if it isn't a thread of any pool
+     */
+    static int currentIndex();
 
     /**
      * @brief Retrieves the amount of threads within this pool
@@ -105,12 +297,41 @@ public:
     size_t queued() const;
 
 private:
-    void runThread();
+    void runThread(size_t index);
+
+    void push(Job* job);
+
+    /**
+     * @brief Reserves one of the queued jobs for the calling thread
+     * @return True if a job has been reserved, false if there are none
+     */
+    bool claim();
+
+    /**
+     * @brief Takes a job from the own queue, or steals one from another thread
+     * @param index Index of the calling thread
+     * @return The job or nullptr if none could be found right now
+     */
+    Job* take(size_t index);
+
+    /**
+     * @brief Executes a job and recycles it afterwards
+     */
+    static void run(Job* job);
 
     std::vector<std::thread> m_threads;
-    std::deque<IJob*> m_jobs;
-    std::mutex m_internalMutex;
-    bool m_shutdown = false;
+    std::vector<std::unique_ptr<JobQueue>> m_queues; //< One per thread
+    std::vector<std::vector<size_t>> m_victims; //< Per thread: own queue, then queues of the same node, then the rest
+    bool m_pinThreads = false;
+    std::atomic<size_t> m_numQueued{0}; //< Jobs that have been pushed but not claimed yet
+    std::atomic<size_t> m_nextQueue{0}; //< Round-robin position for jobs enqueued from outside the pool
+    size_t m_maxQueued = 0;
+    std::mutex m_sleepMutex; //< Only taken to park threads and to wake them up
+    std::condition_variable m_jobAvailable;
+    std::condition_variable m_slotAvailable;
+    std::atomic<size_t> m_numParked{0}; //< Threads waiting for jobs
+    std::atomic<size_t> m_numBlocked{0}; //< Producers waiting for a free slot
+    std::atomic_bool m_shutdown{false};
 };
 
 #include "ThreadPool.inl"
@@ -8,35 +8,121 @@
 /// it might also begin to hurt your kittens.
 //////////////////////////////////////////////////////////////////////
 
-template<typename R>
-template<typename T>
-ThreadPool::Job<R>::Job(T fun) : m_task{fun}
+template<typename Fun>
+void ThreadPool::Job::assign(Fun&& fun)
 {
+    using F = std::decay_t<Fun>;
+    emplace<F>(std::forward<Fun>(fun),
+               std::integral_constant<bool, sizeof(F) <= s_inlineSize && alignof(F) <= alignof(Storage)>{});
+    m_pInvoke = [](void* pFun) { (*static_cast<F*>(pFun))(); };
 }
 
-template<typename R>
-void ThreadPool::Job<R>::execute()
+template<typename F, typename Fun>
+void ThreadPool::Job::emplace(Fun&& fun, std::true_type /*inline*/)
 {
-    m_task();
+    m_pFun = new(&m_storage) F(std::forward<Fun>(fun));
+    m_pDestroy = [](void* pFun) { static_cast<F*>(pFun)->~F(); };
 }
 
-template<typename R>
-auto ThreadPool::Job<R>::getFuture() -> decltype(m_task.get_future())
+template<typename F, typename Fun>
+void ThreadPool::Job::emplace(Fun&& fun, std::false_type /*inline*/)
 {
-    return m_task.get_future();
+    m_pFun = new F(std::forward<Fun>(fun));
+    m_pDestroy = [](void* pFun) { delete static_cast<F*>(pFun); };
 }
 
 template<typename Fun, typename... Args>
-auto ThreadPool::enqueue(Fun fun, Args... args) -> std::future<decltype(fun(args...))>
+template<typename F, typename... A>
+ThreadPool::Task<Fun, Args...>::Task(F&& fun, A&& ... args)
+    : m_fun(std::forward<F>(fun)),
+      m_args(std::forward<A>(args)...)
 {
-    using Result = decltype(fun(args...));
+}
+
+template<typename Fun, typename... Args>
+auto ThreadPool::Task<Fun, Args...>::operator()() -> std::result_of_t<Fun(Args...)>
+{
+    return invoke(std::index_sequence_for<Args...>{});
+}
+
+template<typename Fun, typename... Args>
+template<size_t... I>
+auto ThreadPool::Task<Fun, Args...>::invoke(std::index_sequence<I...>) -> std::result_of_t<Fun(Args...)>
+{
+    return std::move(m_fun)(std::move(std::get<I>(m_args))...);
+}
+
+template<typename R, typename T>
+void ThreadPool::fulfill(std::promise<R>& promise, T& task)
+{
+    try
+    {
+        promise.set_value(task());
+    }
+    catch (...)
+    {
+        promise.set_exception(std::current_exception());
+    }
+}
 
-    Job <Result>* job = new Job <Result>{std::move(std::bind(fun, args...))};
+template<typename T>
+void ThreadPool::fulfill(std::promise<void>& promise, T& task)
+{
+    try
+    {
+        task();
+        promise.set_value();
+    }
+    catch (...)
+    {
+        promise.set_exception(std::current_exception());
+    }
+}
 
-    m_internalMutex.lock();
-    m_jobs.push_back(job);
-    auto future = job->getFuture();
-    m_internalMutex.unlock();
+template<typename Fun, typename... Args>
+auto ThreadPool::enqueue(Fun&& fun, Args&& ... args) -> std::future<ResultOf<Fun, Args...>>
+{
+    // A job that is never run releases its promise, which breaks the future
+    std::promise<ResultOf<Fun, Args...>> promise;
+    auto future = promise.get_future();
+    Job* job = JobAllocator::allocate();
+    job->assign([promise = std::move(promise), task = TaskOf<Fun, Args...>(std::forward<Fun>(fun),
+                                                                           std::forward<Args>(args)...)]() mutable
+                {
+                    fulfill(promise, task);
+                });
+    push(job);
 
     return future;
 }
+
+template<typename R, typename Fun, typename... Args>
+void ThreadPool::enqueueTo(BoundedQueue<R>& completionQueue, Fun&& fun, Args&& ... args)
+{
+    static_assert(std::is_default_constructible<R>::value, "Failed jobs push a default constructed result");
+
+    Job* job = JobAllocator::allocate();
+    job->assign([&completionQueue, task = TaskOf<Fun, Args...>(std::forward<Fun>(fun),
+                                                              std::forward<Args>(args)...)]() mutable
+                {
+                    // Consumers wait for one result per job, thus a failed job still has to push one
+                    try
+                    {
+                        completionQueue.push(task());
+                    }
+                    catch (...)
+                    {
+                        reportException();
+                        completionQueue.push(R{});
+                    }
+                });
+    push(job);
+}
+
+template<typename Fun, typename... Args>
+void ThreadPool::post(Fun&& fun, Args&& ... args)
+{
+    Job* job = JobAllocator::allocate();
+    job->assign(TaskOf<Fun, Args...>(std::forward<Fun>(fun), std::forward<Args>(args)...));
+    push(job);
+}
@@ -0,0 +1,76 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#ifndef HSEG_TOPOLOGY_H
+#define HSEG_TOPOLOGY_H
+
+#include <vector>
+#include <memory>
+#include <string>
+
+/**
+ * @brief NUMA layout of the machine, i.e. which CPUs belong to which memory node
+ * @details The layout is read from sysfs once. Only CPUs the process may run on are considered. If there is no NUMA
+ *          information, all of them form a single node.
+ */
+class Topology
+{
+public:
+    /**
+     * @return The topology of this machine
+     */
+    static Topology const& get();
+
+    /**
+     * @return Amount of nodes with at least one usable CPU
+     */
+    size_t numNodes() const;
+
+    /**
+     * @param node Node index
+     * @return CPUs of the node
+     */
+    std::vector<int> const& cpus(size_t node) const;
+
+    /**
+     * @brief Restricts the calling thread to the CPUs of a node
+     * @details Memory is placed on the node of the thread that touches it first, thus everything the thread
+     *          allocates and initializes afterwards is local to it.
+     * @param node Node index
+     * @return True in case of success, otherwise false
+     */
+    bool pinToNode(size_t node) const;
+
+    /**
+     * @return The node the calling thread has been pinned to, or -1 if it hasn't been pinned
+     */
+    static int currentNode();
+
+    /**
+     * @brief Copies an object on the calling thread, so the copy is allocated on the node of this thread
+     * @details Memory the copy shares with the original stays where it is, e.g. features of a mapped FeatureImage.
+     *          Call FeatureImage::detach() on the copy to localize them as well.
+     * @param obj Object to copy
+     * @return The copy
+     */
+    template<typename T>
+    static std::shared_ptr<T> localCopy(T const& obj)
+    {
+        return std::make_shared<T>(obj);
+    }
+
+    /**
+     * @brief Parses a CPU list as used by sysfs, e.g. "0-3,8,10-11"
+     * @param list The list
+     * @return The CPUs in the list
+     */
+    static std::vector<int> parseCpuList(std::string const& list);
+
+private:
+    Topology();
+
+    std::vector<std::vector<int>> m_nodes;
+};
+
+#endif //HSEG_TOPOLOGY_H
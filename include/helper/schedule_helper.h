@@ -0,0 +1,28 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#ifndef HSEG_SCHEDULE_HELPER_H
+#define HSEG_SCHEDULE_HELPER_H
+
+#include <cstddef>
+#include <vector>
+
+namespace helper
+{
+    namespace schedule
+    {
+        /**
+         * Orders items by their estimated cost, largest first. If the items are processed by a pool of workers, this
+         * keeps a single large item from being started last and holding up the end of the batch.
+         * @param costs Estimated cost of every item
+         * @param numBuckets If 0, the items are sorted strictly. Otherwise the cost range is split into this many
+         *                   buckets of equal width. Buckets are ordered largest first, but items within a bucket keep
+         *                   their relative order, e.g. a random one.
+         * @return Indices of the items in the order they should be processed
+         */
+        std::vector<size_t> largestFirst(std::vector<size_t> const& costs, size_t numBuckets = 0);
+    }
+}
+
+#endif //HSEG_SCHEDULE_HELPER_H
@@ -157,15 +157,15 @@ namespace caffe {
             for (int i = 0; i < bottom[0]->num(); ++i)
             {
                 EnergyFunction energy(&weights_, numClusters_);
-                FeatureImage gradGt(gtResult_[i].labeling.width(), gtResult_[i].labeling.height(), bottom[0]->channels());
+                Eigen::MatrixXf gradGt, gradPred; // One column per site
                 energy.computeFeatureGradient(gradGt, gtResult_[i].labeling, gtResult_[i].clustering,
                                               gtResult_[i].clusters, features_[i]);
-                FeatureImage gradPred(predResult_[i].labeling.width(), predResult_[i].labeling.height(), bottom[0]->channels());
                 energy.computeFeatureGradient(gradPred, predResult_[i].labeling, predResult_[i].clustering,
                                               predResult_[i].clusters, features_[i]);
 
                 // Compute gradient
-                gradGt.subtract(gradPred);
+                gradGt -= gradPred;
+                Coord const gradWidth = gtResult_[i].labeling.width();
 
                 // Write back
                 for (Coord x = 0; x < bottom[0]->width(); ++x)
@@ -179,7 +179,7 @@ namespace caffe {
                             for (Coord c = 0; c < features_[i].dim(); ++c)
                             {
                                 if (l < numClasses_)
-                                    *(bottom[0]->mutable_cpu_diff_at(i, c, y, x)) = gradGt.at(x - bb.x, y - bb.y)[c] / bottom[0]->num();
+                                    *(bottom[0]->mutable_cpu_diff_at(i, c, y, x)) = gradGt(c, x - bb.x + (y - bb.y) * gradWidth) / bottom[0]->num();
                                 else
                                     *(bottom[0]->mutable_cpu_diff_at(i, c, y, x)) = 0;
                             }
@@ -0,0 +1,494 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <iomanip>
+#include <cstring>
+#include <cstdio>
+#include <deque>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <boost/filesystem.hpp>
+#include <helper/image_helper.h>
+#include <Threading/ThreadPool.h>
+#include "Dataset/DatasetCache.h"
+
+namespace
+{
+    /**
+     * Identifies the file format. Has to be changed whenever the layout of the file or the preprocessing changes.
+     */
+    char const s_magic[8] = {'H', 'S', 'E', 'G', 'D', 'C', '0', '2'};
+
+    /**
+     * Samples and their features start at multiples of this within the file, so features can be used right from the
+     * mapping
+     */
+    size_t const s_alignment = 8;
+
+    /**
+     * Layout of the file:
+     *  - Header
+     *  - For every sample: Ground truth header, ground truth labels, padding, pixel features, cluster features, padding
+     *  - Index: For every sample: length of the name, name, offset and size of the sample
+     */
+    struct Header
+    {
+        char magic[8];
+        uint64_t numSamples;
+        uint64_t indexOffset;
+    };
+
+    struct LabelHeader
+    {
+        uint32_t width;
+        uint32_t height;
+    };
+
+    uint64_t fnv1a(std::string const& str)
+    {
+        uint64_t hash = 14695981039346656037ull;
+        for(char c : str)
+        {
+            hash ^= static_cast<unsigned char>(c);
+            hash *= 1099511628211ull;
+        }
+        return hash;
+    }
+
+    template<typename T>
+    void writePod(std::ostream& out, T const& value)
+    {
+        out.write(reinterpret_cast<char const*>(&value), sizeof(T));
+    }
+
+    size_t padding(size_t size)
+    {
+        return (s_alignment - size % s_alignment) % s_alignment;
+    }
+
+    void writePadding(std::ostream& out, size_t size)
+    {
+        char const zeros[s_alignment] = {};
+        out.write(zeros, padding(size));
+    }
+
+    template<typename T>
+    bool readPod(char const* data, size_t size, size_t& pos, T& outValue)
+    {
+        if(size - pos < sizeof(T))
+            return false;
+        std::memcpy(&outValue, data + pos, sizeof(T));
+        pos += sizeof(T);
+        return true;
+    }
+
+    bool writeSample(std::ostream& out, TrainingSample const& sample)
+    {
+        LabelHeader header{sample.gt.width(), sample.gt.height()};
+        writePod(out, header);
+        size_t const labelSize = sample.gt.data().size() * sizeof(Label);
+        out.write(reinterpret_cast<char const*>(sample.gt.data().data()), labelSize);
+        writePadding(out, sizeof(header) + labelSize);
+        return sample.pxFeatures.writeBinary(out) && sample.clusterFeatures.writeBinary(out);
+    }
+
+    size_t availableMemory()
+    {
+        long const pages = sysconf(_SC_AVPHYS_PAGES);
+        long const pageSize = sysconf(_SC_PAGESIZE);
+        if(pages < 0 || pageSize < 0)
+            return 0;
+        return static_cast<size_t>(pages) * static_cast<size_t>(pageSize);
+    }
+}
+
+DatasetCache::~DatasetCache()
+{
+    close();
+}
+
+bool DatasetCache::preprocess(TrainingSampleSource const& source, std::string const& filename,
+                              TrainingSample& outSample)
+{
+    std::string pxFeatFilename = source.pxPath + filename + source.pxExtension;
+    std::string clusterFeatFilename = source.clusterPath + filename + source.clusterExtension;
+    std::string gtFilename = source.gtPath + filename + source.gtExtension;
+
+    FeatureImage& pxFeatures = outSample.pxFeatures;
+    if(!pxFeatures.read(pxFeatFilename, source.precision))
+    {
+        std::cerr << "Unable to read features from \"" << pxFeatFilename << "\"" << std::endl;
+        return false;
+    }
+    FeatureImage& clusterFeatures = outSample.clusterFeatures;
+    if(!clusterFeatures.read(clusterFeatFilename, source.precision))
+    {
+        std::cerr << "Unable to read features from \"" << clusterFeatFilename << "\"" << std::endl;
+        return false;
+    }
+    if(clusterFeatures.width() != pxFeatures.width() || clusterFeatures.height() != pxFeatures.height())
+    {
+        if(static_cast<float>(clusterFeatures.width()) / clusterFeatures.height() ==
+           static_cast<float>(pxFeatures.width()) / pxFeatures.height())
+            clusterFeatures.rescale(pxFeatures.width(), pxFeatures.height(), true);
+        else
+        {
+            std::cerr << "Cluster and pixel feature map size don't match up: "
+                      << "(" << clusterFeatures.width() << "," << clusterFeatures.height() << ") vs. "
+                      << "(" << pxFeatures.width() << "," << pxFeatures.height() << ")." << std::endl;
+            return false;
+        }
+    }
+
+    LabelImage& gt = outSample.gt;
+    auto errCode = helper::image::readPalettePNG(gtFilename, gt, nullptr);
+    if(errCode != helper::image::PNGError::Okay)
+    {
+        std::cerr << "Unable to read ground truth from \"" << gtFilename << "\". Error Code: " << (int) errCode << std::endl;
+        return false;
+    }
+    pxFeatures.rescale(source.scaleFactor, true);
+    clusterFeatures.rescale(source.scaleFactor, true);
+    gt.rescale(pxFeatures.width(), pxFeatures.height(), false);
+
+    // Crop to valid region
+    cv::Rect bb = helper::image::computeValidBox(gt, source.numClasses);
+    LabelImage gtCropped(bb.width, bb.height);
+    for(Coord y = 0; y < gtCropped.height(); ++y)
+        for(Coord x = 0; x < gtCropped.width(); ++x)
+            gtCropped.at(x, y) = gt.at(x + bb.x, y + bb.y);
+    gt = std::move(gtCropped);
+    pxFeatures.crop(bb.x, bb.y, bb.width, bb.height);
+    clusterFeatures.crop(bb.x, bb.y, bb.width, bb.height);
+
+    if(gt.height() == 0 || gt.width() == 0 || gt.height() != pxFeatures.height() || gt.width() != pxFeatures.width()
+       || gt.height() != clusterFeatures.height() || gt.width() != clusterFeatures.width())
+    {
+        std::cerr << "Invalid ground truth or features. Dimensions: (" << gt.width() << "x" << gt.height()
+                  << ") vs. ("
+                  << pxFeatures.width() << "x" << pxFeatures.height() << ") vs. ("
+                  << clusterFeatures.width() << "x" << clusterFeatures.height() << ")." << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+std::string DatasetCache::cacheFilename(std::string const& cacheDir, TrainingSampleSource const& source,
+                                        std::vector<std::string> const& filenames)
+{
+    uint32_t scaleBits;
+    std::memcpy(&scaleBits, &source.scaleFactor, sizeof(scaleBits));
+
+    std::stringstream config;
+    config.write(s_magic, sizeof(s_magic));
+    config << '\n' << source.pxPath << '\n' << source.pxExtension
+           << '\n' << source.clusterPath << '\n' << source.clusterExtension
+           << '\n' << source.gtPath << '\n' << source.gtExtension
+           << '\n' << scaleBits << '\n' << source.numClasses << '\n' << static_cast<int>(source.precision) << '\n';
+    for(std::string const& f : filenames)
+        config << f << '\n';
+
+    std::stringstream name;
+    name << cacheDir << cachePrefix(source) << std::hex << std::setw(16) << std::setfill('0') << fnv1a(config.str())
+         << ".cache";
+    return name.str();
+}
+
+std::string DatasetCache::cachePrefix(TrainingSampleSource const& source)
+{
+    std::stringstream paths;
+    paths << source.pxPath << '\n' << source.clusterPath << '\n' << source.gtPath << '\n';
+
+    std::stringstream prefix;
+    prefix << "hseg_train_" << std::hex << std::setw(16) << std::setfill('0') << fnv1a(paths.str()) << "_";
+    return prefix.str();
+}
+
+bool DatasetCache::build(std::string const& cacheFile, TrainingSampleSource const& source,
+                         std::vector<std::string> const& filenames, uint32_t numThreads)
+{
+    std::string const tmpFile = cacheFile + ".tmp";
+    std::ofstream out(tmpFile, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!out.is_open())
+    {
+        std::cerr << "Unable to create cache file \"" << tmpFile << "\"" << std::endl;
+        return false;
+    }
+
+    Header header;
+    std::memcpy(header.magic, s_magic, sizeof(s_magic));
+    header.numSamples = filenames.size();
+    header.indexOffset = 0;
+    writePod(out, header);
+
+    std::vector<Entry> entries;
+    entries.reserve(filenames.size());
+
+    ThreadPool pool(numThreads);
+    std::deque<std::future<std::shared_ptr<TrainingSample>>> futures;
+    auto preprocessJob = [&source](std::string const& filename)
+    {
+        auto pSample = std::make_shared<TrainingSample>();
+        if(!preprocess(source, filename, *pSample))
+            pSample.reset();
+        return pSample;
+    };
+    auto writeNext = [&]()
+    {
+        auto pSample = futures.front().get();
+        futures.pop_front();
+        if(!pSample)
+            return false;
+
+        Entry entry;
+        entry.offset = static_cast<uint64_t>(out.tellp());
+        if(!writeSample(out, *pSample))
+            return false;
+        entry.size = static_cast<uint64_t>(out.tellp()) - entry.offset;
+        writePadding(out, entry.size);
+        entries.push_back(entry);
+        return true;
+    };
+
+    for(std::string const& filename : filenames)
+    {
+        futures.push_back(pool.enqueue(preprocessJob, filename));
+
+        // Only keep a few preprocessed samples in flight
+        while(futures.size() > 2 * numThreads)
+        {
+            if(!writeNext())
+            {
+                std::cerr << "Unable to add \"" << filenames[entries.size()] << "\" to the cache." << std::endl;
+                std::remove(tmpFile.c_str());
+                return false;
+            }
+        }
+    }
+    while(!futures.empty())
+    {
+        if(!writeNext())
+        {
+            std::cerr << "Unable to add \"" << filenames[entries.size()] << "\" to the cache." << std::endl;
+            std::remove(tmpFile.c_str());
+            return false;
+        }
+    }
+
+    // Write index and patch its position into the header
+    header.indexOffset = static_cast<uint64_t>(out.tellp());
+    for(size_t i = 0; i < filenames.size(); ++i)
+    {
+        uint32_t const nameLength = static_cast<uint32_t>(filenames[i].size());
+        writePod(out, nameLength);
+        out.write(filenames[i].data(), nameLength);
+        writePod(out, entries[i]);
+    }
+    out.seekp(0);
+    writePod(out, header);
+    out.close();
+
+    if(!out || std::rename(tmpFile.c_str(), cacheFile.c_str()) != 0)
+    {
+        std::cerr << "Unable to write cache file \"" << cacheFile << "\"" << std::endl;
+        std::remove(tmpFile.c_str());
+        return false;
+    }
+
+    // Caches of the same samples that have been preprocessed differently, or of another file list, are superseded
+    boost::filesystem::path const newCache(cacheFile);
+    boost::filesystem::path const dir = newCache.has_parent_path() ? newCache.parent_path() : ".";
+    std::string const prefix = cachePrefix(source);
+    boost::system::error_code error;
+    for(boost::filesystem::directory_iterator it(dir, error), end; !error && it != end; it.increment(error))
+    {
+        std::string const name = it->path().filename().string();
+        if(name.compare(0, prefix.size(), prefix) != 0 || it->path().extension() != ".cache" ||
+           it->path().filename() == newCache.filename())
+            continue;
+        std::cout << "Removing superseded dataset cache \"" << it->path().string() << "\"" << std::endl;
+        boost::system::error_code removeError;
+        boost::filesystem::remove(it->path(), removeError);
+        if(removeError)
+            std::cerr << "Unable to remove \"" << it->path().string() << "\": " << removeError.message() << std::endl;
+    }
+    return true;
+}
+
+bool DatasetCache::open(std::string const& cacheFile, size_t residentBudget)
+{
+    close();
+
+    int const fd = ::open(cacheFile.c_str(), O_RDONLY);
+    if(fd < 0)
+        return false;
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(Header))
+    {
+        ::close(fd);
+        return false;
+    }
+    size_t const dataSize = static_cast<size_t>(st.st_size);
+
+    void* pMap = mmap(nullptr, dataSize, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(pMap == MAP_FAILED)
+    {
+        std::cerr << "Unable to map cache file \"" << cacheFile << "\"" << std::endl;
+        return false;
+    }
+
+    // Mapped samples share the mapping, so it is only dropped when the last of them is gone
+    m_pMapping = std::shared_ptr<void const>(pMap, [dataSize](void const* p)
+    {
+        munmap(const_cast<void*>(p), dataSize);
+    });
+    m_pData = static_cast<char const*>(pMap);
+    m_dataSize = dataSize;
+
+    // Validate header and read index
+    Header header;
+    std::memcpy(&header, m_pData, sizeof(header));
+    if(std::memcmp(header.magic, s_magic, sizeof(s_magic)) != 0 || header.indexOffset > m_dataSize)
+    {
+        std::cerr << "Invalid cache file \"" << cacheFile << "\"" << std::endl;
+        close();
+        return false;
+    }
+    size_t pos = header.indexOffset;
+    for(uint64_t i = 0; i < header.numSamples; ++i)
+    {
+        uint32_t nameLength;
+        Entry entry;
+        bool valid = readPod(m_pData, m_dataSize, pos, nameLength) && m_dataSize - pos >= nameLength;
+        if(valid)
+        {
+            std::string name(m_pData + pos, nameLength);
+            pos += nameLength;
+            valid = readPod(m_pData, m_dataSize, pos, entry) && entry.offset <= header.indexOffset &&
+                    entry.size <= header.indexOffset - entry.offset;
+            m_index[name] = entry;
+        }
+        if(!valid)
+        {
+            std::cerr << "Corrupt index in cache file \"" << cacheFile << "\"" << std::endl;
+            close();
+            return false;
+        }
+    }
+
+    // Decode everything up front if it fits
+    if(m_dataSize <= residentBudget && m_dataSize <= availableMemory() / 2)
+    {
+        for(auto const& e : m_index)
+        {
+            auto pSample = std::make_shared<TrainingSample>();
+            if(!decode(e.second, *pSample, true))
+            {
+                std::cerr << "Corrupt sample \"" << e.first << "\" in cache file \"" << cacheFile << "\"" << std::endl;
+                close();
+                return false;
+            }
+            m_resident[e.first] = pSample;
+        }
+        m_pMapping.reset();
+        m_pData = nullptr;
+    }
+
+    return true;
+}
+
+void DatasetCache::close()
+{
+    m_pMapping.reset();
+    m_pData = nullptr;
+    m_dataSize = 0;
+    m_index.clear();
+    m_resident.clear();
+}
+
+std::shared_ptr<TrainingSample const> DatasetCache::get(std::string const& filename) const
+{
+    auto iter = m_resident.find(filename);
+    if(iter != m_resident.end())
+        return iter->second;
+
+    auto entryIter = m_index.find(filename);
+    if(entryIter == m_index.end() || m_pData == nullptr)
+        return nullptr;
+
+    auto pSample = std::make_shared<TrainingSample>();
+    if(!decode(entryIter->second, *pSample, false))
+        return nullptr;
+    return pSample;
+}
+
+bool DatasetCache::dimensions(std::string const& filename, Coord& outWidth, Coord& outHeight) const
+{
+    auto iter = m_resident.find(filename);
+    if(iter != m_resident.end())
+    {
+        outWidth = iter->second->gt.width();
+        outHeight = iter->second->gt.height();
+        return true;
+    }
+
+    auto entryIter = m_index.find(filename);
+    if(entryIter == m_index.end() || m_pData == nullptr)
+        return false;
+
+    // The ground truth is stored first, its header holds the size of the sample
+    size_t pos = 0;
+    LabelHeader header;
+    if(!readPod(m_pData + entryIter->second.offset, entryIter->second.size, pos, header))
+        return false;
+    outWidth = header.width;
+    outHeight = header.height;
+    return true;
+}
+
+size_t DatasetCache::size() const
+{
+    return m_index.size();
+}
+
+bool DatasetCache::resident() const
+{
+    return !m_resident.empty();
+}
+
+bool DatasetCache::decode(Entry const& entry, TrainingSample& outSample, bool copy) const
+{
+    char const* data = m_pData + entry.offset;
+    size_t const size = entry.size;
+    size_t pos = 0;
+
+    LabelHeader header;
+    if(!readPod(data, size, pos, header))
+        return false;
+    size_t const numLabels = static_cast<size_t>(header.width) * header.height;
+    size_t const labelSize = numLabels * sizeof(Label);
+    if(size - pos < labelSize + padding(pos + labelSize))
+        return false;
+    outSample.gt = LabelImage(header.width, header.height);
+    std::memcpy(outSample.gt.data().data(), data + pos, labelSize);
+    pos += labelSize;
+    pos += padding(pos);
+
+    auto readFeatures = [&](FeatureImage& features)
+    {
+        size_t const read = copy ? features.readBinary(data + pos, size - pos)
+                                 : features.readBinary(m_pMapping, data + pos, size - pos);
+        pos += read;
+        return read != 0;
+    };
+    return readFeatures(outSample.pxFeatures) && readFeatures(outSample.clusterFeatures);
+}
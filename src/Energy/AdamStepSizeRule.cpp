@@ -6,6 +6,7 @@
  * @brief
  * @details
  **********************************************************/
+#include <iostream>
 #include "Energy/AdamStepSizeRule.h"
 
 AdamStepSizeRule::AdamStepSizeRule(float alpha, float beta1, float beta2, float eps, size_t numClasses, size_t featDimPx,
@@ -58,3 +59,20 @@ bool AdamStepSizeRule::read(std::string const& folder, size_t t)
     m_t = t;
     return success;
 }
+
+bool AdamStepSizeRule::writeState(std::ostream& out) const
+{
+    uint64_t const t = m_t;
+    out.write(reinterpret_cast<char const*>(&t), sizeof(t));
+    return m_firstMoment.write(out) && m_secondMoment.write(out);
+}
+
+bool AdamStepSizeRule::readState(std::istream& in)
+{
+    uint64_t t = 0;
+    in.read(reinterpret_cast<char*>(&t), sizeof(t));
+    if(!in || !m_firstMoment.read(in) || !m_secondMoment.read(in))
+        return false;
+    m_t = t;
+    return true;
+}
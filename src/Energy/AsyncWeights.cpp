@@ -0,0 +1,76 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#include <algorithm>
+#include "Energy/AsyncWeights.h"
+
+AsyncWeights::AsyncWeights(Weights const& initial, size_t maxStaleness)
+        : m_maxStaleness(maxStaleness),
+          m_latest(initial.snapshot())
+{
+}
+
+WeightsSnapshot AsyncWeights::acquire(size_t& outVersion)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    outVersion = m_version;
+    m_running.insert(m_version);
+    return m_latest;
+}
+
+void AsyncWeights::finish(size_t version, size_t id)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_running.find(version);
+    if(iter != m_running.end())
+        m_running.erase(iter);
+    m_pending.emplace(version, id);
+}
+
+bool AsyncWeights::nextGroup(std::vector<size_t>& outIds)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    outIds.clear();
+    if(m_pending.empty())
+        return false;
+
+    // Without a bound, results are applied one by one in the order of their version
+    if(m_maxStaleness == 0)
+    {
+        outIds.push_back(m_pending.begin()->second);
+        m_pending.erase(m_pending.begin());
+        return true;
+    }
+
+    // The oldest pending results are applied together. Another update must not push any other job or result beyond
+    // the bound.
+    size_t const groupVersion = m_pending.begin()->first;
+    auto groupEnd = m_pending.upper_bound(groupVersion);
+    size_t oldestOther = m_version + 1;
+    if(!m_running.empty())
+        oldestOther = std::min(oldestOther, *m_running.begin());
+    if(groupEnd != m_pending.end())
+        oldestOther = std::min(oldestOther, groupEnd->first);
+    if(oldestOther <= m_version && m_version + 1 - oldestOther > m_maxStaleness)
+        return false;
+
+    for(auto iter = m_pending.begin(); iter != groupEnd; ++iter)
+        outIds.push_back(iter->second);
+    m_pending.erase(m_pending.begin(), groupEnd);
+    return true;
+}
+
+void AsyncWeights::publish(Weights const& weights)
+{
+    WeightsSnapshot snapshot = weights.snapshot();
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_latest = std::move(snapshot);
+    m_version++;
+}
+
+size_t AsyncWeights::version() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_version;
+}
@@ -0,0 +1,194 @@
+/**********************************************************
+ * @file   BCFWStepSizeRule.cpp
+ * @author jan
+ * @date   18.10.26
+ * ********************************************************
+ * @brief
+ * @details
+ **********************************************************/
+#include <fstream>
+#include <algorithm>
+#include <numeric>
+#include <cstring>
+#include "Energy/BCFWStepSizeRule.h"
+
+BCFWStepSizeRule::BCFWStepSizeRule(float C, size_t numSamples, size_t numClasses, size_t featDimPx,
+                                   size_t featDimCluster, size_t t) noexcept
+    : m_C(C),
+      m_numClasses(numClasses),
+      m_featDimPx(featDimPx),
+      m_featDimCluster(featDimCluster),
+      m_t(t),
+      m_w0(numClasses, featDimPx, featDimCluster),
+      m_v(zero()),
+      m_blocks(numSamples),
+      m_blockLoss(numSamples, 0.f),
+      m_blockGap(numSamples, 0.f)
+{
+    // Default constructed weights are the origin of the regularizer, see Weights::regularized()
+    m_w0 -= m_w0.regularized();
+}
+
+void BCFWStepSizeRule::update(Weights& /*w*/, Weights const& /*gradient*/)
+{
+    m_t++;
+}
+
+bool BCFWStepSizeRule::perSample() const
+{
+    return true;
+}
+
+void BCFWStepSizeRule::updateSample(Weights& w, size_t sample, Weights const& gradient, Cost loss)
+{
+    assert(sample < m_blocks.size());
+
+    float const n = m_blocks.size();
+    if(!m_blocks[sample])
+    {
+        m_blocks[sample] = std::make_unique<Weights>(zero());
+        m_numVisited++;
+    }
+    Weights& block = *m_blocks[sample];
+
+    // Frank-Wolfe corner of this block. The hinge loss is linear in w, thus its offset at w0 goes into the loss term.
+    Weights const corner = gradient * (-m_C / n);
+    Cost const cornerLoss = m_C / n * (loss + m_w0 * gradient);
+
+    // Exact line search
+    Weights diff = block;
+    diff -= corner;
+    Cost const gap = diff * m_v - m_blockLoss[sample] + cornerLoss;
+    Cost const sqNorm = diff.sqNorm();
+    float const gamma = sqNorm > 0 ? std::min(1.f, std::max(0.f, gap / sqNorm)) : 0.f;
+
+    diff *= gamma;
+    block -= diff;
+    m_v -= diff;
+    m_blockLoss[sample] = (1 - gamma) * m_blockLoss[sample] + gamma * cornerLoss;
+    m_blockGap[sample] = gap;
+
+    initialize(w);
+}
+
+bool BCFWStepSizeRule::write(std::string const& folder)
+{
+    std::ofstream out(folder + std::to_string(m_t) + "_bcfw.dat", std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!out.is_open())
+        return false;
+    return writeBlocks(out);
+}
+
+bool BCFWStepSizeRule::read(std::string const& folder, size_t t)
+{
+    std::ifstream in(folder + std::to_string(t) + "_bcfw.dat", std::ios::in | std::ios::binary);
+    if(!in.is_open())
+        return false;
+    if(!readBlocks(in))
+        return false;
+    m_t = t;
+    return true;
+}
+
+bool BCFWStepSizeRule::writeState(std::ostream& out) const
+{
+    uint64_t const t = m_t;
+    out.write(reinterpret_cast<char const*>(&t), sizeof(t));
+    return writeBlocks(out);
+}
+
+bool BCFWStepSizeRule::readState(std::istream& in)
+{
+    uint64_t t = 0;
+    in.read(reinterpret_cast<char*>(&t), sizeof(t));
+    if(!in || !readBlocks(in))
+        return false;
+    m_t = t;
+    return true;
+}
+
+bool BCFWStepSizeRule::writeBlocks(std::ostream& out) const
+{
+    // Blocks of unvisited samples are skipped, all others only store their non-zero weight vectors
+    out.write("BCFW0001", 8);
+    uint64_t const numBlocks = m_blocks.size();
+    out.write(reinterpret_cast<char const*>(&numBlocks), sizeof(numBlocks));
+    for(size_t i = 0; i < m_blocks.size(); ++i)
+    {
+        uint8_t const visited = m_blocks[i] ? 1 : 0;
+        out.write(reinterpret_cast<char const*>(&visited), sizeof(visited));
+        if(!visited)
+            continue;
+        out.write(reinterpret_cast<char const*>(&m_blockLoss[i]), sizeof(m_blockLoss[i]));
+        out.write(reinterpret_cast<char const*>(&m_blockGap[i]), sizeof(m_blockGap[i]));
+        m_blocks[i]->writeSparse(out);
+    }
+    return out.good();
+}
+
+bool BCFWStepSizeRule::readBlocks(std::istream& in)
+{
+    char id[8];
+    uint64_t numBlocks = 0;
+    in.read(id, 8);
+    in.read(reinterpret_cast<char*>(&numBlocks), sizeof(numBlocks));
+    if(!in || std::strncmp(id, "BCFW0001", 8) != 0 || numBlocks != m_blocks.size())
+        return false;
+
+    std::vector<std::unique_ptr<Weights>> blocks(numBlocks);
+    std::vector<Cost> blockLoss(numBlocks, 0.f);
+    std::vector<Cost> blockGap(numBlocks, 0.f);
+    for(size_t i = 0; i < numBlocks; ++i)
+    {
+        uint8_t visited = 0;
+        in.read(reinterpret_cast<char*>(&visited), sizeof(visited));
+        if(!in)
+            return false;
+        if(!visited)
+            continue;
+        in.read(reinterpret_cast<char*>(&blockLoss[i]), sizeof(blockLoss[i]));
+        in.read(reinterpret_cast<char*>(&blockGap[i]), sizeof(blockGap[i]));
+        blocks[i] = std::make_unique<Weights>(zero());
+        if(!blocks[i]->readSparse(in))
+            return false;
+    }
+
+    // The sum of all blocks is recomputed, so it is consistent with the blocks
+    m_blocks = std::move(blocks);
+    m_blockLoss = std::move(blockLoss);
+    m_blockGap = std::move(blockGap);
+    m_v = zero();
+    m_numVisited = 0;
+    for(auto const& pBlock : m_blocks)
+    {
+        if(pBlock)
+        {
+            m_v += *pBlock;
+            m_numVisited++;
+        }
+    }
+    return true;
+}
+
+void BCFWStepSizeRule::initialize(Weights& w) const
+{
+    w = m_w0;
+    w += m_v;
+}
+
+float BCFWStepSizeRule::dualityGap() const
+{
+    return std::accumulate(m_blockGap.begin(), m_blockGap.end(), 0.f);
+}
+
+bool BCFWStepSizeRule::allVisited() const
+{
+    return m_numVisited == m_blocks.size();
+}
+
+Weights BCFWStepSizeRule::zero() const
+{
+    Weights w(m_numClasses, m_featDimPx, m_featDimCluster);
+    w *= 0.f;
+    return w;
+}
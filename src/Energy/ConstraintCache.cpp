@@ -0,0 +1,61 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#include <vector>
+#include "Energy/ConstraintCache.h"
+
+ConstraintCache::ConstraintCache(size_t maxConstraints)
+        : m_maxConstraints(maxConstraints)
+{
+}
+
+size_t ConstraintCache::visit(std::string const& name)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_entries[name].visits++;
+}
+
+bool ConstraintCache::mostViolated(std::string const& name, Weights const& w, Weights& outGradient, Cost& outLoss,
+                                   Cost& outViolation) const
+{
+    // Only copy the pointers while locked, the dot products are computed without holding the lock
+    std::vector<std::shared_ptr<Constraint const>> constraints;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto iter = m_entries.find(name);
+        if(iter == m_entries.end() || iter->second.constraints.empty())
+            return false;
+        constraints.assign(iter->second.constraints.begin(), iter->second.constraints.end());
+    }
+
+    Constraint const* pBest = nullptr;
+    for(auto const& pConstraint : constraints)
+    {
+        Cost const violation = pConstraint->loss + pConstraint->gradient * w;
+        if(pBest == nullptr || violation > outViolation)
+        {
+            pBest = pConstraint.get();
+            outViolation = violation;
+        }
+    }
+
+    outGradient = w * 0.f;
+    pBest->gradient.addTo(outGradient);
+    outLoss = pBest->loss;
+    return true;
+}
+
+void ConstraintCache::add(std::string const& name, Weights const& gradient, Cost loss)
+{
+    if(m_maxConstraints == 0)
+        return;
+
+    auto pConstraint = std::make_shared<Constraint const>(Constraint{SparseWeights(gradient), loss});
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto& constraints = m_entries[name].constraints;
+    constraints.push_back(std::move(pConstraint));
+    while(constraints.size() > m_maxConstraints)
+        constraints.pop_front();
+}
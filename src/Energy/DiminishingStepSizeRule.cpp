@@ -7,6 +7,7 @@
  * @details
  **********************************************************/
 
+#include <iostream>
 #include "typedefs.h"
 #include "Energy/Weights.h"
 #include "Energy/DiminishingStepSizeRule.h"
@@ -34,3 +35,20 @@ bool DiminishingStepSizeRule::read(std::string const& /*folder*/, size_t /*t*/)
     return true;
 }
 
+
+bool DiminishingStepSizeRule::writeState(std::ostream& out) const
+{
+    uint64_t const t = m_t;
+    out.write(reinterpret_cast<char const*>(&t), sizeof(t));
+    return out.good();
+}
+
+bool DiminishingStepSizeRule::readState(std::istream& in)
+{
+    uint64_t t = 0;
+    in.read(reinterpret_cast<char*>(&t), sizeof(t));
+    if(!in)
+        return false;
+    m_t = t;
+    return true;
+}
@@ -2,10 +2,81 @@
 // Created by jan on 20.08.16.
 //
 
+#include <future>
+#include <unordered_map>
 #include "helper/coordinate_helper.h"
-#include "Timer.h"
+#include "helper/hash_helper.h"
+#include "Profiler.h"
+#include "Threading/Parallel.h"
 #include "Energy/EnergyFunction.h"
 
+namespace
+{
+    /**
+     * Recursively halves the site range [begin, end) until a block has at most EnergyFunction::s_reductionGrain
+     * sites, evaluates \p block on every such block and sums up the results along the same binary tree. The tree only
+     * depends on the range, therefore the result is the same for any amount of threads.
+     * If called from within a thread pool, the blocks become tasks of that pool instead of new threads, so this composes
+     * with parallelism across images without oversubscription.
+     * @param begin First site
+     * @param end One past the last site
+     * @param numThreads Amount of threads that may be used
+     * @param block Functor that computes the result for a block of sites
+     * @return Sum of all block results
+     */
+    template<typename BlockFun>
+    auto reduceSites(SiteId begin, SiteId end, unsigned int numThreads, BlockFun const& block) -> decltype(block(begin, end))
+    {
+        if(end - begin <= EnergyFunction::s_reductionGrain)
+            return block(begin, end);
+
+        if(numThreads > 1 && ThreadPool::current() != nullptr)
+            return parallelReduce(*ThreadPool::current(), begin, end, EnergyFunction::s_reductionGrain, block);
+
+        SiteId const mid = begin + (end - begin) / 2;
+        if(numThreads > 1)
+        {
+            auto right = std::async(std::launch::async, [&] { return reduceSites(mid, end, numThreads / 2, block); });
+            auto left = reduceSites(begin, mid, numThreads - numThreads / 2, block);
+            left += right.get();
+            return left;
+        }
+        auto left = reduceSites(begin, mid, 1, block);
+        left += reduceSites(mid, end, 1, block);
+        return left;
+    }
+
+    /**
+     * Splits the site range [begin, end) into blocks like reduceSites(), but doesn't combine any results
+     * @param begin First site
+     * @param end One past the last site
+     * @param numThreads Amount of threads that may be used
+     * @param block Functor that processes a block of sites
+     */
+    template<typename BlockFun>
+    void forEachSiteBlock(SiteId begin, SiteId end, unsigned int numThreads, BlockFun const& block)
+    {
+        if(numThreads <= 1 || end - begin <= EnergyFunction::s_reductionGrain)
+        {
+            block(begin, end);
+            return;
+        }
+
+        if(ThreadPool::current() != nullptr)
+        {
+            parallelFor(*ThreadPool::current(), begin, end, EnergyFunction::s_reductionGrain, block);
+            return;
+        }
+
+        SiteId const mid = begin + (end - begin) / 2;
+        auto right = std::async(std::launch::async, [&] { forEachSiteBlock(mid, end, numThreads / 2, block); });
+        forEachSiteBlock(begin, mid, numThreads - numThreads / 2, block);
+        right.get();
+    }
+}
+
+constexpr SiteId EnergyFunction::s_reductionGrain;
+
 EnergyFunction::EnergyFunction(Weights const* weights, ClusterId numClusters, bool usePairwise)
         : m_pWeights(weights),
           m_numClusters(numClusters),
@@ -19,23 +90,53 @@ Cost EnergyFunction::giveEnergy(FeatureImage const& pxFeat, FeatureImage const&
     return (*m_pWeights) * energy;
 }
 
-Weights EnergyFunction::giveEnergyByWeight(FeatureImage const& pxFeat, FeatureImage const& clusterFeat, LabelImage const& labeling, LabelImage const& clustering, std::vector<Cluster> const& clusters, LabelImage const* gt) const
+Weights EnergyFunction::giveEnergyByWeight(FeatureImage const& pxFeat, FeatureImage const& clusterFeat, LabelImage const& labeling, LabelImage const& clustering, std::vector<Cluster> const& clusters, LabelImage const* gt, unsigned int numThreads) const
 {
     PROFILE_THIS
 
-    Weights w(numClasses(), pxFeat.dim(), clusterFeat.dim()); // Zero-initialized weights
+    Weights zero(numClasses(), pxFeat.dim(), clusterFeat.dim());
+    zero.setZero();
 
-    computeUnaryEnergyByWeight(pxFeat, labeling, w, gt);
-    if(m_usePairwise)
-        computePairwiseEnergyByWeight(pxFeat, labeling, w, gt);
-    computeHigherOrderEnergyByWeight(clusterFeat, labeling, clustering, clusters, w, gt);
+    auto accumulateBlock = [&](SiteId begin, SiteId end)
+    {
+        Weights w = zero;
+        computeUnaryEnergyByWeight(begin, end, pxFeat, labeling, w, gt);
+        if(m_usePairwise)
+            computePairwiseEnergyByWeight(begin, end, pxFeat, labeling, w, gt);
+        computeHigherOrderEnergyByWeight(begin, end, clusterFeat, labeling, clustering, clusters, w, gt);
+        return w;
+    };
+
+    Weights w(numClasses(), pxFeat.dim(), clusterFeat.dim());
+    w += reduceSites(0, labeling.pixels(), std::max(numThreads, 1u), accumulateBlock);
 
     return w;
 }
 
 void EnergyFunction::computeUnaryEnergyByWeight(FeatureImage const& features, LabelImage const& labeling, Weights& energyW, LabelImage const* gt) const
 {
-    for (SiteId i = 0; i < labeling.pixels(); ++i)
+    computeUnaryEnergyByWeight(0, labeling.pixels(), features, labeling, energyW, gt);
+}
+
+void EnergyFunction::computePairwiseEnergyByWeight(FeatureImage const& features, LabelImage const& labeling, Weights& energyW, LabelImage const* gt) const
+{
+    computePairwiseEnergyByWeight(0, labeling.pixels(), features, labeling, energyW, gt);
+}
+
+void EnergyFunction::computeHigherOrderEnergyByWeight(FeatureImage const& features, LabelImage const& labeling,
+                                                      LabelImage const& clustering,
+                                                      std::vector<Cluster> const& clusters, Weights& energyW,
+                                                      LabelImage const* gt) const
+{
+    computeHigherOrderEnergyByWeight(0, labeling.pixels(), features, labeling, clustering, clusters, energyW, gt);
+}
+
+void EnergyFunction::computeUnaryEnergyByWeight(SiteId begin, SiteId end, FeatureImage const& features,
+                                                LabelImage const& labeling, Weights& energyW,
+                                                LabelImage const* gt) const
+{
+    Feature scratch;
+    for (SiteId i = begin; i < end; ++i)
     {
         // Skip invalid pixels
         if(gt && gt->atSite(i) >= numClasses())
@@ -44,78 +145,74 @@ void EnergyFunction::computeUnaryEnergyByWeight(FeatureImage const& features, La
         Label l = labeling.atSite(i);
         if(l < numClasses())
         {
-            Feature const& f = features.atSite(i);
-            Feature combinedFeat(f.size() + 1);
-            combinedFeat << f, 1.f;
-            energyW.m_unaryWeights[l] += combinedFeat;
+            Feature const& f = features.atSite(i, scratch);
+            WeightVec& w = energyW.m_unaryWeights[l];
+            w.head(f.size()) += f;
+            w(f.size()) += 1.f;
         }
     }
 }
 
-void EnergyFunction::computePairwiseEnergyByWeight(FeatureImage const& features, LabelImage const& labeling, Weights& energyW, LabelImage const* gt) const
+void EnergyFunction::computePairwiseEnergyByWeight(SiteId begin, SiteId end, FeatureImage const& features,
+                                                   LabelImage const& labeling, Weights& energyW,
+                                                   LabelImage const* gt) const
 {
-    for (Coord x = 0; x < labeling.width(); ++x)
+    auto addEdge = [&](Label l1, Label l2, Feature const& f1, Feature const& f2)
     {
-        for (Coord y = 0; y < labeling.height(); ++y)
-        {
-            // Skip invalid pixels
-            if(gt && gt->at(x, y) >= numClasses())
-                continue;
+        WeightVec& w = energyW.pairwise(l1, l2);
+        w.head(f1.size()) += f1;
+        w.segment(f1.size(), f2.size()) += f2;
+        w(f1.size() + f2.size()) += 1.f;
+    };
 
-            Label l = labeling.at(x, y);
-            if(l >= numClasses())
-                continue;
-            Feature const& f = features.at(x, y);
-            if(x + 1 < labeling.width())
-            {
-                // Skip invalid pixels
-                if(gt && gt->at(x + 1, y) >= numClasses())
-                    continue;
-
-                Label lR = labeling.at(x + 1, y);
-                if(lR >= numClasses())
-                    continue;
-                Feature const& fR = features.at(x + 1, y);
-
-                Feature combinedFeat(f.size() + fR.size() + 1);
-                combinedFeat << f, fR, 1.f;
-                energyW.pairwise(l, lR) += combinedFeat;
-            }
+    Feature scratch, scratchNeighbor;
+    for (SiteId i = begin; i < end; ++i)
+    {
+        // Skip invalid pixels
+        if(gt && gt->atSite(i) >= numClasses())
+            continue;
 
-            if(y + 1 < labeling.height())
-            {
-                // Skip invalid pixels
-                if(gt && gt->at(x, y + 1) >= numClasses())
-                    continue;
-
-                Label lD = labeling.at(x, y + 1);
-                if(lD >= numClasses())
-                    continue;
-                Feature const& fD = features.at(x, y + 1);
-
-                Feature combinedFeat(f.size() + fD.size() + 1);
-                combinedFeat << f, fD, 1.f;
-                energyW.pairwise(l, lD) += combinedFeat;
-            }
+        Label l = labeling.atSite(i);
+        if(l >= numClasses())
+            continue;
+        Feature const& f = features.atSite(i, scratch);
+        auto coords = helper::coord::siteTo2DCoordinate(i, labeling.width());
+
+        // Every site owns the edges to its right and lower neighbor
+        if(coords.x() + 1 < labeling.width())
+        {
+            SiteId const siteR = i + 1;
+            Label lR = labeling.atSite(siteR);
+            if((!gt || gt->atSite(siteR) < numClasses()) && lR < numClasses())
+                addEdge(l, lR, f, features.atSite(siteR, scratchNeighbor));
+        }
+
+        if(coords.y() + 1 < labeling.height())
+        {
+            SiteId const siteD = i + labeling.width();
+            Label lD = labeling.atSite(siteD);
+            if((!gt || gt->atSite(siteD) < numClasses()) && lD < numClasses())
+                addEdge(l, lD, f, features.atSite(siteD, scratchNeighbor));
         }
     }
 }
 
-void EnergyFunction::computeHigherOrderEnergyByWeight(FeatureImage const& features, LabelImage const& labeling,
-                                                      LabelImage const& clustering,
+void EnergyFunction::computeHigherOrderEnergyByWeight(SiteId begin, SiteId end, FeatureImage const& features,
+                                                      LabelImage const& labeling, LabelImage const& clustering,
                                                       std::vector<Cluster> const& clusters, Weights& energyW,
                                                       LabelImage const* gt) const
 {
     if(numClusters() == 0)
         return;
 
-    for(SiteId i = 0; i < labeling.pixels(); ++i)
+    Feature scratch;
+    for(SiteId i = begin; i < end; ++i)
     {
         // Skip invalid pixels
         if(gt && gt->atSite(i) >= numClasses())
             continue;
 
-        Feature const& f = features.atSite(i);
+        Feature const& f = features.atSite(i, scratch);
         Label const l = labeling.atSite(i);
         if(l >= numClasses())
             continue;
@@ -125,19 +222,19 @@ void EnergyFunction::computeHigherOrderEnergyByWeight(FeatureImage const& featur
         Label lClus = clusters[k].m_label;
 
         // Feature similarity
-        auto diff = f - fClus;
-        energyW.feature(l, lClus) += diff.cwiseProduct(diff);
+        energyW.feature(l, lClus) += (f - fClus).cwiseAbs2();
 
         // Label consistency
-        Feature combinedFeat(f.size() + fClus.size() + 1);
-        combinedFeat << f, fClus, 1.f;
-        energyW.higherOrder(l, lClus) += combinedFeat;
+        WeightVec& w = energyW.higherOrder(l, lClus);
+        w.head(f.size()) += f;
+        w.segment(f.size(), fClus.size()) += fClus;
+        w(f.size() + fClus.size()) += 1.f;
     }
 }
 
 void EnergyFunction::computeFeatureGradient(FeatureImage& outGradients, LabelImage const& labeling,
                                             LabelImage const& clustering, std::vector<Cluster> const& clusters,
-                                            FeatureImage const& features) const
+                                            FeatureImage const& features, unsigned int numThreads) const
 {
     assert(outGradients.width() == labeling.width());
     assert(outGradients.height() == labeling.height());
@@ -145,57 +242,153 @@ void EnergyFunction::computeFeatureGradient(FeatureImage& outGradients, LabelIma
     assert(labeling.width() == clustering.width());
     assert(labeling.height() == clustering.height());
 
-    unsigned int const featSize = outGradients.dim();
-
-    for (SiteId i = 0; i < labeling.pixels(); ++i)
+    auto computeBlock = [&](SiteId begin, SiteId end)
     {
-        Feature& grad = outGradients.atSite(i);
-        auto coords = helper::coord::siteTo2DCoordinate(i, labeling.width());
-        Label l = labeling.atSite(i);
-        if(l >= numClasses())
-        {
-            grad = Feature::Zero(featSize);
-            continue;
-        }
+        Feature scratch;
+        for (SiteId i = begin; i < end; ++i)
+            computeFeatureGradient(i, outGradients.atSite(i), labeling, clustering, clusters, features, scratch);
+    };
 
-        // unary
-        grad = m_pWeights->unary(l);
+    forEachSiteBlock(0, labeling.pixels(), numThreads, computeBlock);
+}
 
-        // pairwise
-        if(m_usePairwise)
+void EnergyFunction::computeFeatureGradient(Eigen::MatrixXf& outGradients, LabelImage const& labeling,
+                                            LabelImage const& clustering, std::vector<Cluster> const& clusters,
+                                            FeatureImage const& features, unsigned int numThreads) const
+{
+    assert(labeling.width() == clustering.width());
+    assert(labeling.height() == clustering.height());
+
+    unsigned int const featSize = m_pWeights->unary(0).size() - 1;
+    Label const noLabel = numClasses();
+    outGradients.resize(featSize, labeling.pixels());
+
+    // Labels of the site, its left, right, upper and lower neighbor, and its cluster
+    using Signature = std::tuple<Label, Label, Label, Label, Label, Label>;
+
+    auto validLabel = [&](Label l) { return l < numClasses() ? l : noLabel; };
+
+    auto computeBlock = [&](SiteId begin, SiteId end)
+    {
+        std::unordered_map<Signature, std::vector<SiteId>, helper::hash::hash<Signature>> groups;
+        for (SiteId i = begin; i < end; ++i)
         {
-            if(static_cast<int>(coords.x()) - 1 >= 0)
-            {
-                Label l2 = labeling.at(coords.x() - 1, coords.y());
-                if(l2 < numClasses())
-                    grad += m_pWeights->pairwise(l2, l).tail(featSize);
-            }
-            if(coords.x() + 1 < labeling.width())
+            Label const l = labeling.atSite(i);
+            if(l >= numClasses())
             {
-                Label l2 = labeling.at(coords.x() + 1, coords.y());
-                if(l2 < numClasses())
-                    grad += m_pWeights->pairwise(l, l2).head(featSize);
+                outGradients.col(i).setZero();
+                continue;
             }
-            if(static_cast<int>(coords.y()) - 1 >= 0)
+
+            auto coords = helper::coord::siteTo2DCoordinate(i, labeling.width());
+            Label lL = noLabel, lR = noLabel, lU = noLabel, lD = noLabel, lClus = noLabel;
+            if(m_usePairwise)
             {
-                Label l2 = labeling.at(coords.x(), coords.y() - 1);
-                if(l2 < numClasses())
-                    grad += m_pWeights->pairwise(l2, l).tail(featSize);
+                if(coords.x() > 0)
+                    lL = validLabel(labeling.atSite(i - 1));
+                if(coords.x() + 1 < labeling.width())
+                    lR = validLabel(labeling.atSite(i + 1));
+                if(coords.y() > 0)
+                    lU = validLabel(labeling.atSite(i - labeling.width()));
+                if(coords.y() + 1 < labeling.height())
+                    lD = validLabel(labeling.atSite(i + labeling.width()));
             }
-            if(coords.y() + 1 < labeling.height())
+            if(numClusters() > 0)
+                lClus = clusters[clustering.atSite(i)].m_label;
+
+            groups[Signature(l, lL, lR, lU, lD, lClus)].push_back(i);
+        }
+
+        Feature scratch;
+        for (auto const& g : groups)
+        {
+            Label l, lL, lR, lU, lD, lClus;
+            std::tie(l, lL, lR, lU, lD, lClus) = g.first;
+            std::vector<SiteId> const& sites = g.second;
+
+            // Label dependent part
+            Feature bias = m_pWeights->unary(l).head(featSize);
+            if(lL != noLabel)
+                bias += m_pWeights->pairwise(lL, l).segment(featSize, featSize);
+            if(lR != noLabel)
+                bias += m_pWeights->pairwise(l, lR).head(featSize);
+            if(lU != noLabel)
+                bias += m_pWeights->pairwise(lU, l).segment(featSize, featSize);
+            if(lD != noLabel)
+                bias += m_pWeights->pairwise(l, lD).head(featSize);
+            if(lClus == noLabel)
             {
-                Label l2 = labeling.at(coords.x(), coords.y() + 1);
-                if(l2 < numClasses())
-                    grad += m_pWeights->pairwise(l, l2).head(featSize);
+                for (SiteId i : sites)
+                    outGradients.col(i) = bias;
+                continue;
             }
+            bias += m_pWeights->higherOrder(l, lClus).head(featSize);
+
+            // Feature dependent part: gather, scale by the shared feature weights, scatter
+            Eigen::MatrixXf diff(featSize, sites.size());
+            for (size_t j = 0; j < sites.size(); ++j)
+                diff.col(j) = features.atSite(sites[j], scratch) - clusters[clustering.atSite(sites[j])].m_feature;
+            diff = (2.f * m_pWeights->feature(l, lClus)).asDiagonal() * diff;
+            diff.colwise() += bias;
+            for (size_t j = 0; j < sites.size(); ++j)
+                outGradients.col(sites[j]) = diff.col(j);
         }
+    };
+
+    forEachSiteBlock(0, labeling.pixels(), numThreads, computeBlock);
+}
+
+void EnergyFunction::computeFeatureGradient(SiteId i, Feature& grad, LabelImage const& labeling,
+                                            LabelImage const& clustering, std::vector<Cluster> const& clusters,
+                                            FeatureImage const& features, Feature& scratch) const
+{
+    unsigned int const featSize = grad.size();
+
+    auto coords = helper::coord::siteTo2DCoordinate(i, labeling.width());
+    Label l = labeling.atSite(i);
+    if(l >= numClasses())
+    {
+        grad = Feature::Zero(featSize);
+        return;
+    }
 
-        // higher-order
-        if(numClusters() > 0)
+    // unary
+    grad = m_pWeights->unary(l).head(featSize);
+
+    // pairwise
+    if(m_usePairwise)
+    {
+        if(static_cast<int>(coords.x()) - 1 >= 0)
+        {
+            Label l2 = labeling.at(coords.x() - 1, coords.y());
+            if(l2 < numClasses())
+                grad += m_pWeights->pairwise(l2, l).segment(featSize, featSize);
+        }
+        if(coords.x() + 1 < labeling.width())
         {
-            Label l_clus = clusters[clustering.atSite(i)].m_label;
-            grad += 2.f * m_pWeights->feature(l, l_clus) * (features.atSite(i) - clusters[clustering.atSite(i)].m_feature);
-            grad += m_pWeights->higherOrder(l, l_clus).segment(0, featSize);
+            Label l2 = labeling.at(coords.x() + 1, coords.y());
+            if(l2 < numClasses())
+                grad += m_pWeights->pairwise(l, l2).head(featSize);
         }
+        if(static_cast<int>(coords.y()) - 1 >= 0)
+        {
+            Label l2 = labeling.at(coords.x(), coords.y() - 1);
+            if(l2 < numClasses())
+                grad += m_pWeights->pairwise(l2, l).segment(featSize, featSize);
+        }
+        if(coords.y() + 1 < labeling.height())
+        {
+            Label l2 = labeling.at(coords.x(), coords.y() + 1);
+            if(l2 < numClasses())
+                grad += m_pWeights->pairwise(l, l2).head(featSize);
+        }
+    }
+
+    // higher-order
+    if(numClusters() > 0)
+    {
+        Cluster const& c = clusters[clustering.atSite(i)];
+        grad += 2.f * m_pWeights->feature(l, c.m_label).cwiseProduct(features.atSite(i, scratch) - c.m_feature);
+        grad += m_pWeights->higherOrder(l, c.m_label).head(featSize);
     }
 }
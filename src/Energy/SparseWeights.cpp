@@ -0,0 +1,37 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#include "Energy/SparseWeights.h"
+
+SparseWeights::SparseWeights(Weights const& dense)
+{
+    for(size_t i = 0; i < dense.numVectors(); ++i)
+    {
+        WeightVec const& e = dense.vector(i);
+        if(!e.isZero(0))
+            m_vectors.emplace_back(i, e);
+    }
+}
+
+Weight SparseWeights::operator*(Weights const& dense) const
+{
+    Weight result = 0;
+    for(auto const& e : m_vectors)
+        result += e.second.dot(dense.vector(e.first));
+    return result;
+}
+
+void SparseWeights::addTo(Weights& dense, float factor) const
+{
+    for(auto const& e : m_vectors)
+        dense.vector(e.first) += factor * e.second;
+}
+
+size_t SparseWeights::bytes() const
+{
+    size_t bytes = sizeof(*this);
+    for(auto const& e : m_vectors)
+        bytes += sizeof(e) + e.second.size() * sizeof(Weight);
+    return bytes;
+}
@@ -0,0 +1,166 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <cstring>
+#include <cstdio>
+#include <fcntl.h>
+#include <unistd.h>
+#include "Energy/TrainingCheckpoint.h"
+
+namespace
+{
+    char const s_magic[] = "HSEGCK01";
+
+    void appendSection(std::ostream& out, std::string const& section)
+    {
+        uint64_t const size = section.size();
+        out.write(reinterpret_cast<char const*>(&size), sizeof(size));
+        out.write(section.data(), section.size());
+    }
+
+    bool readSection(std::istream& in, std::string& outSection)
+    {
+        uint64_t size = 0;
+        in.read(reinterpret_cast<char*>(&size), sizeof(size));
+        if(!in)
+            return false;
+
+        // A corrupt size must not lead to a huge allocation
+        std::streampos const pos = in.tellg();
+        in.seekg(0, std::ios::end);
+        std::streampos const end = in.tellg();
+        in.seekg(pos);
+        if(!in || pos < 0 || end < pos || size > static_cast<uint64_t>(end - pos))
+            return false;
+
+        outSection.resize(size);
+        in.read(&outSection[0], size);
+        return static_cast<bool>(in);
+    }
+
+    /**
+     * @return True if the stream has been read without errors and there is no data left
+     */
+    bool consumed(std::istream& in)
+    {
+        return in && in.peek() == std::char_traits<char>::eof();
+    }
+}
+
+std::string TrainingCheckpoint::filename(std::string const& folder, size_t t)
+{
+    return folder + std::to_string(t) + "_checkpoint.dat";
+}
+
+std::string TrainingCheckpoint::serialize(Weights const& weights, IStepSizeRule const& rule,
+                                          TrainingCursor const& cursor)
+{
+    std::ostringstream weightsOut(std::ios::out | std::ios::binary);
+    weights.write(weightsOut);
+
+    std::ostringstream ruleOut(std::ios::out | std::ios::binary);
+    rule.writeState(ruleOut);
+
+    std::ostringstream cursorOut(std::ios::out | std::ios::binary);
+    uint64_t const numSamples = cursor.order.size();
+    uint64_t const rngSize = cursor.rngState.size();
+    cursorOut.write(reinterpret_cast<char const*>(&cursor.pos), sizeof(cursor.pos));
+    cursorOut.write(reinterpret_cast<char const*>(&numSamples), sizeof(numSamples));
+    cursorOut.write(reinterpret_cast<char const*>(cursor.order.data()), numSamples * sizeof(uint32_t));
+    cursorOut.write(reinterpret_cast<char const*>(&rngSize), sizeof(rngSize));
+    cursorOut.write(cursor.rngState.data(), rngSize);
+
+    std::ostringstream out(std::ios::out | std::ios::binary);
+    out.write(s_magic, 8);
+    appendSection(out, weightsOut.str());
+    appendSection(out, ruleOut.str());
+    appendSection(out, cursorOut.str());
+    return out.str();
+}
+
+bool TrainingCheckpoint::read(std::string const& filename, Weights& outWeights, IStepSizeRule& outRule,
+                              TrainingCursor& outCursor)
+{
+    std::ifstream in(filename, std::ios::in | std::ios::binary);
+    if(!in.is_open())
+        return false;
+
+    char id[8];
+    in.read(id, 8);
+    std::string weightsSection, ruleSection, cursorSection;
+    if(!in || std::strncmp(id, s_magic, 8) != 0 || !readSection(in, weightsSection) || !readSection(in, ruleSection)
+       || !readSection(in, cursorSection))
+        return false;
+
+    // Read into a copy first, so the weights are only changed if they fit
+    Weights weights = outWeights;
+    std::istringstream weightsIn(weightsSection, std::ios::in | std::ios::binary);
+    if(!weights.read(weightsIn) || !consumed(weightsIn) || weights.numClasses() != outWeights.numClasses()
+       || weights.featDimPx() != outWeights.featDimPx() || weights.featDimCluster() != outWeights.featDimCluster())
+        return false;
+
+    TrainingCursor cursor;
+    uint64_t numSamples = 0, rngSize = 0;
+    std::istringstream cursorIn(cursorSection, std::ios::in | std::ios::binary);
+    cursorIn.read(reinterpret_cast<char*>(&cursor.pos), sizeof(cursor.pos));
+    cursorIn.read(reinterpret_cast<char*>(&numSamples), sizeof(numSamples));
+    if(!cursorIn || numSamples * sizeof(uint32_t) > cursorSection.size())
+        return false;
+    cursor.order.resize(numSamples);
+    cursorIn.read(reinterpret_cast<char*>(cursor.order.data()), numSamples * sizeof(uint32_t));
+    cursorIn.read(reinterpret_cast<char*>(&rngSize), sizeof(rngSize));
+    if(!cursorIn || rngSize > cursorSection.size())
+        return false;
+    cursor.rngState.resize(rngSize);
+    cursorIn.read(&cursor.rngState[0], rngSize);
+    if(!consumed(cursorIn))
+        return false;
+
+    std::istringstream ruleIn(ruleSection, std::ios::in | std::ios::binary);
+    if(!outRule.readState(ruleIn) || !consumed(ruleIn))
+        return false;
+
+    outWeights = std::move(weights);
+    outCursor = std::move(cursor);
+    return true;
+}
+
+bool TrainingCheckpoint::writeAtomic(std::string const& filename, std::string const& bytes)
+{
+    std::string const tmpFile = filename + ".tmp";
+    int fd = ::open(tmpFile.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if(fd < 0)
+        return false;
+
+    size_t written = 0;
+    while(written < bytes.size())
+    {
+        ssize_t const result = ::write(fd, bytes.data() + written, bytes.size() - written);
+        if(result < 0)
+            break;
+        written += result;
+    }
+
+    // The data has to be on disk before the rename, otherwise a crash could leave an empty file behind
+    bool const success = written == bytes.size() && ::fsync(fd) == 0;
+    ::close(fd);
+    if(!success || std::rename(tmpFile.c_str(), filename.c_str()) != 0)
+    {
+        std::remove(tmpFile.c_str());
+        return false;
+    }
+
+    // The rename is only durable once the directory has been synced as well
+    size_t const slash = filename.find_last_of('/');
+    std::string const dir = slash == std::string::npos ? "." : filename.substr(0, std::max<size_t>(slash, 1));
+    int const dirFd = ::open(dir.c_str(), O_RDONLY | O_DIRECTORY);
+    if(dirFd < 0)
+        return false;
+    bool const synced = ::fsync(dirFd) == 0;
+    ::close(dirFd);
+    return synced;
+}
@@ -140,6 +140,18 @@ Weights Weights::operator/(Weights const& other) const
     return result;
 }
 
+void Weights::setZero()
+{
+    for (size_t i = 0; i < m_unaryWeights.size(); ++i)
+        m_unaryWeights[i].setZero();
+    for (size_t i = 0; i < m_pairwiseWeights.size(); ++i)
+        m_pairwiseWeights[i].setZero();
+    for (size_t i = 0; i < m_higherOrderWeights.size(); ++i)
+        m_higherOrderWeights[i].setZero();
+    for (size_t i = 0; i < m_featureWeights.size(); ++i)
+        m_featureWeights[i].setZero();
+}
+
 void Weights::squareElements()
 {
     for (size_t i = 0; i < m_unaryWeights.size(); ++i)
@@ -262,90 +274,162 @@ bool Weights::write(std::string const& filename) const
     std::ofstream out(filename, std::ios::out | std::ios::binary | std::ios::trunc);
     if(out.is_open())
     {
-        out.write("WEIGHT04", 8);
-        uint32_t featDimPx = m_unaryWeights[0].size() - 1;
-        uint32_t featDimCluster = m_featureWeights[0].size();
-        uint32_t noUnaries = m_unaryWeights.size();
-        uint32_t noPairwise = m_pairwiseWeights.size();
-        uint32_t noHigherOrder = m_higherOrderWeights.size();
-        uint32_t noFeature = m_featureWeights.size();
-        out.write(reinterpret_cast<const char*>(&featDimPx), sizeof(featDimPx));
-        out.write(reinterpret_cast<const char*>(&featDimCluster), sizeof(featDimCluster));
-        out.write(reinterpret_cast<const char*>(&noUnaries), sizeof(noUnaries));
-        out.write(reinterpret_cast<const char*>(&noPairwise), sizeof(noPairwise));
-        out.write(reinterpret_cast<const char*>(&noHigherOrder), sizeof(noHigherOrder));
-        out.write(reinterpret_cast<const char*>(&noFeature), sizeof(noFeature));
-        for(auto const& e : m_unaryWeights)
-        {
-            assert(e.size() == featDimPx + 1);
-            out.write(reinterpret_cast<const char*>(e.data()), sizeof(e(0)) * e.size());
-        }
-        for(auto const& e : m_pairwiseWeights)
-        {
-            assert(e.size() == featDimPx * 2 + 1);
-            out.write(reinterpret_cast<const char*>(e.data()), sizeof(e(0)) * e.size());
-        }
-        for(auto const& e : m_higherOrderWeights)
-        {
-            assert(e.size() == featDimCluster * 2 + 1);
-            out.write(reinterpret_cast<const char*>(e.data()), sizeof(e(0)) * e.size());
-        }
-        for(auto const& e : m_featureWeights)
-        {
-            assert(e.size() == featDimCluster);
-            out.write(reinterpret_cast<const char*>(e.data()), sizeof(e(0)) * e.size());
-        }
+        bool const success = write(out);
         out.close();
-        return true;
+        return success;
     }
     return false;
 }
 
+bool Weights::write(std::ostream& out) const
+{
+    out.write("WEIGHT04", 8);
+    uint32_t featDimPx = m_unaryWeights[0].size() - 1;
+    uint32_t featDimCluster = m_featureWeights[0].size();
+    uint32_t noUnaries = m_unaryWeights.size();
+    uint32_t noPairwise = m_pairwiseWeights.size();
+    uint32_t noHigherOrder = m_higherOrderWeights.size();
+    uint32_t noFeature = m_featureWeights.size();
+    out.write(reinterpret_cast<const char*>(&featDimPx), sizeof(featDimPx));
+    out.write(reinterpret_cast<const char*>(&featDimCluster), sizeof(featDimCluster));
+    out.write(reinterpret_cast<const char*>(&noUnaries), sizeof(noUnaries));
+    out.write(reinterpret_cast<const char*>(&noPairwise), sizeof(noPairwise));
+    out.write(reinterpret_cast<const char*>(&noHigherOrder), sizeof(noHigherOrder));
+    out.write(reinterpret_cast<const char*>(&noFeature), sizeof(noFeature));
+    for(auto const& e : m_unaryWeights)
+    {
+        assert(e.size() == featDimPx + 1);
+        out.write(reinterpret_cast<const char*>(e.data()), sizeof(e(0)) * e.size());
+    }
+    for(auto const& e : m_pairwiseWeights)
+    {
+        assert(e.size() == featDimPx * 2 + 1);
+        out.write(reinterpret_cast<const char*>(e.data()), sizeof(e(0)) * e.size());
+    }
+    for(auto const& e : m_higherOrderWeights)
+    {
+        assert(e.size() == featDimCluster * 2 + 1);
+        out.write(reinterpret_cast<const char*>(e.data()), sizeof(e(0)) * e.size());
+    }
+    for(auto const& e : m_featureWeights)
+    {
+        assert(e.size() == featDimCluster);
+        out.write(reinterpret_cast<const char*>(e.data()), sizeof(e(0)) * e.size());
+    }
+    return out.good();
+}
+
 bool Weights::read(std::string const& filename)
 {
     std::ifstream in(filename, std::ios::in | std::ios::binary);
     if(in.is_open())
     {
-        try
-        {
-            char id[8];
-            in.read(id, 8);
-            if(std::strncmp(id, "WEIGHT04", 8) != 0)
-            {
-                in.close();
-                return false;
-            }
-            uint32_t featDimPx, featDimCluster, noUnaries, noPairwise, noHigherOrder, noFeature;
-            in.read(reinterpret_cast<char*>(&featDimPx), sizeof(featDimPx));
-            in.read(reinterpret_cast<char*>(&featDimCluster), sizeof(featDimCluster));
-            in.read(reinterpret_cast<char*>(&noUnaries), sizeof(noUnaries));
-            in.read(reinterpret_cast<char*>(&noPairwise), sizeof(noPairwise));
-            in.read(reinterpret_cast<char*>(&noHigherOrder), sizeof(noHigherOrder));
-            in.read(reinterpret_cast<char*>(&noFeature), sizeof(noFeature));
-            m_unaryWeights.resize(noUnaries, WeightVec::Zero(featDimPx + 1));
-            m_pairwiseWeights.resize(noPairwise, WeightVec::Zero(featDimPx * 2 + 1));
-            m_higherOrderWeights.resize(noHigherOrder, WeightVec::Zero(featDimCluster * 2 + 1));
-            m_featureWeights.resize(noFeature, WeightVec::Zero(featDimCluster));
-            for(auto& e : m_unaryWeights)
-                in.read(reinterpret_cast<char*>(e.data()), sizeof(e(0)) * (featDimPx + 1));
-            for(auto& e : m_pairwiseWeights)
-                in.read(reinterpret_cast<char*>(e.data()), sizeof(e(0)) * (featDimPx * 2 + 1));
-            for(auto& e : m_higherOrderWeights)
-                in.read(reinterpret_cast<char*>(e.data()), sizeof(e(0)) * (featDimCluster * 2 + 1));
-            for(auto& e : m_featureWeights)
-                in.read(reinterpret_cast<char*>(e.data()), sizeof(e(0)) * (featDimCluster));
-            in.close();
-
-            return true;
-        }
-        catch (...)
-        {
-            return false;
-        }
+        bool const success = read(in);
+        in.close();
+        return success;
     }
     return false;
 }
 
+bool Weights::read(std::istream& in)
+{
+    try
+    {
+        char id[8];
+        in.read(id, 8);
+        if(!in || std::strncmp(id, "WEIGHT04", 8) != 0)
+            return false;
+        uint32_t featDimPx, featDimCluster, noUnaries, noPairwise, noHigherOrder, noFeature;
+        in.read(reinterpret_cast<char*>(&featDimPx), sizeof(featDimPx));
+        in.read(reinterpret_cast<char*>(&featDimCluster), sizeof(featDimCluster));
+        in.read(reinterpret_cast<char*>(&noUnaries), sizeof(noUnaries));
+        in.read(reinterpret_cast<char*>(&noPairwise), sizeof(noPairwise));
+        in.read(reinterpret_cast<char*>(&noHigherOrder), sizeof(noHigherOrder));
+        in.read(reinterpret_cast<char*>(&noFeature), sizeof(noFeature));
+        m_unaryWeights.resize(noUnaries, WeightVec::Zero(featDimPx + 1));
+        m_pairwiseWeights.resize(noPairwise, WeightVec::Zero(featDimPx * 2 + 1));
+        m_higherOrderWeights.resize(noHigherOrder, WeightVec::Zero(featDimCluster * 2 + 1));
+        m_featureWeights.resize(noFeature, WeightVec::Zero(featDimCluster));
+        for(auto& e : m_unaryWeights)
+            in.read(reinterpret_cast<char*>(e.data()), sizeof(e(0)) * (featDimPx + 1));
+        for(auto& e : m_pairwiseWeights)
+            in.read(reinterpret_cast<char*>(e.data()), sizeof(e(0)) * (featDimPx * 2 + 1));
+        for(auto& e : m_higherOrderWeights)
+            in.read(reinterpret_cast<char*>(e.data()), sizeof(e(0)) * (featDimCluster * 2 + 1));
+        for(auto& e : m_featureWeights)
+            in.read(reinterpret_cast<char*>(e.data()), sizeof(e(0)) * (featDimCluster));
+
+        return static_cast<bool>(in);
+    }
+    catch (...)
+    {
+        return false;
+    }
+}
+
+size_t Weights::numVectors() const
+{
+    return m_unaryWeights.size() + m_pairwiseWeights.size() + m_higherOrderWeights.size() + m_featureWeights.size();
+}
+
+WeightVec const& Weights::vector(size_t i) const
+{
+    assert(i < numVectors());
+
+    if(i < m_unaryWeights.size())
+        return m_unaryWeights[i];
+    i -= m_unaryWeights.size();
+    if(i < m_pairwiseWeights.size())
+        return m_pairwiseWeights[i];
+    i -= m_pairwiseWeights.size();
+    if(i < m_higherOrderWeights.size())
+        return m_higherOrderWeights[i];
+    i -= m_higherOrderWeights.size();
+    return m_featureWeights[i];
+}
+
+WeightVec& Weights::vector(size_t i)
+{
+    return const_cast<WeightVec&>(static_cast<Weights const*>(this)->vector(i));
+}
+
+bool Weights::writeSparse(std::ostream& out) const
+{
+    uint32_t numNonZero = 0;
+    for(size_t i = 0; i < numVectors(); ++i)
+        if(!vector(i).isZero(0))
+            numNonZero++;
+
+    out.write(reinterpret_cast<const char*>(&numNonZero), sizeof(numNonZero));
+    for(uint32_t i = 0; i < numVectors(); ++i)
+    {
+        WeightVec const& e = vector(i);
+        if(e.isZero(0))
+            continue;
+        out.write(reinterpret_cast<const char*>(&i), sizeof(i));
+        out.write(reinterpret_cast<const char*>(e.data()), sizeof(e(0)) * e.size());
+    }
+    return out.good();
+}
+
+bool Weights::readSparse(std::istream& in)
+{
+    for(size_t i = 0; i < numVectors(); ++i)
+        vector(i).setZero();
+
+    uint32_t numNonZero = 0;
+    in.read(reinterpret_cast<char*>(&numNonZero), sizeof(numNonZero));
+    for(uint32_t n = 0; n < numNonZero && in; ++n)
+    {
+        uint32_t i = 0;
+        in.read(reinterpret_cast<char*>(&i), sizeof(i));
+        if(i >= numVectors())
+            return false;
+        in.read(reinterpret_cast<char*>(vector(i).data()), sizeof(Weight) * vector(i).size());
+    }
+    return static_cast<bool>(in);
+}
+
 std::tuple<float, float, float, float, float> Weights::means() const
 {
     float meanUnary = 0, meanPairwise = 0, meanLabelCons = 0, meanFeature = 0, meanTotal = 0;
@@ -555,3 +639,8 @@ bool Weights::isFeatureSymmetric() const
     }
     return true;
 }
+
+std::shared_ptr<Weights const> Weights::snapshot() const
+{
+    return std::make_shared<Weights const>(*this);
+}
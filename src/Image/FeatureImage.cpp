@@ -3,9 +3,186 @@
 //
 
 #include <iostream>
+#include <fstream>
+#include <cstring>
+#include <stdexcept>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
 #include <helper/opencv_helper.h>
 #include "Image/FeatureImage.h"
 #include "matio.h"
+#if defined(__F16C__) || defined(__AVX2__)
+#include <immintrin.h>
+#endif
+
+namespace
+{
+    /**
+     * Widens half precision features to single precision
+     */
+    inline void widen(Eigen::half const* in, float* out, size_t n)
+    {
+        size_t c = 0;
+#if defined(__F16C__)
+        for(; c + 8 <= n; c += 8)
+            _mm256_storeu_ps(out + c, _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<__m128i const*>(in + c))));
+#endif
+        for(; c < n; ++c)
+            out[c] = static_cast<float>(in[c]);
+    }
+
+    /**
+     * Widens bfloat16 features to single precision. A bfloat16 is the upper half of a float, thus this is a shift.
+     */
+    inline void widen(Eigen::bfloat16 const* in, float* out, size_t n)
+    {
+        size_t c = 0;
+#if defined(__AVX2__)
+        for(; c + 8 <= n; c += 8)
+        {
+            __m256i const wide = _mm256_cvtepu16_epi32(_mm_loadu_si128(reinterpret_cast<__m128i const*>(in + c)));
+            _mm256_storeu_ps(out + c, _mm256_castsi256_ps(_mm256_slli_epi32(wide, 16)));
+        }
+#endif
+        for(; c < n; ++c)
+            out[c] = static_cast<float>(in[c]);
+    }
+
+    /**
+     * Copies a column-major MATLAB feature map into reduced precision storage with one column per site
+     */
+    template<typename Storage>
+    void packMatData(float const* data, Storage& out, Coord width, Coord height, Coord dim)
+    {
+        using Scalar = typename Storage::Scalar;
+        out.resize(dim, width * height);
+        for(size_t y = 0; y < height; ++y)
+            for(size_t x = 0; x < width; ++x)
+                for(size_t c = 0; c < dim; ++c)
+                    out(c, x + y * width) = Scalar(data[y + x * height + c * height * width]);
+    }
+
+    /**
+     * Reads the header of the feature map variable. The data itself isn't read.
+     */
+    matvar_t* readFeatureInfo(mat_t* matfp)
+    {
+        matvar_t* matvar = Mat_VarReadInfo(matfp, "features");
+        if(matvar == nullptr)
+            matvar = Mat_VarReadInfo(matfp, "data");
+        return matvar;
+    }
+
+    template<typename Storage>
+    void packFeatures(std::vector<Feature> const& features, Storage& out, Coord dim)
+    {
+        using Scalar = typename Storage::Scalar;
+        out.resize(dim, features.size());
+        for(size_t i = 0; i < features.size(); ++i)
+            out.col(i) = features[i].cast<Scalar>();
+    }
+
+    template<typename Storage>
+    void unpackFeatures(Storage const& packed, std::vector<Feature>& out)
+    {
+        out.clear();
+        out.reserve(packed.cols());
+        for(typename Storage::Index i = 0; i < packed.cols(); ++i)
+            out.push_back(packed.col(i).template cast<float>());
+    }
+
+    /**
+     * Crops packed features. \p packed may be a view on \p out.
+     */
+    template<typename View, typename Storage>
+    void cropColumns(View const& packed, Storage& out, Coord width, Coord x, Coord y, Coord w, Coord h)
+    {
+        Storage cropped(packed.rows(), w * h);
+        for(Coord d_y = 0; d_y < h; ++d_y)
+            for(Coord d_x = 0; d_x < w; ++d_x)
+                cropped.col(d_x + d_y * w) = packed.col(x + d_x + (y + d_y) * width);
+        out.swap(cropped);
+    }
+
+    /**
+     * Header of the binary feature format
+     */
+    struct BinaryHeader
+    {
+        uint32_t width;
+        uint32_t height;
+        uint32_t dim;
+        uint32_t precision;
+    };
+
+    /**
+     * Reads the header of the binary feature format and checks whether the buffer holds all of the features
+     * @param data Buffer to read from
+     * @param size Size of the buffer in bytes
+     * @param outHeader The header
+     * @param outFeatureSize Size of the features following the header in bytes
+     * @return True if the header is valid, otherwise false
+     */
+    bool readBinaryHeader(char const* data, size_t size, BinaryHeader& outHeader, size_t& outFeatureSize)
+    {
+        if(size < sizeof(outHeader))
+            return false;
+        std::memcpy(&outHeader, data, sizeof(outHeader));
+        if(outHeader.precision > static_cast<uint32_t>(FeatureImage::Precision::BFloat16))
+            return false;
+
+        // The dimensions come from the file, their product must not overflow
+        outFeatureSize = outHeader.precision == static_cast<uint32_t>(FeatureImage::Precision::Single)
+                         ? sizeof(float) : sizeof(uint16_t);
+        for(uint32_t factor : {outHeader.width, outHeader.height, outHeader.dim})
+        {
+            if(factor != 0 && outFeatureSize > std::numeric_limits<size_t>::max() / factor)
+                return false;
+            outFeatureSize *= factor;
+        }
+        return size - sizeof(outHeader) >= outFeatureSize;
+    }
+
+    /**
+     * Identifies native feature files. The version has to be changed whenever the layout changes.
+     */
+    char const s_nativeMagic[8] = {'H', 'S', 'E', 'G', 'F', 'E', 'A', 'T'};
+    uint32_t const s_nativeVersion = 1;
+
+    /**
+     * Layout of a native feature file:
+     *  - Native header
+     *  - Binary header and features as written by FeatureImage::writeBinary()
+     * The headers add up to 32 bytes, thus the features are aligned within a page aligned mapping of the file.
+     */
+    struct NativeHeader
+    {
+        char magic[8];
+        uint32_t version;
+        uint32_t reserved;
+    };
+
+    /**
+     * Reads the native header of a file, if it is long enough
+     */
+    bool readNativeHeader(std::string const& filename, NativeHeader& outHeader)
+    {
+        std::ifstream in(filename, std::ios::in | std::ios::binary);
+        return in.read(reinterpret_cast<char*>(&outHeader), sizeof(outHeader)) &&
+               std::memcmp(outHeader.magic, s_nativeMagic, sizeof(s_nativeMagic)) == 0;
+    }
+
+    template<typename Storage>
+    void packMat(cv::Mat const& mat, Storage& out, Coord dim)
+    {
+        using Scalar = typename Storage::Scalar;
+        out.resize(dim, mat.cols * mat.rows);
+        for(int i = 0; i < mat.cols * mat.rows; ++i)
+            out.col(i) = Eigen::Map<Feature const>(((float const*)mat.data) + i * dim, dim).cast<Scalar>();
+    }
+}
 
 FeatureImage::FeatureImage(Coord width, Coord height, Coord dim)
     : m_width(width),
@@ -15,13 +192,16 @@ FeatureImage::FeatureImage(Coord width, Coord height, Coord dim)
     m_features.resize(width * height, Feature::Zero(dim));
 }
 
-FeatureImage::FeatureImage(std::string const& filename)
+FeatureImage::FeatureImage(std::string const& filename, Precision precision)
 {
-    read(filename);
+    read(filename, precision);
 }
 
-bool FeatureImage::read(std::string const& filename)
+bool FeatureImage::read(std::string const& filename, Precision precision)
 {
+    if(isNative(filename))
+        return readNative(filename, precision);
+
     mat_t* matfp = Mat_Open(filename.c_str(), MAT_ACC_RDONLY);
     if (matfp == nullptr)
     {
@@ -29,9 +209,7 @@ bool FeatureImage::read(std::string const& filename)
         return false;
     }
 
-    matvar_t *matvar = Mat_VarReadInfo(matfp,"features");
-    if ( matvar == nullptr )
-        matvar = Mat_VarReadInfo(matfp,"data");
+    matvar_t *matvar = readFeatureInfo(matfp);
     if ( matvar == nullptr )
     {
         std::cerr << "Error finding feature map in file \"" << filename << "\"." << std::endl;
@@ -55,20 +233,38 @@ bool FeatureImage::read(std::string const& filename)
             return false;
         }
 
-        m_features.reserve(m_width * m_height);
+        m_precision = precision;
+        m_features.clear();
+        m_halfFeatures.resize(0, 0);
+        m_bfloat16Features.resize(0, 0);
+        unmap();
 
-        for(size_t y = 0; y < m_height; ++y)
+        // Reduced precision features are converted right away, so the full map never has to exist twice
+        switch(m_precision)
         {
-            for(size_t x = 0; x < m_width; ++x)
-            {
-                Feature f = Feature::Zero(m_dim);
-                for(size_t c = 0; c < m_dim; ++c)
+            case Precision::Half:
+                packMatData((float const*)matvar->data, m_halfFeatures, m_width, m_height, m_dim);
+                break;
+            case Precision::BFloat16:
+                packMatData((float const*)matvar->data, m_bfloat16Features, m_width, m_height, m_dim);
+                break;
+            case Precision::Single:
+                m_features.reserve(m_width * m_height);
+
+                for(size_t y = 0; y < m_height; ++y)
                 {
-                    float data = ((float*)matvar->data)[y + x * m_height + c * m_height* m_width];
-                    f(c) = data;
+                    for(size_t x = 0; x < m_width; ++x)
+                    {
+                        Feature f = Feature::Zero(m_dim);
+                        for(size_t c = 0; c < m_dim; ++c)
+                        {
+                            float data = ((float*)matvar->data)[y + x * m_height + c * m_height* m_width];
+                            f(c) = data;
+                        }
+                        m_features.push_back(f);
+                    }
                 }
-                m_features.push_back(f);
-            }
+                break;
         }
 
         Mat_VarFree(matvar);
@@ -78,6 +274,41 @@ bool FeatureImage::read(std::string const& filename)
     return true;
 }
 
+bool FeatureImage::readDimensions(std::string const& filename, Coord& outWidth, Coord& outHeight, Coord& outDim)
+{
+    NativeHeader nativeHeader;
+    if(readNativeHeader(filename, nativeHeader))
+    {
+        std::ifstream in(filename, std::ios::in | std::ios::binary);
+        BinaryHeader header;
+        if(nativeHeader.version != s_nativeVersion || !in.seekg(sizeof(NativeHeader)) ||
+           !in.read(reinterpret_cast<char*>(&header), sizeof(header)))
+            return false;
+        outWidth = header.width;
+        outHeight = header.height;
+        outDim = header.dim;
+        return true;
+    }
+
+    mat_t* matfp = Mat_Open(filename.c_str(), MAT_ACC_RDONLY);
+    if(matfp == nullptr)
+        return false;
+
+    matvar_t* matvar = readFeatureInfo(matfp);
+    bool const valid = matvar != nullptr && matvar->rank == 3;
+    if(valid)
+    {
+        outHeight = (Coord) matvar->dims[0];
+        outWidth = (Coord) matvar->dims[1];
+        outDim = (Coord) matvar->dims[2];
+    }
+
+    if(matvar != nullptr)
+        Mat_VarFree(matvar);
+    Mat_Close(matfp);
+    return valid;
+}
+
 bool FeatureImage::write(std::string const& filename)
 {
     mat_t* matfp = Mat_Create(filename.c_str(), nullptr);
@@ -100,13 +331,15 @@ bool FeatureImage::write(std::string const& filename)
     else
     {
         // Write features to mat variable
+        Feature scratch;
         for(size_t y = 0; y < m_height; ++y)
         {
             for(size_t x = 0; x < m_width; ++x)
             {
+                Feature const& f = at(x, y, scratch);
                 for(size_t c = 0; c < m_dim; ++c)
                 {
-                    ((float*)matvar->data)[y + x * m_height + c * m_height* m_width] = at(x, y)[c];
+                    ((float*)matvar->data)[y + x * m_height + c * m_height* m_width] = f[c];
                 }
             }
         }
@@ -119,6 +352,247 @@ bool FeatureImage::write(std::string const& filename)
     return true;
 }
 
+bool FeatureImage::writeNative(std::string const& filename) const
+{
+    std::ofstream out(filename, std::ios::out | std::ios::binary | std::ios::trunc);
+    if(!out.is_open())
+    {
+        std::cerr << "Unable to open feature file \"" << filename << "\" for writing." << std::endl;
+        return false;
+    }
+
+    NativeHeader header{};
+    std::memcpy(header.magic, s_nativeMagic, sizeof(s_nativeMagic));
+    header.version = s_nativeVersion;
+    out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+    return writeBinary(out);
+}
+
+bool FeatureImage::isNative(std::string const& filename)
+{
+    NativeHeader header;
+    return readNativeHeader(filename, header);
+}
+
+bool FeatureImage::readNative(std::string const& filename, Precision precision)
+{
+    int const fd = ::open(filename.c_str(), O_RDONLY);
+    if(fd < 0)
+    {
+        std::cerr << "Error opening feature file \"" << filename << "\"." << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0 || static_cast<size_t>(st.st_size) < sizeof(NativeHeader))
+    {
+        std::cerr << "Invalid feature file \"" << filename << "\"." << std::endl;
+        ::close(fd);
+        return false;
+    }
+    size_t const size = static_cast<size_t>(st.st_size);
+
+    void* pMap = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+    ::close(fd);
+    if(pMap == MAP_FAILED)
+    {
+        std::cerr << "Unable to map feature file \"" << filename << "\"." << std::endl;
+        return false;
+    }
+    char const* data = static_cast<char const*>(pMap);
+    char const* binary = data + sizeof(NativeHeader);
+
+    NativeHeader header;
+    BinaryHeader binaryHeader;
+    size_t featureSize;
+    std::memcpy(&header, data, sizeof(header));
+    bool const valid = std::memcmp(header.magic, s_nativeMagic, sizeof(s_nativeMagic)) == 0 &&
+                       header.version == s_nativeVersion &&
+                       readBinaryHeader(binary, size - sizeof(header), binaryHeader, featureSize);
+    if(!valid)
+    {
+        std::cerr << "Invalid feature file \"" << filename << "\"." << std::endl;
+        munmap(pMap, size);
+        return false;
+    }
+
+    // Features are used right from the mapping, pages are loaded as they are touched
+    if(binaryHeader.precision == static_cast<uint32_t>(precision))
+    {
+        m_width = binaryHeader.width;
+        m_height = binaryHeader.height;
+        m_dim = binaryHeader.dim;
+        m_precision = precision;
+        m_features.clear();
+        m_halfFeatures.resize(0, 0);
+        m_bfloat16Features.resize(0, 0);
+        m_pMapping = std::shared_ptr<void const>(pMap, [size](void const* p)
+        {
+            munmap(const_cast<void*>(p), size);
+        });
+        m_pMappedFeatures = binary + sizeof(BinaryHeader);
+        return true;
+    }
+
+    // Otherwise the features have to be converted. The file is read once from front to back.
+    madvise(pMap, size, MADV_SEQUENTIAL);
+    readBinary(binary, size - sizeof(header));
+    munmap(pMap, size);
+    convert(precision);
+    return true;
+}
+
+bool FeatureImage::writeBinary(std::ostream& out) const
+{
+    BinaryHeader header{m_width, m_height, m_dim, static_cast<uint32_t>(m_precision)};
+    out.write(reinterpret_cast<char const*>(&header), sizeof(header));
+
+    switch(m_precision)
+    {
+        case Precision::Half:
+            out.write(reinterpret_cast<char const*>(halfFeatures().data()),
+                      halfFeatures().size() * sizeof(Eigen::half));
+            break;
+        case Precision::BFloat16:
+            out.write(reinterpret_cast<char const*>(bfloat16Features().data()),
+                      bfloat16Features().size() * sizeof(Eigen::bfloat16));
+            break;
+        case Precision::Single:
+            if(m_pMappedFeatures != nullptr)
+                out.write(static_cast<char const*>(m_pMappedFeatures), m_width * m_height * m_dim * sizeof(float));
+            else
+                for(Feature const& f : m_features)
+                    out.write(reinterpret_cast<char const*>(f.data()), m_dim * sizeof(float));
+            break;
+    }
+
+    return out.good();
+}
+
+size_t FeatureImage::readBinary(char const* data, size_t size)
+{
+    BinaryHeader header;
+    size_t featureSize;
+    if(!readBinaryHeader(data, size, header, featureSize))
+        return 0;
+
+    m_width = header.width;
+    m_height = header.height;
+    m_dim = header.dim;
+    m_precision = static_cast<Precision>(header.precision);
+    m_features.clear();
+    m_halfFeatures.resize(0, 0);
+    m_bfloat16Features.resize(0, 0);
+    unmap();
+
+    char const* payload = data + sizeof(header);
+    switch(m_precision)
+    {
+        case Precision::Half:
+            m_halfFeatures.resize(m_dim, m_width * m_height);
+            std::memcpy(m_halfFeatures.data(), payload, featureSize);
+            break;
+        case Precision::BFloat16:
+            m_bfloat16Features.resize(m_dim, m_width * m_height);
+            std::memcpy(m_bfloat16Features.data(), payload, featureSize);
+            break;
+        case Precision::Single:
+            m_features.resize(m_width * m_height, Feature(m_dim));
+            for(SiteId i = 0; i < m_width * m_height; ++i)
+                std::memcpy(m_features[i].data(), payload + i * m_dim * sizeof(float), m_dim * sizeof(float));
+            break;
+    }
+
+    return sizeof(header) + featureSize;
+}
+
+size_t FeatureImage::readBinary(std::shared_ptr<void const> pOwner, char const* data, size_t size)
+{
+    BinaryHeader header;
+    size_t featureSize;
+    if(!readBinaryHeader(data, size, header, featureSize))
+        return 0;
+
+    char const* payload = data + sizeof(header);
+    size_t const alignment = header.precision == static_cast<uint32_t>(Precision::Single)
+                             ? alignof(float) : alignof(uint16_t);
+    if(reinterpret_cast<uintptr_t>(payload) % alignment != 0)
+        return readBinary(data, size);
+
+    m_width = header.width;
+    m_height = header.height;
+    m_dim = header.dim;
+    m_precision = static_cast<Precision>(header.precision);
+    m_features.clear();
+    m_halfFeatures.resize(0, 0);
+    m_bfloat16Features.resize(0, 0);
+    m_pMapping = std::move(pOwner);
+    m_pMappedFeatures = payload;
+
+    return sizeof(header) + featureSize;
+}
+
+void FeatureImage::convert(Precision precision)
+{
+    if(precision == m_precision)
+        return;
+
+    // Go through single precision if converting between two reduced precisions
+    if(m_precision != Precision::Single && precision != Precision::Single)
+        convert(Precision::Single);
+
+    switch(precision)
+    {
+        case Precision::Half:
+            if(m_pMappedFeatures != nullptr)
+                m_halfFeatures = mappedSingleFeatures().cast<Eigen::half>();
+            else
+                packFeatures(m_features, m_halfFeatures, m_dim);
+            break;
+        case Precision::BFloat16:
+            if(m_pMappedFeatures != nullptr)
+                m_bfloat16Features = mappedSingleFeatures().cast<Eigen::bfloat16>();
+            else
+                packFeatures(m_features, m_bfloat16Features, m_dim);
+            break;
+        case Precision::Single:
+            if(m_precision == Precision::Half)
+                unpackFeatures(halfFeatures(), m_features);
+            else
+                unpackFeatures(bfloat16Features(), m_features);
+            break;
+    }
+
+    // Release the memory of the old representation
+    if(m_precision == Precision::Single)
+        std::vector<Feature>().swap(m_features);
+    else if(m_precision == Precision::Half)
+        m_halfFeatures.resize(0, 0);
+    else
+        m_bfloat16Features.resize(0, 0);
+    unmap();
+
+    m_precision = precision;
+}
+
+FeatureImage::Precision FeatureImage::precision() const
+{
+    return m_precision;
+}
+
+bool FeatureImage::parsePrecision(std::string const& name, Precision& outPrecision)
+{
+    if(name == "single")
+        outPrecision = Precision::Single;
+    else if(name == "half")
+        outPrecision = Precision::Half;
+    else if(name == "bfloat16")
+        outPrecision = Precision::BFloat16;
+    else
+        return false;
+    return true;
+}
+
 Coord FeatureImage::width() const
 {
     return m_width;
@@ -136,56 +610,100 @@ Coord FeatureImage::dim() const
 
 Feature const& FeatureImage::at(Coord x, Coord y) const
 {
+    requireOwnedSingle();
     assert(x + y * m_width < m_features.size());
     return m_features[x + y * m_width];
 }
 
 Feature& FeatureImage::at(Coord x, Coord y)
 {
+    requireSingle();
+    detach();
     assert(x + y * m_width < m_features.size());
     return m_features[x + y * m_width];
 }
 
+Feature const& FeatureImage::at(Coord x, Coord y, Feature& scratch) const
+{
+    return atSite(x + y * m_width, scratch);
+}
+
 Feature const& FeatureImage::atSite(SiteId i) const
 {
+    requireOwnedSingle();
     assert(i < m_features.size());
     return m_features[i];
 }
 
 Feature& FeatureImage::atSite(SiteId i)
 {
+    requireSingle();
+    detach();
     assert(i < m_features.size());
     return m_features[i];
 }
 
+Feature const& FeatureImage::atSite(SiteId i, Feature& scratch) const
+{
+    switch(m_precision)
+    {
+        case Precision::Half:
+            assert(i < m_width * m_height);
+            scratch.resize(m_dim);
+            widen(halfFeatures().col(i).data(), scratch.data(), m_dim);
+            return scratch;
+        case Precision::BFloat16:
+            assert(i < m_width * m_height);
+            scratch.resize(m_dim);
+            widen(bfloat16Features().col(i).data(), scratch.data(), m_dim);
+            return scratch;
+        case Precision::Single:
+            if(m_pMappedFeatures == nullptr)
+                break;
+            assert(i < m_width * m_height);
+            scratch = mappedSingleFeatures().col(i);
+            return scratch;
+    }
+    return atSite(i);
+}
+
 std::vector<Feature>& FeatureImage::data()
 {
+    requireSingle();
+    detach();
     return m_features;
 }
 
 std::vector<Feature> const& FeatureImage::data() const
 {
+    requireOwnedSingle();
     return m_features;
 }
 
 void FeatureImage::subtract(FeatureImage const& other)
 {
-    assert(other.m_features.size() == m_features.size());
-
-    for(size_t i = 0; i < m_features.size(); ++i)
-        m_features[i] -= other.m_features[i];
+    requireSingle();
+    other.requireSingle();
+    detach();
+    assert(other.width() == m_width && other.height() == m_height);
+
+    Feature scratch;
+    for(SiteId i = 0; i < m_features.size(); ++i)
+        m_features[i] -= other.atSite(i, scratch);
 }
 
 FeatureImage::operator cv::Mat() const
 {
     cv::Mat result(m_height, m_width, helper::opencv::getOpenCvType<float>(m_dim));
 
+    Feature scratch;
     for (Coord y = 0; y < m_height; ++y)
     {
         for (Coord x = 0; x < m_width; ++x)
         {
+            Feature const& f = at(x, y, scratch);
             for (Coord c = 0; c < m_dim; ++c)
-                ((float*)result.data)[(x+y*m_width) * m_dim + c] = at(x, y)[c];
+                ((float*)result.data)[(x+y*m_width) * m_dim + c] = f[c];
         }
     }
 
@@ -194,41 +712,55 @@ FeatureImage::operator cv::Mat() const
 
 void FeatureImage::rescale(float factor, bool interpolate)
 {
+    // Resizing to the same size doesn't change anything, but would copy every feature twice
+    if(factor == 1.f)
+        return;
+
     cv::Mat img = static_cast<cv::Mat>(*this);
     cv::Mat resized;
     cv::resize(img, resized, cv::Size(), factor, factor, interpolate ? cv::INTER_LINEAR : cv::INTER_NEAREST);
 
-    m_width = static_cast<size_t>(resized.cols);
-    m_height = static_cast<size_t>(resized.rows);
-    m_features.resize(m_width * m_height, Feature::Zero(m_dim));
-
-    for (Coord y = 0; y < m_height; ++y)
-    {
-        for (Coord x = 0; x < m_width; ++x)
-        {
-            for (Coord c = 0; c < m_dim; ++c)
-                at(x, y)[c] = ((float*)resized.data)[resized.cols * y * m_dim + x * m_dim + c];
-        }
-    }
+    assign(resized);
 }
 
 void FeatureImage::rescale(Coord width, Coord height, bool interpolate)
 {
+    if(width == m_width && height == m_height)
+        return;
+
     cv::Mat img = static_cast<cv::Mat>(*this);
     cv::Mat resized;
     cv::resize(img, resized, cv::Size(width, height), 0, 0, interpolate ? cv::INTER_LINEAR : cv::INTER_NEAREST);
 
-    m_width = static_cast<size_t>(resized.cols);
-    m_height = static_cast<size_t>(resized.rows);
-    m_features.resize(m_width * m_height, Feature::Zero(m_dim));
+    assign(resized);
+}
+
+void FeatureImage::assign(cv::Mat const& mat)
+{
+    m_width = static_cast<size_t>(mat.cols);
+    m_height = static_cast<size_t>(mat.rows);
+    unmap();
 
-    for (Coord y = 0; y < m_height; ++y)
+    switch(m_precision)
     {
-        for (Coord x = 0; x < m_width; ++x)
-        {
-            for (Coord c = 0; c < m_dim; ++c)
-                at(x, y)[c] = ((float*)resized.data)[resized.cols * y * m_dim + x * m_dim + c];
-        }
+        case Precision::Half:
+            packMat(mat, m_halfFeatures, m_dim);
+            break;
+        case Precision::BFloat16:
+            packMat(mat, m_bfloat16Features, m_dim);
+            break;
+        case Precision::Single:
+            m_features.resize(m_width * m_height, Feature::Zero(m_dim));
+
+            for (Coord y = 0; y < m_height; ++y)
+            {
+                for (Coord x = 0; x < m_width; ++x)
+                {
+                    for (Coord c = 0; c < m_dim; ++c)
+                        at(x, y)[c] = ((float*)mat.data)[mat.cols * y * m_dim + x * m_dim + c];
+                }
+            }
+            break;
     }
 }
 
@@ -239,13 +771,15 @@ void FeatureImage::minMax(float* min, float* max) const
     if(max != nullptr)
         *max = std::numeric_limits<float>::min();
 
+    Feature scratch;
     for (Coord y = 0; y < m_height; ++y)
     {
         for (Coord x = 0; x < m_width; ++x)
         {
+            Feature const& feat = at(x, y, scratch);
             for (Coord c = 0; c < m_dim; ++c)
             {
-                float const f = at(x, y)[c];
+                float const f = feat[c];
                 if(min != nullptr && f < *min)
                     *min = f;
                 if(max != nullptr && f > *max)
@@ -257,30 +791,86 @@ void FeatureImage::minMax(float* min, float* max) const
 
 void FeatureImage::flipHorizontally()
 {
+    detach();
     for (Coord y = 0; y < m_height; ++y)
     {
         for (Coord x = 0; x < std::floor(m_width / 2.f); ++x)
         {
-            Feature f = at(x, y);
-            at(x, y) = at(m_width - x - 1, y);
-            at(m_width - x - 1, y) = f;
+            SiteId const left = x + y * m_width;
+            SiteId const right = m_width - x - 1 + y * m_width;
+            switch(m_precision)
+            {
+                case Precision::Half:
+                    m_halfFeatures.col(left).swap(m_halfFeatures.col(right));
+                    break;
+                case Precision::BFloat16:
+                    m_bfloat16Features.col(left).swap(m_bfloat16Features.col(right));
+                    break;
+                case Precision::Single:
+                    m_features[left].swap(m_features[right]);
+                    break;
+            }
+        }
+    }
+}
+
+void FeatureImage::crop(Coord x, Coord y, Coord w, Coord h)
+{
+    assert(x + w <= m_width && y + h <= m_height);
+
+    switch(m_precision)
+    {
+        case Precision::Half:
+            cropColumns(halfFeatures(), m_halfFeatures, m_width, x, y, w, h);
+            break;
+        case Precision::BFloat16:
+            cropColumns(bfloat16Features(), m_bfloat16Features, m_width, x, y, w, h);
+            break;
+        case Precision::Single:
+        {
+            std::vector<Feature> cropped;
+            cropped.reserve(w * h);
+            for(Coord d_y = y; d_y < y + h; ++d_y)
+            {
+                for(Coord d_x = x; d_x < x + w; ++d_x)
+                {
+                    if(m_pMappedFeatures != nullptr)
+                        cropped.push_back(mappedSingleFeatures().col(d_x + d_y * m_width));
+                    else
+                        cropped.push_back(std::move(m_features[d_x + d_y * m_width]));
+                }
+            }
+            m_features.swap(cropped);
+            break;
         }
     }
+
+    unmap();
+    m_width = w;
+    m_height = h;
 }
 
 void FeatureImage::addFrom(FeatureImage const& other, int x, int y, int w, int h)
 {
+    requireSingle();
+    other.requireSingle();
+    detach();
+
+    Feature scratch;
     for(int d_x = x; d_x < m_width && d_x < x + w; ++d_x)
     {
         for(int d_y = y; d_y < m_height && d_y < y + h; ++d_y)
         {
-            at(d_x, d_y) += other.at(d_x - x, d_y - y);
+            at(d_x, d_y) += other.at(d_x - x, d_y - y, scratch);
         }
     }
 }
 
 void FeatureImage::normalize()
 {
+    requireSingle();
+    detach();
+
     for (SiteId i = 0; i < m_width * m_height; ++i)
     {
         float sum = atSite(i).sum();
@@ -288,3 +878,69 @@ void FeatureImage::normalize()
             atSite(i) /= sum;
     }
 }
+
+void FeatureImage::requireSingle() const
+{
+    // Reduced precision images don't have any single precision features, accessing them would be out of bounds
+    if(m_precision != Precision::Single)
+        throw std::logic_error("FeatureImage: Operation is only available for features stored in single precision");
+}
+
+void FeatureImage::requireOwnedSingle() const
+{
+    requireSingle();
+    if(m_pMappedFeatures != nullptr)
+        throw std::logic_error("FeatureImage: Features mapped from a file can only be read through a scratch feature");
+}
+
+FeatureImage::SingleView FeatureImage::mappedSingleFeatures() const
+{
+    assert(m_pMappedFeatures != nullptr);
+    return SingleView(static_cast<float const*>(m_pMappedFeatures), m_dim, m_width * m_height);
+}
+
+FeatureImage::HalfView FeatureImage::halfFeatures() const
+{
+    if(m_pMappedFeatures != nullptr)
+        return HalfView(static_cast<Eigen::half const*>(m_pMappedFeatures), m_dim, m_width * m_height);
+    return HalfView(m_halfFeatures.data(), m_halfFeatures.rows(), m_halfFeatures.cols());
+}
+
+FeatureImage::BFloat16View FeatureImage::bfloat16Features() const
+{
+    if(m_pMappedFeatures != nullptr)
+        return BFloat16View(static_cast<Eigen::bfloat16 const*>(m_pMappedFeatures), m_dim, m_width * m_height);
+    return BFloat16View(m_bfloat16Features.data(), m_bfloat16Features.rows(), m_bfloat16Features.cols());
+}
+
+void FeatureImage::detach()
+{
+    if(m_pMappedFeatures == nullptr)
+        return;
+
+    switch(m_precision)
+    {
+        case Precision::Half:
+            m_halfFeatures = halfFeatures();
+            break;
+        case Precision::BFloat16:
+            m_bfloat16Features = bfloat16Features();
+            break;
+        case Precision::Single:
+        {
+            SingleView const features = mappedSingleFeatures();
+            m_features.clear();
+            m_features.reserve(features.cols());
+            for(SingleView::Index i = 0; i < features.cols(); ++i)
+                m_features.push_back(features.col(i));
+            break;
+        }
+    }
+    unmap();
+}
+
+void FeatureImage::unmap()
+{
+    m_pMappedFeatures = nullptr;
+    m_pMapping.reset();
+}
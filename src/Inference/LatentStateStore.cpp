@@ -0,0 +1,226 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#include <fstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+#include <unistd.h>
+#include "Inference/LatentStateStore.h"
+
+namespace
+{
+    /**
+     * Identifies spill files. Has to be changed whenever the layout changes.
+     */
+    char const s_magic[8] = {'H', 'S', 'E', 'G', 'L', 'S', '0', '1'};
+
+    template<typename T>
+    void writePod(std::ostream& out, T const& value)
+    {
+        out.write(reinterpret_cast<char const*>(&value), sizeof(T));
+    }
+
+    template<typename T>
+    bool readPod(std::istream& in, T& outValue)
+    {
+        in.read(reinterpret_cast<char*>(&outValue), sizeof(T));
+        return static_cast<bool>(in);
+    }
+
+    void writeLabelImage(std::ostream& out, LabelImage const& img)
+    {
+        writePod<uint32_t>(out, img.width());
+        writePod<uint32_t>(out, img.height());
+        out.write(reinterpret_cast<char const*>(img.data().data()), img.data().size() * sizeof(Label));
+    }
+
+    bool readLabelImage(std::istream& in, LabelImage& outImg)
+    {
+        uint32_t width, height;
+        if(!readPod(in, width) || !readPod(in, height))
+            return false;
+        outImg = LabelImage(width, height);
+        in.read(reinterpret_cast<char*>(outImg.data().data()), outImg.data().size() * sizeof(Label));
+        return static_cast<bool>(in);
+    }
+
+    void writeResult(std::ostream& out, InferenceResult const& result)
+    {
+        writeLabelImage(out, result.labeling);
+        writeLabelImage(out, result.clustering);
+        writePod<uint32_t>(out, result.clusters.size());
+        for(Cluster const& c : result.clusters)
+        {
+            writePod<Label>(out, c.m_label);
+            writePod<uint32_t>(out, c.m_feature.size());
+            out.write(reinterpret_cast<char const*>(c.m_feature.data()), c.m_feature.size() * sizeof(float));
+        }
+        writePod(out, result.numIter);
+    }
+
+    bool readResult(std::istream& in, InferenceResult& outResult)
+    {
+        if(!readLabelImage(in, outResult.labeling) || !readLabelImage(in, outResult.clustering))
+            return false;
+        uint32_t numClusters;
+        if(!readPod(in, numClusters))
+            return false;
+        outResult.clusters.resize(numClusters);
+        for(Cluster& c : outResult.clusters)
+        {
+            uint32_t dim;
+            if(!readPod(in, c.m_label) || !readPod(in, dim))
+                return false;
+            c.m_feature.resize(dim);
+            in.read(reinterpret_cast<char*>(c.m_feature.data()), dim * sizeof(float));
+        }
+        return readPod(in, outResult.numIter);
+    }
+}
+
+LatentStateStore::LatentStateStore(size_t memoryBudget, std::string spillDir)
+        : m_memoryBudget(memoryBudget),
+          m_spillDir(std::move(spillDir))
+{
+    auto const now = std::chrono::system_clock::now().time_since_epoch();
+    m_runId = std::to_string(getpid()) + "-" + std::to_string(std::chrono::duration_cast<std::chrono::milliseconds>(now).count());
+}
+
+LatentStateStore::~LatentStateStore()
+{
+    for(std::string const& name : m_spilled)
+        std::remove(spillFilename(name).c_str());
+}
+
+bool LatentStateStore::get(std::string const& name, LatentState& outState)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        auto iter = m_states.find(name);
+        if(iter != m_states.end())
+        {
+            m_lru.splice(m_lru.begin(), m_lru, iter->second.lruPos);
+            outState = iter->second.state;
+            return true;
+        }
+
+        // A state that is still being written is taken from memory
+        auto spillIter = m_spilling.find(name);
+        if(spillIter != m_spilling.end())
+        {
+            outState = *spillIter->second.pState;
+            return true;
+        }
+        if(m_spilled.count(name) == 0)
+            return false;
+    }
+
+    return unspill(name, outState);
+}
+
+void LatentStateStore::put(std::string const& name, LatentState state)
+{
+    std::vector<std::pair<std::string, Spilling>> evicted;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t const bytes = estimateSize(state);
+        auto iter = m_states.find(name);
+        if(iter != m_states.end())
+        {
+            m_memoryUsage -= iter->second.bytes;
+            m_lru.erase(iter->second.lruPos);
+            m_states.erase(iter);
+        }
+        m_lru.push_front(name);
+        m_states.emplace(name, Entry{std::move(state), bytes, m_lru.begin()});
+        m_memoryUsage += bytes;
+
+        // Evict least recently used states until the budget is met
+        while(m_memoryUsage > m_memoryBudget && !m_lru.empty())
+        {
+            auto victim = m_states.find(m_lru.back());
+            m_memoryUsage -= victim->second.bytes;
+            if(!m_spillDir.empty())
+            {
+                Spilling spilling{std::make_shared<LatentState const>(std::move(victim->second.state)),
+                                  m_nextGeneration++};
+                m_spilling[victim->first] = spilling;
+                evicted.emplace_back(victim->first, std::move(spilling));
+            }
+            m_states.erase(victim);
+            m_lru.pop_back();
+        }
+    }
+
+    // Write evicted states without holding the lock
+    for(auto const& e : evicted)
+        spill(e.first, e.second);
+}
+
+size_t LatentStateStore::memoryUsage() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_memoryUsage;
+}
+
+std::string LatentStateStore::spillFilename(std::string const& name) const
+{
+    std::string flatName = name;
+    std::replace(flatName.begin(), flatName.end(), '/', '_');
+    return m_spillDir + "hseg-" + m_runId + "-" + flatName + ".latent";
+}
+
+void LatentStateStore::spill(std::string const& name, Spilling const& spilling)
+{
+    // Written to a temporary file first, so a file that can be read is always complete
+    std::string const filename = spillFilename(name);
+    std::string const tmpFilename = filename + ".tmp" + std::to_string(spilling.generation);
+    bool written;
+    {
+        std::ofstream out(tmpFilename, std::ios::out | std::ios::binary | std::ios::trunc);
+        out.write(s_magic, sizeof(s_magic));
+        writeResult(out, spilling.pState->gt);
+        writeResult(out, spilling.pState->prediction);
+        written = static_cast<bool>(out);
+    }
+
+    // Only the latest spill of a sample is kept. If the state has been put again in the meantime, the spill is obsolete.
+    std::lock_guard<std::mutex> lock(m_mutex);
+    auto iter = m_spilling.find(name);
+    bool const latest = iter != m_spilling.end() && iter->second.generation == spilling.generation;
+    if(latest)
+        m_spilling.erase(iter);
+    if(latest && written && std::rename(tmpFilename.c_str(), filename.c_str()) == 0)
+        m_spilled.insert(name);
+    else
+        std::remove(tmpFilename.c_str());
+}
+
+bool LatentStateStore::unspill(std::string const& name, LatentState& outState) const
+{
+    if(m_spillDir.empty())
+        return false;
+    std::ifstream in(spillFilename(name), std::ios::in | std::ios::binary);
+    if(!in.is_open())
+        return false;
+    char magic[sizeof(s_magic)];
+    if(!in.read(magic, sizeof(magic)) || std::memcmp(magic, s_magic, sizeof(s_magic)) != 0)
+        return false;
+    return readResult(in, outState.gt) && readResult(in, outState.prediction);
+}
+
+size_t LatentStateStore::estimateSize(LatentState const& state)
+{
+    size_t bytes = sizeof(LatentState);
+    for(InferenceResult const* pResult : {&state.gt, &state.prediction})
+    {
+        bytes += (pResult->labeling.data().size() + pResult->clustering.data().size()) * sizeof(Label);
+        for(Cluster const& c : pResult->clusters)
+            bytes += sizeof(Cluster) + c.m_feature.size() * sizeof(float);
+    }
+    return bytes;
+}
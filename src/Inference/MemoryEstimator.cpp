@@ -0,0 +1,87 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#include "Inference/MemoryEstimator.h"
+
+namespace
+{
+    // Bookkeeping of the allocator and of TRW-S per node and edge, measured roughly
+    constexpr size_t s_allocOverhead = 16;
+    constexpr size_t s_trwsNodeOverhead = 64;
+    constexpr size_t s_trwsEdgeOverhead = 64;
+    constexpr size_t s_trwsReal = sizeof(double);
+
+    // Quantized vectors are padded to this many elements
+    constexpr size_t s_searchLanes = 32;
+}
+
+MemoryEstimator::MemoryEstimator(size_t featDimPx, size_t featDimCluster, Label numClasses, ClusterId numClusters,
+                                 ClusterId shortlist, bool usePairwise, FeatureImage::Precision precision)
+        : m_featDimPx(featDimPx),
+          m_featDimCluster(featDimCluster),
+          m_numClasses(numClasses),
+          m_numClusters(numClusters),
+          m_shortlist(shortlist),
+          m_usePairwise(usePairwise),
+          m_precision(precision)
+{
+}
+
+size_t MemoryEstimator::estimate(Coord width, Coord height) const
+{
+    return features(width, height) + inference(width, height);
+}
+
+size_t MemoryEstimator::features(Coord width, Coord height) const
+{
+    size_t const numPx = static_cast<size_t>(width) * height;
+    size_t const dim = m_featDimPx + m_featDimCluster;
+
+    // Single precision features are allocated per site, reduced precision ones are stored in one matrix
+    if(m_precision == FeatureImage::Precision::Single)
+        return numPx * (dim * sizeof(float) + 2 * (sizeof(Feature) + s_allocOverhead));
+    return numPx * dim * 2;
+}
+
+size_t MemoryEstimator::inference(Coord width, Coord height) const
+{
+    size_t const numPx = static_cast<size_t>(width) * height;
+    size_t const numNodes = numPx + m_numClusters;
+    size_t numEdges = m_numClusters > 0 ? numPx : 0;
+    if(m_usePairwise)
+        numEdges += 2 * numPx;
+
+    // Every node holds its unaries, every edge its cost matrix and a message
+    size_t const K = m_numClasses;
+    size_t const graph = numNodes * (s_trwsNodeOverhead + 2 * K * s_trwsReal)
+                         + numEdges * (s_trwsEdgeOverhead + (K * K + K) * s_trwsReal);
+
+    // Labeling and clustering of the result, the previous state and the ground truth
+    size_t const labelings = 6 * numPx * sizeof(Label);
+
+    return graph + labelings + clusterSearch(width, height);
+}
+
+size_t MemoryEstimator::clusterSearch(Coord width, Coord height) const
+{
+    if(m_shortlist == 0 || m_shortlist >= m_numClusters)
+        return 0;
+
+    // Quantized features and squared features of every site, and the scales of every channel
+    size_t const numPx = static_cast<size_t>(width) * height;
+    size_t const paddedDim = (m_featDimCluster + s_searchLanes - 1) / s_searchLanes * s_searchLanes;
+    size_t const features = numPx * 2 * paddedDim + 4 * m_featDimCluster * sizeof(float);
+
+    // Quantized weights with scale and sum per (pixel label, cluster) and per (pixel label, cluster label). There is an
+    // additional pixel label for invalid labels.
+    size_t const rows = m_numClasses + 1u;
+    size_t const rowInfo = sizeof(float) + sizeof(int32_t);
+    size_t const weights = rows * m_numClusters * (paddedDim + rowInfo + sizeof(float))
+                           + rows * m_numClasses * (paddedDim + rowInfo);
+
+    // Approximate costs and candidates of a site
+    size_t const scratch = m_numClusters * (sizeof(Cost) + sizeof(ClusterId));
+
+    return features + weights + scratch;
+}
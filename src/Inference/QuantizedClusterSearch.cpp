@@ -0,0 +1,228 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#include <cmath>
+#include <algorithm>
+#if defined(__x86_64__) || defined(__i386__)
+#include <immintrin.h>
+#endif
+#include "Inference/QuantizedClusterSearch.h"
+
+namespace
+{
+    uint32_t const s_lanes = 32;
+
+#if defined(__AVX2__)
+    inline int32_t horizontalSum(__m256i v)
+    {
+        __m128i s = _mm_add_epi32(_mm256_castsi256_si128(v), _mm256_extracti128_si256(v, 1));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(1, 0, 3, 2)));
+        s = _mm_add_epi32(s, _mm_shuffle_epi32(s, _MM_SHUFFLE(2, 3, 0, 1)));
+        return _mm_cvtsi128_si32(s);
+    }
+#endif
+
+    /**
+     * Computes the dot product of an unsigned and a signed 8 bit vector
+     * @param a Unsigned vector
+     * @param b Signed vector
+     * @param n Length of both vectors, must be a multiple of s_lanes
+     * @return The dot product
+     */
+    inline int32_t dot(uint8_t const* a, int8_t const* b, uint32_t n)
+    {
+#if defined(__AVX512VNNI__) && defined(__AVX512VL__)
+        __m256i acc = _mm256_setzero_si256();
+        for(uint32_t c = 0; c < n; c += 32)
+        {
+            __m256i const va = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(a + c));
+            __m256i const vb = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b + c));
+            acc = _mm256_dpbusd_epi32(acc, va, vb);
+        }
+        return horizontalSum(acc);
+#elif defined(__AVXVNNI__)
+        __m256i acc = _mm256_setzero_si256();
+        for(uint32_t c = 0; c < n; c += 32)
+        {
+            __m256i const va = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(a + c));
+            __m256i const vb = _mm256_loadu_si256(reinterpret_cast<__m256i const*>(b + c));
+            acc = _mm256_dpbusd_avx_epi32(acc, va, vb);
+        }
+        return horizontalSum(acc);
+#elif defined(__AVX2__)
+        // No VNNI: widen to 16 bit and use madd, which (unlike maddubs) can't saturate
+        __m256i acc = _mm256_setzero_si256();
+        for(uint32_t c = 0; c < n; c += 16)
+        {
+            __m256i const va = _mm256_cvtepu8_epi16(_mm_loadu_si128(reinterpret_cast<__m128i const*>(a + c)));
+            __m256i const vb = _mm256_cvtepi8_epi16(_mm_loadu_si128(reinterpret_cast<__m128i const*>(b + c)));
+            acc = _mm256_add_epi32(acc, _mm256_madd_epi16(va, vb));
+        }
+        return horizontalSum(acc);
+#else
+        int32_t sum = 0;
+        for(uint32_t c = 0; c < n; ++c)
+            sum += static_cast<int32_t>(a[c]) * static_cast<int32_t>(b[c]);
+        return sum;
+#endif
+    }
+
+    inline int32_t quantize(float value, float invScale, int32_t min, int32_t max)
+    {
+        return std::min(max, std::max(min, static_cast<int32_t>(std::lround(value * invScale))));
+    }
+}
+
+QuantizedClusterSearch::QuantizedClusterSearch(FeatureImage const& features)
+        : m_dim(features.dim()),
+          m_paddedDim((features.dim() + s_lanes - 1) / s_lanes * s_lanes)
+{
+    SiteId const numSites = features.width() * features.height();
+    Feature scratch;
+
+    // Find the range of every channel
+    Feature maxAbs = Feature::Zero(m_dim);
+    for(SiteId i = 0; i < numSites; ++i)
+        maxAbs = maxAbs.cwiseMax(features.atSite(i, scratch).cwiseAbs());
+
+    m_channelScale.resize(m_dim);
+    m_channelScaleSq.resize(m_dim);
+    std::vector<float> invScale(m_dim, 0.f);
+    std::vector<float> invScaleSq(m_dim, 0.f);
+    for(uint32_t c = 0; c < m_dim; ++c)
+    {
+        m_channelScale[c] = maxAbs(c) / 127.f;
+        m_channelScaleSq[c] = maxAbs(c) * maxAbs(c) / 127.f;
+        if(maxAbs(c) > 0)
+        {
+            invScale[c] = 1.f / m_channelScale[c];
+            invScaleSq[c] = 1.f / m_channelScaleSq[c];
+        }
+    }
+
+    // Quantize. Features are stored with an offset of 128 so they can be used as unsigned operand.
+    m_features.assign(static_cast<size_t>(numSites) * m_paddedDim, 128);
+    m_featuresSq.assign(static_cast<size_t>(numSites) * m_paddedDim, 0);
+    for(SiteId i = 0; i < numSites; ++i)
+    {
+        Feature const& f = features.atSite(i, scratch);
+        uint8_t* q = &m_features[static_cast<size_t>(i) * m_paddedDim];
+        uint8_t* qSq = &m_featuresSq[static_cast<size_t>(i) * m_paddedDim];
+        for(uint32_t c = 0; c < m_dim; ++c)
+        {
+            q[c] = static_cast<uint8_t>(quantize(f(c), invScale[c], -127, 127) + 128);
+            qSq[c] = static_cast<uint8_t>(quantize(f(c) * f(c), invScaleSq[c], 0, 127));
+        }
+    }
+}
+
+void QuantizedClusterSearch::prepare(Weights const& weights, std::vector<Cluster> const& clusters, LabelImage const& labeling)
+{
+    m_numClasses = static_cast<Label>(weights.numClasses());
+    m_numClusters = static_cast<ClusterId>(clusters.size());
+
+    m_clusterLabels.resize(m_numClusters);
+    std::vector<bool> used(m_numClasses, false);
+    m_usedLabels.clear();
+    for(ClusterId k = 0; k < m_numClusters; ++k)
+    {
+        m_clusterLabels[k] = clusters[k].m_label;
+        if(!used[m_clusterLabels[k]])
+        {
+            used[m_clusterLabels[k]] = true;
+            m_usedLabels.push_back(m_clusterLabels[k]);
+        }
+    }
+    m_labelCost.assign(m_numClasses, 0.f);
+
+    // Row m_numClasses is used for sites with an invalid label
+    size_t const numRows = m_numClasses + 1u;
+    m_clusterRows.assign(numRows * m_numClusters * m_paddedDim, 0);
+    m_clusterRowInfo.assign(numRows * m_numClusters, QuantizedRow());
+    m_clusterConst.assign(numRows * m_numClusters, 0.f);
+    m_labelRows.assign(numRows * m_numClasses * m_paddedDim, 0);
+    m_labelRowInfo.assign(numRows * m_numClasses, QuantizedRow());
+
+    std::vector<bool> present(numRows, false);
+    for(SiteId i = 0; i < labeling.pixels(); ++i)
+        present[std::min(labeling.atSite(i), m_numClasses)] = true;
+
+    for(size_t row = 0; row < numRows; ++row)
+        if(present[row])
+            prepareRow(weights, clusters, static_cast<Label>(row), row);
+}
+
+void QuantizedClusterSearch::prepareRow(Weights const& weights, std::vector<Cluster> const& clusters, Label l1, size_t row)
+{
+    bool const invalid = l1 >= m_numClasses;
+    Feature scaled(m_dim);
+
+    // Quadratic term only depends on the labels
+    for(Label l2 = 0; l2 < m_numClasses; ++l2)
+    {
+        WeightVec const& wFeat = weights.feature(invalid ? l2 : l1, l2);
+        for(uint32_t c = 0; c < m_dim; ++c)
+            scaled(c) = wFeat(c) * m_channelScaleSq[c];
+        size_t const index = row * m_numClasses + l2;
+        m_labelRowInfo[index] = quantizeRow(scaled, &m_labelRows[index * m_paddedDim]);
+    }
+
+    // Linear and constant terms depend on the cluster
+    for(ClusterId k = 0; k < m_numClusters; ++k)
+    {
+        Feature const& fClus = clusters[k].m_feature;
+        Label const l2 = clusters[k].m_label;
+        Label const l = invalid ? l2 : l1;
+        WeightVec const& wFeat = weights.feature(l, l2);
+        WeightVec const& wHo = weights.higherOrder(l, l2);
+
+        auto const wHead = wHo.head(m_dim);
+        auto const wTail = wHo.segment(m_dim, m_dim);
+        scaled = (wHead - 2.f * wFeat.cwiseProduct(fClus)).cwiseProduct(Eigen::Map<Feature const>(m_channelScale.data(), m_dim));
+
+        size_t const index = row * m_numClusters + k;
+        m_clusterRowInfo[index] = quantizeRow(scaled, &m_clusterRows[index * m_paddedDim]);
+        m_clusterConst[index] = wTail.dot(fClus) + wHo(2 * m_dim) + wFeat.dot(fClus.cwiseAbs2());
+    }
+}
+
+QuantizedClusterSearch::QuantizedRow QuantizedClusterSearch::quantizeRow(Feature const& row, int8_t* out) const
+{
+    QuantizedRow info;
+    float const maxAbs = row.cwiseAbs().maxCoeff();
+    if(maxAbs <= 0)
+        return info;
+
+    info.m_scale = maxAbs / 127.f;
+    float const invScale = 1.f / info.m_scale;
+    for(uint32_t c = 0; c < m_dim; ++c)
+    {
+        int32_t const q = quantize(row(c), invScale, -127, 127);
+        out[c] = static_cast<int8_t>(q);
+        info.m_sum += q;
+    }
+    return info;
+}
+
+void QuantizedClusterSearch::approximateCosts(SiteId i, Label l, Cost* outCosts)
+{
+    size_t const row = std::min(l, m_numClasses);
+    uint8_t const* q = &m_features[static_cast<size_t>(i) * m_paddedDim];
+    uint8_t const* qSq = &m_featuresSq[static_cast<size_t>(i) * m_paddedDim];
+
+    // Quadratic term, only for the labels that are actually used by some cluster
+    for(Label l2 : m_usedLabels)
+    {
+        size_t const index = row * m_numClasses + l2;
+        m_labelCost[l2] = m_labelRowInfo[index].m_scale * dot(qSq, &m_labelRows[index * m_paddedDim], m_paddedDim);
+    }
+
+    for(ClusterId k = 0; k < m_numClusters; ++k)
+    {
+        size_t const index = row * m_numClusters + k;
+        QuantizedRow const& info = m_clusterRowInfo[index];
+        int32_t const linear = dot(q, &m_clusterRows[index * m_paddedDim], m_paddedDim) - 128 * info.m_sum;
+        outCosts[k] = info.m_scale * linear + m_labelCost[m_clusterLabels[k]] + m_clusterConst[index];
+    }
+}
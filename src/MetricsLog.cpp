@@ -0,0 +1,131 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#include <cmath>
+#include <iomanip>
+#include <iostream>
+#include <sys/resource.h>
+#include "MetricsLog.h"
+
+MetricsLog::Record::Record(char const* type)
+{
+    m_out << "{\"type\":\"" << type << "\"";
+}
+
+MetricsLog::Record& MetricsLog::Record::set(char const* key, std::string const& value)
+{
+    return set(key, value.c_str());
+}
+
+MetricsLog::Record& MetricsLog::Record::set(char const* key, char const* value)
+{
+    m_out << ",\"" << key << "\":\"";
+    for(; *value != '\0'; ++value)
+    {
+        if(*value == '"' || *value == '\\')
+            m_out << '\\' << *value;
+        else if(static_cast<unsigned char>(*value) >= 0x20)
+            m_out << *value;
+    }
+    m_out << '"';
+    return *this;
+}
+
+MetricsLog::Record& MetricsLog::Record::set(char const* key, bool value)
+{
+    m_out << ",\"" << key << "\":" << (value ? "true" : "false");
+    return *this;
+}
+
+MetricsLog::Record& MetricsLog::Record::set(char const* key, double value)
+{
+    m_out << ",\"" << key << "\":";
+    if(std::isfinite(value))
+        m_out << std::setprecision(9) << value;
+    else
+        m_out << "null";
+    return *this;
+}
+
+MetricsLog::Record& MetricsLog::Record::set(char const* key, long long value)
+{
+    m_out << ",\"" << key << "\":" << value;
+    return *this;
+}
+
+MetricsLog::Record& MetricsLog::Record::set(char const* key, unsigned long long value)
+{
+    m_out << ",\"" << key << "\":" << value;
+    return *this;
+}
+
+std::string MetricsLog::Record::str() const
+{
+    return m_out.str() + "}";
+}
+
+MetricsLog::MetricsLog(std::string const& filename, size_t total, float progressEvery)
+        : m_filename(filename),
+          m_total(total),
+          m_progressEvery(progressEvery)
+{
+    if(!m_filename.empty())
+        m_out.open(m_filename, std::ios::out | std::ios::app);
+}
+
+bool MetricsLog::good() const
+{
+    return m_filename.empty() || m_out.is_open();
+}
+
+void MetricsLog::write(Record& record)
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    writeLocked(record);
+}
+
+void MetricsLog::writeLocked(Record& record)
+{
+    if(!m_out.is_open())
+        return;
+    record.set("time", m_timer.elapsed<Timer::microseconds>().count() / 1e6);
+    m_out << record.str() << std::endl;
+}
+
+void MetricsLog::itemDone()
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    m_numDone++;
+    float const elapsed = m_timer.elapsed<Timer::microseconds>().count() / 1e6f;
+    if(m_progressEvery <= 0 || (elapsed - m_lastReport < m_progressEvery && m_numDone < m_total))
+        return;
+
+    // Throughput is measured since the last report, the remaining time is estimated from the overall throughput
+    float const throughput = (m_numDone - m_numDoneLastReport) / std::max(elapsed - m_lastReport, 1e-3f);
+    float const eta = m_numDone < m_total ? (m_total - m_numDone) * elapsed / m_numDone : 0.f;
+    size_t const rss = peakRss();
+    m_lastReport = elapsed;
+    m_numDoneLastReport = m_numDone;
+
+    std::cout << "Progress: " << m_numDone << "/" << m_total << ", " << std::fixed << std::setprecision(2)
+              << throughput << " items/s, ETA " << static_cast<size_t>(eta) << "s, peak RSS "
+              << rss / (1024 * 1024) << "MiB" << std::defaultfloat << std::endl;
+
+    Record record("progress");
+    record.set("done", m_numDone)
+          .set("total", m_total)
+          .set("items_per_s", throughput)
+          .set("eta_s", eta)
+          .set("peak_rss_mb", rss / (1024. * 1024.));
+    writeLocked(record);
+}
+
+size_t MetricsLog::peakRss()
+{
+    rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) != 0)
+        return 0;
+    // Reported in KiB on Linux
+    return static_cast<size_t>(usage.ru_maxrss) * 1024;
+}
@@ -0,0 +1,263 @@
+//
+// Created by jan on 18.10.26.
+//
+
+#include <cstring>
+#include <cerrno>
+#include <cstdlib>
+#include <iostream>
+#include <unistd.h>
+#include <netdb.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include "Network/Socket.h"
+
+namespace
+{
+    bool isUnixAddress(std::string const& address)
+    {
+        return address.compare(0, 5, "unix:") == 0;
+    }
+
+    bool makeUnixAddress(std::string const& path, sockaddr_un& outAddr)
+    {
+        if(path.size() >= sizeof(outAddr.sun_path))
+            return false;
+        std::memset(&outAddr, 0, sizeof(outAddr));
+        outAddr.sun_family = AF_UNIX;
+        std::strncpy(outAddr.sun_path, path.c_str(), sizeof(outAddr.sun_path) - 1);
+        return true;
+    }
+
+    bool splitHostPort(std::string const& address, std::string& outHost, std::string& outPort)
+    {
+        size_t const colon = address.rfind(':');
+        if(colon == std::string::npos)
+            return false;
+        outHost = address.substr(0, colon);
+        outPort = address.substr(colon + 1);
+        return !outPort.empty();
+    }
+
+    bool sendAll(int fd, char const* data, size_t size)
+    {
+        while(size > 0)
+        {
+            ssize_t const sent = ::send(fd, data, size, MSG_NOSIGNAL);
+            if(sent < 0 && errno == EINTR)
+                continue;
+            if(sent <= 0)
+                return false;
+            data += sent;
+            size -= sent;
+        }
+        return true;
+    }
+
+    bool receiveAll(int fd, char* data, size_t size)
+    {
+        while(size > 0)
+        {
+            ssize_t const received = ::recv(fd, data, size, 0);
+            if(received < 0 && errno == EINTR)
+                continue;
+            if(received <= 0)
+                return false;
+            data += received;
+            size -= received;
+        }
+        return true;
+    }
+}
+
+Socket::Socket(int fd)
+        : m_fd(fd)
+{
+}
+
+constexpr uint64_t Socket::s_defaultMaxMessageSize;
+
+Socket::Socket(Socket&& other)
+        : m_fd(other.m_fd),
+          m_maxMessageSize(other.m_maxMessageSize)
+{
+    other.m_fd = -1;
+}
+
+Socket& Socket::operator=(Socket&& other)
+{
+    if(this != &other)
+    {
+        if(m_fd >= 0)
+            ::close(m_fd);
+        m_fd = other.m_fd;
+        m_maxMessageSize = other.m_maxMessageSize;
+        other.m_fd = -1;
+    }
+    return *this;
+}
+
+Socket::~Socket()
+{
+    if(m_fd >= 0)
+        ::close(m_fd);
+}
+
+Socket Socket::connect(std::string const& address)
+{
+    if(isUnixAddress(address))
+    {
+        sockaddr_un addr;
+        if(!makeUnixAddress(address.substr(5), addr))
+            return Socket();
+        Socket socket(::socket(AF_UNIX, SOCK_STREAM, 0));
+        if(!socket.valid() || ::connect(socket.m_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+            return Socket();
+        return socket;
+    }
+
+    std::string host, port;
+    if(!splitHostPort(address, host, port))
+        return Socket();
+    addrinfo hints;
+    std::memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+    addrinfo* pResult = nullptr;
+    if(::getaddrinfo(host.c_str(), port.c_str(), &hints, &pResult) != 0)
+        return Socket();
+
+    Socket socket;
+    for(addrinfo* p = pResult; p != nullptr; p = p->ai_next)
+    {
+        Socket candidate(::socket(p->ai_family, p->ai_socktype, p->ai_protocol));
+        if(candidate.valid() && ::connect(candidate.m_fd, p->ai_addr, p->ai_addrlen) == 0)
+        {
+            // Messages are sent as a whole, there is nothing to gain from delaying them
+            int const flag = 1;
+            ::setsockopt(candidate.m_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+            socket = std::move(candidate);
+            break;
+        }
+    }
+    ::freeaddrinfo(pResult);
+    return socket;
+}
+
+bool Socket::valid() const
+{
+    return m_fd >= 0;
+}
+
+bool Socket::send(uint32_t type, std::string const& payload)
+{
+    char header[sizeof(uint32_t) + sizeof(uint64_t)];
+    uint64_t const size = payload.size();
+    std::memcpy(header, &type, sizeof(type));
+    std::memcpy(header + sizeof(type), &size, sizeof(size));
+    return valid() && sendAll(m_fd, header, sizeof(header)) && sendAll(m_fd, payload.data(), payload.size());
+}
+
+bool Socket::receive(uint32_t& outType, std::string& outPayload)
+{
+    char header[sizeof(uint32_t) + sizeof(uint64_t)];
+    if(!valid() || !receiveAll(m_fd, header, sizeof(header)))
+        return false;
+    uint64_t size = 0;
+    std::memcpy(&outType, header, sizeof(outType));
+    std::memcpy(&size, header + sizeof(outType), sizeof(size));
+
+    // The size comes from the peer, a corrupt header must not lead to a huge allocation
+    if(size > m_maxMessageSize)
+    {
+        std::cerr << "Received message of " << size << " bytes, which exceeds the limit of " << m_maxMessageSize
+                  << " bytes. Closing the connection." << std::endl;
+        shutdown();
+        return false;
+    }
+    outPayload.resize(size);
+    return size == 0 || receiveAll(m_fd, &outPayload[0], size);
+}
+
+void Socket::setMaxMessageSize(uint64_t maxMessageSize)
+{
+    m_maxMessageSize = maxMessageSize;
+}
+
+void Socket::shutdown()
+{
+    if(m_fd >= 0)
+        ::shutdown(m_fd, SHUT_RDWR);
+}
+
+ServerSocket::~ServerSocket()
+{
+    if(m_fd >= 0)
+        ::close(m_fd);
+    if(!m_unixPath.empty())
+        ::unlink(m_unixPath.c_str());
+}
+
+bool ServerSocket::listen(std::string const& address)
+{
+    if(isUnixAddress(address))
+    {
+        sockaddr_un addr;
+        if(!makeUnixAddress(address.substr(5), addr))
+            return false;
+        ::unlink(addr.sun_path);
+        m_fd = ::socket(AF_UNIX, SOCK_STREAM, 0);
+        if(m_fd < 0 || ::bind(m_fd, reinterpret_cast<sockaddr*>(&addr), sizeof(addr)) != 0)
+            return false;
+        m_unixPath = addr.sun_path;
+    }
+    else
+    {
+        std::string host, port;
+        if(!splitHostPort(address, host, port))
+            return false;
+
+        // Only listen on the given interface, all of them have to be asked for explicitly
+        addrinfo hints;
+        std::memset(&hints, 0, sizeof(hints));
+        hints.ai_family = AF_UNSPEC;
+        hints.ai_socktype = SOCK_STREAM;
+        hints.ai_flags = AI_PASSIVE;
+        bool const anyHost = host.empty() || host == "*";
+        addrinfo* pResult = nullptr;
+        if(::getaddrinfo(anyHost ? nullptr : host.c_str(), port.c_str(), &hints, &pResult) != 0)
+            return false;
+
+        for(addrinfo* p = pResult; p != nullptr && m_fd < 0; p = p->ai_next)
+        {
+            m_fd = ::socket(p->ai_family, p->ai_socktype, p->ai_protocol);
+            int const flag = 1;
+            if(m_fd >= 0 && (::setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag)) != 0
+                             || ::bind(m_fd, p->ai_addr, p->ai_addrlen) != 0))
+            {
+                ::close(m_fd);
+                m_fd = -1;
+            }
+        }
+        ::freeaddrinfo(pResult);
+        if(m_fd < 0)
+            return false;
+    }
+    return ::listen(m_fd, SOMAXCONN) == 0;
+}
+
+Socket ServerSocket::accept()
+{
+    int fd;
+    do
+        fd = ::accept(m_fd, nullptr, nullptr);
+    while(fd < 0 && errno == EINTR);
+    if(fd < 0)
+        return Socket();
+
+    int const flag = 1;
+    ::setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag)); // Fails harmlessly on unix sockets
+    return Socket(fd);
+}
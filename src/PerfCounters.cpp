@@ -0,0 +1,141 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#include <atomic>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include "PerfCounters.h"
+
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace
+{
+    std::atomic_bool s_warned[PerfCounters::NumCounters];
+
+#if defined(__linux__)
+    int openCounter(uint32_t type, uint64_t config, int groupFd)
+    {
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.read_format = PERF_FORMAT_GROUP;
+        attr.disabled = groupFd == -1 ? 1 : 0;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        return static_cast<int>(syscall(__NR_perf_event_open, &attr, 0, -1, groupFd, 0));
+    }
+#endif
+}
+
+PerfCounters& PerfCounters::local()
+{
+    thread_local PerfCounters counters;
+    return counters;
+}
+
+PerfCounters::PerfCounters()
+{
+    m_fds.fill(-1);
+    m_slot.fill(-1);
+
+#if defined(__linux__)
+    struct
+    {
+        uint32_t type;
+        uint64_t config;
+    } const events[NumCounters] = {
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES},
+            {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+    };
+
+    for(size_t c = 0; c < NumCounters; ++c)
+    {
+        int const fd = openCounter(events[c].type, events[c].config, m_leader);
+        if(fd < 0)
+        {
+            if(!s_warned[c].exchange(true))
+                std::cerr << "Hardware counter \"" << name(static_cast<Counter>(c)) << "\" unavailable: "
+                          << std::strerror(errno) << std::endl;
+            continue;
+        }
+        if(m_leader == -1)
+            m_leader = fd;
+        m_fds[c] = fd;
+        m_slot[c] = m_numOpen++;
+    }
+
+    if(m_leader != -1)
+    {
+        ioctl(m_leader, PERF_EVENT_IOC_RESET, PERF_IOC_FLAG_GROUP);
+        ioctl(m_leader, PERF_EVENT_IOC_ENABLE, PERF_IOC_FLAG_GROUP);
+    }
+#endif
+}
+
+PerfCounters::~PerfCounters()
+{
+#if defined(__linux__)
+    for(int fd : m_fds)
+        if(fd >= 0)
+            close(fd);
+#endif
+}
+
+bool PerfCounters::available(Counter c) const
+{
+    return m_slot[c] >= 0;
+}
+
+bool PerfCounters::anyAvailable() const
+{
+    return m_numOpen > 0;
+}
+
+bool PerfCounters::read(Values& outValues) const
+{
+    outValues.fill(0);
+#if defined(__linux__)
+    if(m_leader == -1)
+        return false;
+
+    // Layout of a group read: number of counters, followed by their values
+    uint64_t buffer[1 + NumCounters];
+    ssize_t const bytes = ::read(m_leader, buffer, sizeof(uint64_t) * (1 + m_numOpen));
+    if(bytes != static_cast<ssize_t>(sizeof(uint64_t) * (1 + m_numOpen)))
+        return false;
+    for(size_t c = 0; c < NumCounters; ++c)
+        if(m_slot[c] >= 0)
+            outValues[c] = buffer[1 + m_slot[c]];
+    return true;
+#else
+    return false;
+#endif
+}
+
+char const* PerfCounters::name(Counter c)
+{
+    switch(c)
+    {
+        case Cycles:
+            return "cycles";
+        case Instructions:
+            return "instructions";
+        case LlcMisses:
+            return "LLC misses";
+        case BranchMisses:
+            return "branch misses";
+        default:
+            return "unknown";
+    }
+}
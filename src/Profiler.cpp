@@ -0,0 +1,424 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#include <atomic>
+#include <bitset>
+#include <chrono>
+#include <fstream>
+#include <iostream>
+#include <iomanip>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <algorithm>
+#include "Profiler.h"
+
+namespace Profiler
+{
+    namespace
+    {
+#if defined(USE_PERF_COUNTERS)
+        using CounterSet = std::bitset<PerfCounters::NumCounters>;
+#endif
+
+        struct Event
+        {
+            char const* name;
+            uint64_t begin;
+            uint64_t end;
+            uint32_t depth;
+#if defined(USE_PERF_COUNTERS)
+            PerfCounters::Values counters;
+#endif
+        };
+
+        /**
+         * Append-only list of events, written by a single thread. Chunks are never moved, so other threads can read
+         * all events up to the published size of each chunk at any time.
+         */
+        class ThreadBuffer
+        {
+        public:
+            explicit ThreadBuffer(size_t id)
+                    : m_id(id),
+                      m_pHead(new Chunk),
+                      m_pTail(m_pHead)
+            {
+#if defined(USE_PERF_COUNTERS)
+                // Buffers are created by the thread that writes to them, so these are the counters of its events
+                PerfCounters const& counters = PerfCounters::local();
+                for(size_t c = 0; c < PerfCounters::NumCounters; ++c)
+                    m_counters[c] = counters.available(static_cast<PerfCounters::Counter>(c));
+#endif
+            }
+
+            ~ThreadBuffer()
+            {
+                Chunk* pChunk = m_pHead;
+                while(pChunk != nullptr)
+                {
+                    Chunk* pNext = pChunk->next.load();
+                    delete pChunk;
+                    pChunk = pNext;
+                }
+            }
+
+            void append(Event const& e)
+            {
+                size_t size = m_pTail->size.load(std::memory_order_relaxed);
+                if(size == s_chunkSize)
+                {
+                    Chunk* pChunk = new Chunk;
+                    m_pTail->next.store(pChunk, std::memory_order_release);
+                    m_pTail = pChunk;
+                    size = 0;
+                }
+                m_pTail->events[size] = e;
+                m_pTail->size.store(size + 1, std::memory_order_release);
+            }
+
+            template<typename Fun>
+            void forEach(Fun fun) const
+            {
+                for(Chunk const* pChunk = m_pHead; pChunk != nullptr; pChunk = pChunk->next.load(std::memory_order_acquire))
+                {
+                    size_t const size = pChunk->size.load(std::memory_order_acquire);
+                    for(size_t i = 0; i < size; ++i)
+                        fun(pChunk->events[i]);
+                }
+            }
+
+            size_t id() const
+            {
+                return m_id;
+            }
+
+#if defined(USE_PERF_COUNTERS)
+            CounterSet const& counters() const
+            {
+                return m_counters;
+            }
+#endif
+
+        private:
+            static constexpr size_t s_chunkSize = 4096;
+
+            struct Chunk
+            {
+                Event events[s_chunkSize];
+                std::atomic<size_t> size{0};
+                std::atomic<Chunk*> next{nullptr};
+            };
+
+            size_t m_id;
+            Chunk* m_pHead;
+            Chunk* m_pTail;
+#if defined(USE_PERF_COUNTERS)
+            CounterSet m_counters;
+#endif
+        };
+
+        struct Node
+        {
+            size_t calls = 0;
+            uint64_t total = 0;
+#if defined(USE_PERF_COUNTERS)
+            PerfCounters::Values counters{};
+#endif
+            std::map<std::string, Node> children;
+        };
+
+        void add(Node& node, Event const& e)
+        {
+            node.calls++;
+            node.total += e.end - e.begin;
+#if defined(USE_PERF_COUNTERS)
+            for(size_t c = 0; c < PerfCounters::NumCounters; ++c)
+                node.counters[c] += e.counters[c];
+#endif
+        }
+
+#if defined(USE_PERF_COUNTERS)
+        void writeCounters(std::ostream& out, Node const& node, size_t indent, CounterSet const& counters)
+        {
+            if(counters.none())
+                return;
+            out << std::string(indent, ' ');
+            char const* separator = "";
+            for(size_t c = 0; c < PerfCounters::NumCounters; ++c)
+            {
+                auto const counter = static_cast<PerfCounters::Counter>(c);
+                if(counters[c])
+                {
+                    out << separator << node.counters[c] << " " << PerfCounters::name(counter);
+                    separator = ", ";
+                }
+            }
+            uint64_t const instructions = node.counters[PerfCounters::Instructions];
+            if(instructions > 0 && counters[PerfCounters::Cycles])
+                out << ", " << std::setprecision(2)
+                    << static_cast<double>(instructions) / node.counters[PerfCounters::Cycles] << " IPC";
+            if(instructions > 0 && counters[PerfCounters::LlcMisses])
+                out << ", " << std::setprecision(2) << 1e3 * node.counters[PerfCounters::LlcMisses] / instructions
+                    << " LLC MPKI";
+            out << std::endl;
+        }
+#endif
+
+        using Buffers = std::vector<ThreadBuffer const*>;
+
+        void writeChromeTrace(std::ostream& out, Buffers const& buffers);
+
+        void writeSummary(std::ostream& out, Buffers const& buffers);
+
+        /**
+         * Owns the buffers of all threads. Buffers outlive their threads, and are reported when the program ends.
+         */
+        class Registry
+        {
+        public:
+            ~Registry()
+            {
+                Buffers const all = buffers();
+                bool empty = true;
+                for(ThreadBuffer const* pBuffer : all)
+                    pBuffer->forEach([&empty](Event const&) { empty = false; });
+                if(empty)
+                    return;
+
+                std::cout << std::endl << "== PROFILING RESULTS ==" << std::endl;
+                writeSummary(std::cout, all);
+                std::ofstream out("profile.json", std::ios::out | std::ios::trunc);
+                writeChromeTrace(out, all);
+                if(out)
+                    std::cout << "Trace written to \"profile.json\"." << std::endl;
+                else
+                    std::cerr << "Couldn't write trace to \"profile.json\"." << std::endl;
+            }
+
+            ThreadBuffer* add()
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                m_buffers.push_back(std::make_unique<ThreadBuffer>(m_buffers.size()));
+                return m_buffers.back().get();
+            }
+
+            Buffers buffers() const
+            {
+                std::lock_guard<std::mutex> lock(m_mutex);
+                Buffers buffers;
+                for(auto const& pBuffer : m_buffers)
+                    buffers.push_back(pBuffer.get());
+                return buffers;
+            }
+
+        private:
+            mutable std::mutex m_mutex;
+            std::vector<std::unique_ptr<ThreadBuffer>> m_buffers;
+        };
+
+        Registry& registry()
+        {
+            static Registry registry;
+            return registry;
+        }
+
+        thread_local ThreadBuffer* t_pBuffer = nullptr;
+        thread_local uint32_t t_depth = 0;
+
+        void writeJsonString(std::ostream& out, char const* str)
+        {
+            out << '"';
+            for(; *str != '\0'; ++str)
+            {
+                if(*str == '"' || *str == '\\')
+                    out << '\\' << *str;
+                else if(static_cast<unsigned char>(*str) >= 0x20)
+                    out << *str;
+            }
+            out << '"';
+        }
+
+#if defined(USE_PERF_COUNTERS)
+        void writeNode(std::ostream& out, std::string const& name, Node const& node, size_t indent,
+                       CounterSet const& counters)
+#else
+        void writeNode(std::ostream& out, std::string const& name, Node const& node, size_t indent)
+#endif
+        {
+            uint64_t childTotal = 0;
+            for(auto const& c : node.children)
+                childTotal += c.second.total;
+            uint64_t const self = node.total > childTotal ? node.total - childTotal : 0;
+
+            out << std::string(indent, ' ') << name << std::endl << std::string(indent + 4, ' ')
+                << std::fixed << std::setprecision(3)
+                << node.total / 1e6 << "ms TOTAL, "
+                << self / 1e6 << "ms SELF, "
+                << node.total / 1e6 / node.calls << "ms AVERAGE, "
+                << node.calls << " CALLS" << std::endl;
+#if defined(USE_PERF_COUNTERS)
+            writeCounters(out, node, indent + 4, counters);
+#endif
+
+            // Most expensive children first
+            std::vector<std::pair<std::string const*, Node const*>> children;
+            for(auto const& c : node.children)
+                children.emplace_back(&c.first, &c.second);
+            std::sort(children.begin(), children.end(),
+                      [](auto const& a, auto const& b) { return a.second->total > b.second->total; });
+            for(auto const& c : children)
+#if defined(USE_PERF_COUNTERS)
+                writeNode(out, *c.first, *c.second, indent + 2, counters);
+#else
+                writeNode(out, *c.first, *c.second, indent + 2);
+#endif
+        }
+
+        void writeChromeTrace(std::ostream& out, Buffers const& buffers)
+        {
+            out << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[";
+            bool first = true;
+            for(ThreadBuffer const* pBuffer : buffers)
+            {
+                pBuffer->forEach([&](Event const& e)
+                                 {
+                                     out << (first ? "\n" : ",\n") << "{\"name\":";
+                                     writeJsonString(out, e.name);
+                                     out << ",\"ph\":\"X\",\"pid\":0,\"tid\":" << pBuffer->id() << std::fixed
+                                         << std::setprecision(3) << ",\"ts\":" << e.begin / 1e3
+                                         << ",\"dur\":" << (e.end - e.begin) / 1e3;
+#if defined(USE_PERF_COUNTERS)
+                                     out << ",\"args\":{";
+                                     char const* separator = "";
+                                     for(size_t c = 0; c < PerfCounters::NumCounters; ++c)
+                                     {
+                                         auto const counter = static_cast<PerfCounters::Counter>(c);
+                                         if(!pBuffer->counters()[c])
+                                             continue;
+                                         out << separator << "\"" << PerfCounters::name(counter) << "\":"
+                                             << e.counters[c];
+                                         separator = ",";
+                                     }
+                                     out << "}";
+#endif
+                                     out << "}";
+                                     first = false;
+                                 });
+            }
+            out << "\n]}" << std::endl;
+        }
+
+        void writeSummary(std::ostream& out, Buffers const& buffers)
+        {
+            // Events are recorded when a scope ends. Ordered by their beginning, every event follows its parent.
+            Node root;
+            for(ThreadBuffer const* pBuffer : buffers)
+            {
+                std::vector<Event> events;
+                pBuffer->forEach([&events](Event const& e) { events.push_back(e); });
+                std::sort(events.begin(), events.end(), [](Event const& a, Event const& b)
+                {
+                    return a.begin < b.begin || (a.begin == b.begin && a.depth < b.depth);
+                });
+
+                std::vector<Node*> stack{&root};
+                for(Event const& e : events)
+                {
+                    // Scopes whose parent is still running when the summary is written are attached to the deepest
+                    // known ancestor
+                    size_t const depth = std::min<size_t>(e.depth, stack.size() - 1);
+                    stack.resize(depth + 1);
+                    Node& node = stack.back()->children[e.name];
+                    add(node, e);
+                    stack.push_back(&node);
+                }
+            }
+
+#if defined(USE_PERF_COUNTERS)
+            // The call tree merges all threads, so list every counter that any of them could record
+            CounterSet anyCounters;
+            for(ThreadBuffer const* pBuffer : buffers)
+                anyCounters |= pBuffer->counters();
+            for(auto const& c : root.children)
+                writeNode(out, c.first, c.second, 0, anyCounters);
+
+            // Flat profile of every thread, to spot threads that are slowed down by their memory accesses
+            if(anyCounters.none())
+                return;
+            for(ThreadBuffer const* pBuffer : buffers)
+            {
+                std::map<std::string, Node> scopes;
+                pBuffer->forEach([&scopes](Event const& e) { add(scopes[e.name], e); });
+                if(scopes.empty())
+                    continue;
+                out << "== THREAD " << pBuffer->id() << " ==" << std::endl;
+                for(auto const& s : scopes)
+                {
+                    out << s.first << std::endl << "    " << std::fixed << std::setprecision(3) << s.second.total / 1e6
+                        << "ms TOTAL, " << s.second.calls << " CALLS" << std::endl;
+                    writeCounters(out, s.second, 4, pBuffer->counters());
+                }
+            }
+#else
+            for(auto const& c : root.children)
+                writeNode(out, c.first, c.second, 0);
+#endif
+        }
+    }
+
+    ScopeTracer::ScopeTracer(char const* name) noexcept
+            : m_name(name)
+    {
+#if defined(USE_PERF_COUNTERS)
+        PerfCounters::local().read(m_counters);
+#endif
+        m_begin = now();
+        t_depth++;
+    }
+
+    ScopeTracer::~ScopeTracer() noexcept
+    {
+        uint64_t const end = now();
+        t_depth--;
+        if(t_pBuffer == nullptr)
+            t_pBuffer = registry().add();
+#if defined(USE_PERF_COUNTERS)
+        PerfCounters::Values counters;
+        PerfCounters::local().read(counters);
+        for(size_t c = 0; c < PerfCounters::NumCounters; ++c)
+            counters[c] -= m_counters[c];
+        t_pBuffer->append(Event{m_name, m_begin, end, t_depth, counters});
+#else
+        t_pBuffer->append(Event{m_name, m_begin, end, t_depth});
+#endif
+    }
+
+    uint64_t now() noexcept
+    {
+        // Initialized on first use, so scopes in static initializers of other translation units work as well
+        static std::chrono::steady_clock::time_point const epoch = std::chrono::steady_clock::now();
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    void writeChromeTrace(std::ostream& out)
+    {
+        writeChromeTrace(out, registry().buffers());
+    }
+
+    bool writeChromeTrace(std::string const& filename)
+    {
+        std::ofstream out(filename, std::ios::out | std::ios::trunc);
+        if(!out.is_open())
+            return false;
+        writeChromeTrace(out);
+        return static_cast<bool>(out);
+    }
+
+    void writeSummary(std::ostream& out)
+    {
+        writeSummary(out, registry().buffers());
+    }
+}
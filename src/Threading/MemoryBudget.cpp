@@ -0,0 +1,102 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#include <algorithm>
+#include "Threading/MemoryBudget.h"
+
+MemoryBudget::Reservation::Reservation(MemoryBudget* pBudget, size_t bytes)
+        : m_pBudget(pBudget),
+          m_bytes(bytes)
+{
+}
+
+MemoryBudget::Reservation::Reservation(Reservation&& other) noexcept
+        : m_pBudget(other.m_pBudget),
+          m_bytes(other.m_bytes)
+{
+    other.m_pBudget = nullptr;
+    other.m_bytes = 0;
+}
+
+MemoryBudget::Reservation& MemoryBudget::Reservation::operator=(Reservation&& other) noexcept
+{
+    if(this != &other)
+    {
+        release();
+        std::swap(m_pBudget, other.m_pBudget);
+        std::swap(m_bytes, other.m_bytes);
+    }
+    return *this;
+}
+
+MemoryBudget::Reservation::~Reservation()
+{
+    release();
+}
+
+void MemoryBudget::Reservation::release()
+{
+    if(m_pBudget != nullptr)
+        m_pBudget->release(m_bytes);
+    m_pBudget = nullptr;
+    m_bytes = 0;
+}
+
+size_t MemoryBudget::Reservation::bytes() const
+{
+    return m_bytes;
+}
+
+MemoryBudget::MemoryBudget(size_t budget)
+        : m_budget(budget)
+{
+}
+
+MemoryBudget::Reservation MemoryBudget::acquire(size_t bytes)
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    if(m_budget > 0)
+    {
+        // Reservations are admitted in order, so large ones can't be overtaken by small ones forever
+        size_t const ticket = m_nextTicket++;
+        auto const start = std::chrono::steady_clock::now();
+        m_released.wait(lock, [&] { return ticket == m_nowServing && (m_used == 0 || m_used + bytes <= m_budget); });
+        m_wait += std::chrono::steady_clock::now() - start;
+        m_nowServing++;
+        if(bytes > m_budget)
+            m_numOversized++;
+        m_released.notify_all();
+    }
+    m_used += bytes;
+    m_peak = std::max(m_peak, m_used);
+    m_numAdmitted++;
+    return Reservation(this, bytes);
+}
+
+size_t MemoryBudget::used() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_used;
+}
+
+MemoryBudgetStats MemoryBudget::stats() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    MemoryBudgetStats stats;
+    stats.budget = m_budget;
+    stats.peak = m_peak;
+    stats.numAdmitted = m_numAdmitted;
+    stats.numOversized = m_numOversized;
+    stats.waitSeconds = std::chrono::duration<double>(m_wait).count();
+    return stats;
+}
+
+void MemoryBudget::release(size_t bytes)
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_used -= bytes;
+    }
+    m_released.notify_all();
+}
@@ -0,0 +1,72 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#include "Threading/TaskGroup.h"
+
+TaskGroup::State::~State()
+{
+    for (ThreadPool::Job* task : tasks)
+        ThreadPool::JobAllocator::release(task);
+}
+
+bool TaskGroup::State::runOne()
+{
+    ThreadPool::Job* task;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (tasks.empty())
+            return false;
+        task = tasks.front();
+        tasks.pop_front();
+    }
+
+    // The callable reports its own exceptions via finish()
+    task->execute();
+    ThreadPool::JobAllocator::release(task);
+    return true;
+}
+
+void TaskGroup::State::finish(std::exception_ptr e)
+{
+    std::lock_guard<std::mutex> lock(mutex);
+    if (e && !exception)
+        exception = e;
+    if (--numPending == 0)
+        done.notify_all();
+}
+
+TaskGroup::TaskGroup(ThreadPool& pool)
+        : m_pool(pool),
+          m_pState(std::make_shared<State>())
+{
+}
+
+TaskGroup::~TaskGroup()
+{
+    try
+    {
+        wait();
+    }
+    catch (...)
+    {
+    }
+}
+
+void TaskGroup::wait()
+{
+    // Work off the tasks nobody has started yet
+    while (m_pState->runOne())
+    {
+    }
+
+    // Whatever is left is running on other threads
+    std::unique_lock<std::mutex> lock(m_pState->mutex);
+    m_pState->done.wait(lock, [this] { return m_pState->numPending == 0; });
+    if (m_pState->exception)
+    {
+        std::exception_ptr e = m_pState->exception;
+        m_pState->exception = nullptr;
+        std::rethrow_exception(e);
+    }
+}
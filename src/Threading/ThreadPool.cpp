@@ -8,54 +8,328 @@
 /// it might also begin to hurt your kittens.
 //////////////////////////////////////////////////////////////////////
 
+#include <algorithm>
+#include <iostream>
 #include "Threading/ThreadPool.h"
+#include "Threading/Topology.h"
 
-ThreadPool::ThreadPool(unsigned int threads)
+namespace
 {
-    m_internalMutex.lock();
+    // Identifies the pool and queue of the current thread, so jobs enqueued from within a job stay local
+    thread_local ThreadPool* t_pool = nullptr;
+    thread_local size_t t_queue = 0;
+
+    constexpr size_t s_jobBatchSize = 64;
+    constexpr size_t s_maxJobBatches = 64; //< Upper bound of jobs kept in the depot, in batches
+}
+
+ThreadPool::JobQueue::JobQueue()
+    : m_head(&m_stub),
+      m_tail(&m_stub)
+{
+}
+
+void ThreadPool::JobQueue::push(IJob* job)
+{
+    job->m_next.store(nullptr, std::memory_order_relaxed);
+    IJob* prev = m_head.exchange(job, std::memory_order_acq_rel);
+    prev->m_next.store(job, std::memory_order_release);
+}
+
+ThreadPool::IJob* ThreadPool::JobQueue::pop()
+{
+    IJob* tail = m_tail;
+    IJob* next = tail->m_next.load(std::memory_order_acquire);
+    if (tail == &m_stub)
+    {
+        if (next == nullptr)
+            return nullptr;
+        m_tail = next;
+        tail = next;
+        next = next->m_next.load(std::memory_order_acquire);
+    }
+    if (next != nullptr)
+    {
+        m_tail = next;
+        return tail;
+    }
+
+    // The tail is the last job. A push might be in progress, in which case we'll have to try again later.
+    if (tail != m_head.load(std::memory_order_acquire))
+        return nullptr;
+    push(&m_stub);
+    next = tail->m_next.load(std::memory_order_acquire);
+    if (next != nullptr)
+    {
+        m_tail = next;
+        return tail;
+    }
+    return nullptr;
+}
+
+ThreadPool::Job::~Job()
+{
+    reset();
+}
+
+void ThreadPool::Job::execute()
+{
+    // The callable is destroyed even if it throws, so the job can be reused
+    struct Reset
+    {
+        Job& job;
+
+        ~Reset()
+        {
+            job.reset();
+        }
+    } reset{*this};
+    m_pInvoke(m_pFun);
+}
+
+void ThreadPool::Job::reset()
+{
+    if (m_pFun != nullptr)
+    {
+        m_pDestroy(m_pFun);
+        m_pFun = nullptr;
+    }
+}
+
+thread_local ThreadPool::JobAllocator::Cache ThreadPool::JobAllocator::s_cache;
+ThreadPool::JobAllocator::Depot ThreadPool::JobAllocator::s_depot;
+
+ThreadPool::JobAllocator::Cache::~Cache()
+{
+    for (Job* job : jobs)
+        delete job;
+}
+
+ThreadPool::JobAllocator::Depot::~Depot()
+{
+    for (auto& batch : batches)
+        for (Job* job : batch)
+            delete job;
+}
+
+ThreadPool::Job* ThreadPool::JobAllocator::allocate()
+{
+    Cache& cache = s_cache;
+    if (cache.jobs.empty())
+    {
+        std::lock_guard<std::mutex> lock(s_depot.mutex);
+        if (!s_depot.batches.empty())
+        {
+            cache.jobs = std::move(s_depot.batches.back());
+            s_depot.batches.pop_back();
+        }
+    }
+    if (cache.jobs.empty())
+        return new Job;
+
+    Job* job = cache.jobs.back();
+    cache.jobs.pop_back();
+    return job;
+}
+
+void ThreadPool::JobAllocator::release(Job* job)
+{
+    job->reset();
+    Cache& cache = s_cache;
+    cache.jobs.push_back(job);
+    if (cache.jobs.size() < 2 * s_jobBatchSize)
+        return;
+
+    // Hand a batch to the depot, or free it if the depot is full already
+    std::vector<Job*> batch(cache.jobs.end() - s_jobBatchSize, cache.jobs.end());
+    cache.jobs.resize(cache.jobs.size() - s_jobBatchSize);
+    {
+        std::lock_guard<std::mutex> lock(s_depot.mutex);
+        if (s_depot.batches.size() < s_maxJobBatches)
+        {
+            s_depot.batches.push_back(std::move(batch));
+            return;
+        }
+    }
+    for (Job* j : batch)
+        delete j;
+}
+
+ThreadPool::ThreadPool(unsigned int threads, size_t maxQueued, bool pinThreads)
+    : m_pinThreads(pinThreads),
+      m_maxQueued(maxQueued)
+{
+    // There is always at least one queue, so jobs can be enqueued even if there are no threads
+    size_t const numQueues = std::max(threads, 1u);
+    for (size_t i = 0; i < numQueues; i++)
+        m_queues.push_back(std::make_unique<JobQueue>());
+
+    // Threads are assigned to nodes round-robin. Stealing from the own node keeps the data of a job local.
+    size_t const numNodes = pinThreads ? Topology::get().numNodes() : 1;
+    m_victims.resize(numQueues);
+    for (size_t i = 0; i < numQueues; i++)
+    {
+        for (size_t j = 0; j < numQueues; j++)
+            if ((i + j) % numQueues % numNodes == i % numNodes)
+                m_victims[i].push_back((i + j) % numQueues);
+        for (size_t j = 0; j < numQueues; j++)
+            if ((i + j) % numQueues % numNodes != i % numNodes)
+                m_victims[i].push_back((i + j) % numQueues);
+    }
+
     m_threads.reserve(threads);
     for (unsigned int i = 0; i < threads; i++)
-        m_threads.emplace_back(std::move(std::bind(&ThreadPool::runThread, this)));
-    m_internalMutex.unlock();
+        m_threads.emplace_back(&ThreadPool::runThread, this, i);
 }
 
 ThreadPool::~ThreadPool()
 {
-    m_internalMutex.lock();
-    m_shutdown = true;
-    m_internalMutex.unlock();
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_shutdown = true;
+    }
+    m_jobAvailable.notify_all();
+    m_slotAvailable.notify_all();
     for (auto& t : m_threads)
         t.join();
-    for (auto j : m_jobs)
-        delete j;
+    for (auto& q : m_queues)
+    {
+        // Jobs of an unfinished push are lost, but there are no producers left at this point
+        while (IJob* job = q->pop())
+            JobAllocator::release(static_cast<Job*>(job));
+    }
 }
 
-void ThreadPool::runThread()
+void ThreadPool::push(Job* job)
 {
-    while (true)
+    // Blocking a thread of this pool could deadlock it, e.g. if it waits for a task group
+    bool const isWorker = t_pool == this;
+    if (m_maxQueued > 0 && !isWorker && m_numQueued.load() >= m_maxQueued)
     {
-        m_internalMutex.lock();
-        if (m_shutdown)
+        std::unique_lock<std::mutex> lock(m_sleepMutex);
+        m_numBlocked++;
+        m_slotAvailable.wait(lock, [this] { return m_numQueued.load() < m_maxQueued || m_shutdown; });
+        m_numBlocked--;
+    }
+
+    size_t const queue = isWorker ? t_queue : m_nextQueue.fetch_add(1) % m_queues.size();
+    m_queues[queue]->push(job);
+    m_numQueued++;
+
+    // Only take the lock if somebody has to be woken up. As a parking thread registers itself before checking for
+    // jobs, it either sees this job or is registered by now.
+    if (m_numParked.load() > 0)
+    {
+        std::lock_guard<std::mutex> lock(m_sleepMutex);
+        m_jobAvailable.notify_one();
+    }
+}
+
+bool ThreadPool::claim()
+{
+    size_t n = m_numQueued.load();
+    while (n > 0)
+    {
+        if (m_numQueued.compare_exchange_weak(n, n - 1))
+            return true;
+    }
+    return false;
+}
+
+ThreadPool::Job* ThreadPool::take(size_t index)
+{
+    // Own queue first, then steal from the others. Busy queues are skipped instead of waiting for them.
+    for (size_t i = 0; i < m_victims[index].size(); ++i)
+    {
+        JobQueue& queue = *m_queues[m_victims[index][i]];
+        std::unique_lock<std::mutex> lock(queue.m_popMutex, std::defer_lock);
+        if (i == 0)
+            lock.lock();
+        else if (!lock.try_lock())
+            continue;
+        // The stub is never returned, thus every job is a Job
+        if (IJob* job = queue.pop())
+            return static_cast<Job*>(job);
+    }
+    return nullptr;
+}
+
+void ThreadPool::runThread(size_t index)
+{
+    t_pool = this;
+    t_queue = index;
+    if (m_pinThreads)
+    {
+        Topology const& topology = Topology::get();
+        if (!topology.pinToNode(index % topology.numNodes()))
+            std::cerr << "Couldn't pin thread " << index << " to NUMA node " << index % topology.numNodes() << std::endl;
+    }
+    while (!m_shutdown)
+    {
+        if (!claim())
         {
-            m_internalMutex.unlock();
-            return;
+            std::unique_lock<std::mutex> lock(m_sleepMutex);
+            m_numParked++;
+            m_jobAvailable.wait(lock, [this] { return m_numQueued.load() > 0 || m_shutdown; });
+            m_numParked--;
+            continue;
         }
-        if (m_jobs.empty() && !m_shutdown)
+
+        if (m_numBlocked.load() > 0)
         {
-            m_internalMutex.unlock();
-            std::this_thread::yield();
-            continue;
+            std::lock_guard<std::mutex> lock(m_sleepMutex);
+            m_slotAvailable.notify_one();
         }
-        else if (!m_jobs.empty())
+
+        // The claimed job is guaranteed to exist, but might not be visible yet
+        Job* job;
+        while ((job = take(index)) == nullptr)
         {
-            auto job = m_jobs.front();
-            m_jobs.pop_front();
-            m_internalMutex.unlock();
-            job->execute();
-            delete job;
-            continue;
+            if (m_shutdown)
+                return;
+            std::this_thread::yield();
         }
+        run(job);
+    }
+}
+
+void ThreadPool::run(Job* job)
+{
+    try
+    {
+        job->execute();
+    }
+    catch (...)
+    {
+        reportException();
     }
+    JobAllocator::release(job);
+}
+
+void ThreadPool::reportException()
+{
+    try
+    {
+        throw;
+    }
+    catch (std::exception const& e)
+    {
+        std::cerr << "Uncaught exception in job: " << e.what() << std::endl;
+    }
+    catch (...)
+    {
+        std::cerr << "Uncaught exception in job" << std::endl;
+    }
+}
+
+ThreadPool* ThreadPool::current()
+{
+    return t_pool;
+}
+
+int ThreadPool::currentIndex()
+{
+    return t_pool != nullptr ? static_cast<int>(t_queue) : -1;
 }
 
 unsigned int ThreadPool::size() const
@@ -65,5 +339,5 @@ unsigned int ThreadPool::size() const
 
 size_t ThreadPool::queued() const
 {
-    return m_jobs.size();
+    return m_numQueued.load();
 }
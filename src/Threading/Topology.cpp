@@ -0,0 +1,122 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <cstdlib>
+#include <dirent.h>
+#include <sched.h>
+#include <pthread.h>
+#include "Threading/Topology.h"
+
+namespace
+{
+    thread_local int t_node = -1;
+
+    std::vector<int> allowedCpus()
+    {
+        std::vector<int> cpus;
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        if (sched_getaffinity(0, sizeof(set), &set) != 0)
+            return cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &set))
+                cpus.push_back(cpu);
+        return cpus;
+    }
+}
+
+Topology::Topology()
+{
+    std::string const nodePath = "/sys/devices/system/node/";
+    std::vector<int> const allowed = allowedCpus();
+
+    // Node numbers don't have to be contiguous, therefore the directory is listed instead of probing node0, node1, ...
+    std::vector<int> nodeIds;
+    if (DIR* pDir = opendir(nodePath.c_str()))
+    {
+        while (dirent* pEntry = readdir(pDir))
+        {
+            std::string const name = pEntry->d_name;
+            if (name.size() > 4 && name.compare(0, 4, "node") == 0 &&
+                std::all_of(name.begin() + 4, name.end(), [](char c) { return c >= '0' && c <= '9'; }))
+                nodeIds.push_back(std::atoi(name.c_str() + 4));
+        }
+        closedir(pDir);
+    }
+    std::sort(nodeIds.begin(), nodeIds.end());
+
+    for (int id : nodeIds)
+    {
+        std::ifstream in(nodePath + "node" + std::to_string(id) + "/cpulist");
+        std::string list;
+        if (!std::getline(in, list))
+            continue;
+        std::vector<int> cpus;
+        for (int cpu : parseCpuList(list))
+            if (std::binary_search(allowed.begin(), allowed.end(), cpu))
+                cpus.push_back(cpu);
+        if (!cpus.empty())
+            m_nodes.push_back(std::move(cpus));
+    }
+
+    if (m_nodes.empty())
+        m_nodes.push_back(allowed);
+}
+
+Topology const& Topology::get()
+{
+    static Topology const topology;
+    return topology;
+}
+
+size_t Topology::numNodes() const
+{
+    return m_nodes.size();
+}
+
+std::vector<int> const& Topology::cpus(size_t node) const
+{
+    return m_nodes[node];
+}
+
+bool Topology::pinToNode(size_t node) const
+{
+    if (node >= m_nodes.size() || m_nodes[node].empty())
+        return false;
+
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    for (int cpu : m_nodes[node])
+        CPU_SET(cpu, &set);
+    if (pthread_setaffinity_np(pthread_self(), sizeof(set), &set) != 0)
+        return false;
+    t_node = node;
+    return true;
+}
+
+int Topology::currentNode()
+{
+    return t_node;
+}
+
+std::vector<int> Topology::parseCpuList(std::string const& list)
+{
+    std::vector<int> cpus;
+    std::istringstream in(list);
+    std::string range;
+    while (std::getline(in, range, ','))
+    {
+        if (range.empty())
+            continue;
+        size_t const dash = range.find('-');
+        int const first = std::atoi(range.substr(0, dash).c_str());
+        int const last = dash == std::string::npos ? first : std::atoi(range.substr(dash + 1).c_str());
+        for (int cpu = first; cpu <= last; ++cpu)
+            cpus.push_back(cpu);
+    }
+    return cpus;
+}
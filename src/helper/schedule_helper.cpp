@@ -0,0 +1,39 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#include <algorithm>
+#include <numeric>
+#include "helper/schedule_helper.h"
+
+namespace helper
+{
+    namespace schedule
+    {
+        std::vector<size_t> largestFirst(std::vector<size_t> const& costs, size_t numBuckets)
+        {
+            std::vector<size_t> order(costs.size());
+            std::iota(order.begin(), order.end(), 0);
+            if(costs.empty())
+                return order;
+
+            std::vector<size_t> keys = costs;
+            if(numBuckets > 0)
+            {
+                auto const minMax = std::minmax_element(costs.begin(), costs.end());
+                double const width = static_cast<double>(*minMax.second - *minMax.first) / numBuckets;
+                for(size_t& k : keys)
+                {
+                    if(width > 0)
+                        k = std::min(static_cast<size_t>((k - *minMax.first) / width), numBuckets - 1);
+                    else
+                        k = 0;
+                }
+            }
+
+            // Stable, so items of the same cost or bucket keep their order
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] > keys[b]; });
+            return order;
+        }
+    }
+}
@@ -0,0 +1,122 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#include <gtest/gtest.h>
+#include <Threading/TaskGroup.h>
+
+TEST(TaskGroup, runsAllTasks)
+{
+    ThreadPool pool(4);
+    std::atomic<int> sum{0};
+    TaskGroup group(pool);
+    for (int i = 1; i <= 100; ++i)
+        group.run([&sum, i] { sum += i; });
+    group.wait();
+    EXPECT_EQ(5050, sum);
+}
+
+TEST(TaskGroup, waitRunsTasksWithoutThreads)
+{
+    // The waiting thread works off the tasks itself
+    ThreadPool pool(0);
+    int sum = 0;
+    TaskGroup group(pool);
+    for (int i = 1; i <= 10; ++i)
+        group.run([&sum, i] { sum += i; });
+    group.wait();
+    EXPECT_EQ(55, sum);
+}
+
+TEST(TaskGroup, nestedWaitOnSingleThread)
+{
+    // The only thread of the pool waits for a group whose tasks wait for groups of their own
+    ThreadPool pool(1);
+    auto result = pool.enqueue([&pool]
+                               {
+                                   std::atomic<int> count{0};
+                                   TaskGroup outer(pool);
+                                   for (int i = 0; i < 4; ++i)
+                                   {
+                                       outer.run([&pool, &count]
+                                                 {
+                                                     TaskGroup inner(pool);
+                                                     for (int j = 0; j < 4; ++j)
+                                                         inner.run([&count] { count++; });
+                                                     inner.wait();
+                                                 });
+                                   }
+                                   outer.wait();
+                                   return count.load();
+                               });
+    ASSERT_EQ(std::future_status::ready, result.wait_for(std::chrono::seconds(10)));
+    EXPECT_EQ(16, result.get());
+}
+
+TEST(TaskGroup, nestedWaitOnAllThreads)
+{
+    ThreadPool pool(2);
+    std::vector<std::future<int>> results;
+    for (int n = 0; n < 8; ++n)
+    {
+        results.push_back(pool.enqueue([&pool]
+                                       {
+                                           std::atomic<int> count{0};
+                                           TaskGroup group(pool);
+                                           for (int i = 0; i < 16; ++i)
+                                               group.run([&count] { count++; });
+                                           group.wait();
+                                           return count.load();
+                                       }));
+    }
+    for (auto& r : results)
+    {
+        ASSERT_EQ(std::future_status::ready, r.wait_for(std::chrono::seconds(10)));
+        EXPECT_EQ(16, r.get());
+    }
+}
+
+TEST(TaskGroup, exception)
+{
+    ThreadPool pool(2);
+    std::atomic<int> count{0};
+    TaskGroup group(pool);
+    for (int i = 0; i < 10; ++i)
+    {
+        group.run([&count, i]
+                  {
+                      count++;
+                      if (i == 5)
+                          throw std::runtime_error("test");
+                  });
+    }
+    EXPECT_THROW(group.wait(), std::runtime_error);
+
+    // The other tasks aren't cancelled
+    EXPECT_EQ(10, count);
+}
+
+TEST(TaskGroup, destructorWaits)
+{
+    ThreadPool pool(2);
+    std::atomic<int> count{0};
+    {
+        TaskGroup group(pool);
+        for (int i = 0; i < 10; ++i)
+            group.run([&count] { count++; });
+        group.run([] { throw std::runtime_error("dropped"); });
+    }
+    EXPECT_EQ(10, count);
+}
+
+TEST(TaskGroup, reuseAfterWait)
+{
+    ThreadPool pool(2);
+    std::atomic<int> count{0};
+    TaskGroup group(pool);
+    group.run([&count] { count++; });
+    group.wait();
+    group.run([&count] { count++; });
+    group.wait();
+    EXPECT_EQ(2, count);
+}
@@ -0,0 +1,183 @@
+//
+// Created by jan on 19.10.26.
+//
+
+#include <gtest/gtest.h>
+#include <Threading/ThreadPool.h>
+
+namespace
+{
+    /**
+     * Blocks a thread of a pool until it is opened
+     */
+    class Gate
+    {
+    public:
+        void enter()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_entered = true;
+            m_changed.notify_all();
+            m_changed.wait(lock, [this] { return m_open; });
+        }
+
+        void waitEntered()
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_changed.wait(lock, [this] { return m_entered; });
+        }
+
+        void open()
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_open = true;
+            m_changed.notify_all();
+        }
+
+    private:
+        std::mutex m_mutex;
+        std::condition_variable m_changed;
+        bool m_entered = false;
+        bool m_open = false;
+    };
+}
+
+TEST(ThreadPool, enqueue)
+{
+    ThreadPool pool(4);
+    std::vector<std::future<int>> results;
+    for (int i = 0; i < 100; ++i)
+        results.push_back(pool.enqueue([](int a, int b) { return a * b; }, i, 2));
+    for (int i = 0; i < 100; ++i)
+        EXPECT_EQ(2 * i, results[i].get());
+}
+
+TEST(ThreadPool, enqueueMoveOnly)
+{
+    ThreadPool pool(2);
+    auto pValue = std::make_unique<int>(42);
+    auto result = pool.enqueue([](std::unique_ptr<int> p) { return *p; }, std::move(pValue));
+    EXPECT_EQ(42, result.get());
+}
+
+TEST(ThreadPool, enqueueException)
+{
+    ThreadPool pool(2);
+    auto result = pool.enqueue([] { throw std::runtime_error("test"); });
+    EXPECT_THROW(result.get(), std::runtime_error);
+
+    // The thread that ran the job is still alive
+    EXPECT_EQ(1, pool.enqueue([] { return 1; }).get());
+}
+
+TEST(ThreadPool, postException)
+{
+    ThreadPool pool(1);
+    pool.post([] { throw std::runtime_error("test"); });
+    EXPECT_EQ(1, pool.enqueue([] { return 1; }).get());
+}
+
+TEST(ThreadPool, enqueueTo)
+{
+    // The completion queue has to outlive the pool, whose threads may still be inside push()
+    BoundedQueue<int> completed(10);
+    ThreadPool pool(3);
+    for (int i = 1; i <= 10; ++i)
+        pool.enqueueTo(completed, [](int i) { return i; }, i);
+    int sum = 0;
+    for (int i = 0; i < 10; ++i)
+    {
+        int result = 0;
+        ASSERT_TRUE(completed.pop(result));
+        sum += result;
+    }
+    EXPECT_EQ(55, sum);
+}
+
+TEST(ThreadPool, enqueueToException)
+{
+    BoundedQueue<int> completed(1);
+    ThreadPool pool(1);
+    pool.enqueueTo(completed, []() -> int { throw std::runtime_error("test"); });
+    int result = -1;
+    ASSERT_TRUE(completed.pop(result));
+    EXPECT_EQ(0, result);
+}
+
+TEST(ThreadPool, brokenPromiseAtShutdown)
+{
+    // A pool without threads never starts its jobs
+    std::future<int> result;
+    {
+        ThreadPool pool(0);
+        result = pool.enqueue([] { return 1; });
+        EXPECT_EQ(1u, pool.queued());
+    }
+    try
+    {
+        result.get();
+        FAIL() << "Expected a broken promise";
+    }
+    catch (std::future_error const& e)
+    {
+        EXPECT_EQ(std::make_error_code(std::future_errc::broken_promise), e.code());
+    }
+}
+
+TEST(ThreadPool, current)
+{
+    EXPECT_EQ(nullptr, ThreadPool::current());
+    EXPECT_EQ(-1, ThreadPool::currentIndex());
+    ThreadPool pool(2);
+    EXPECT_EQ(&pool, pool.enqueue([] { return ThreadPool::current(); }).get());
+    int const index = pool.enqueue([] { return ThreadPool::currentIndex(); }).get();
+    EXPECT_TRUE(index == 0 || index == 1);
+}
+
+TEST(ThreadPool, maxQueuedBlocksProducers)
+{
+    size_t const maxQueued = 2;
+    ThreadPool pool(1, maxQueued);
+    Gate gate;
+    pool.post([&gate] { gate.enter(); });
+    gate.waitEntered();
+
+    std::vector<std::future<int>> results;
+    for (size_t i = 0; i < maxQueued; ++i)
+        results.push_back(pool.enqueue([] { return 1; }));
+    EXPECT_EQ(maxQueued, pool.queued());
+
+    std::atomic_bool enqueued{false};
+    std::future<int> blocked;
+    std::thread producer([&]
+                         {
+                             blocked = pool.enqueue([] { return 1; });
+                             enqueued = true;
+                         });
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    EXPECT_FALSE(enqueued);
+    EXPECT_EQ(maxQueued, pool.queued());
+
+    gate.open();
+    producer.join();
+    EXPECT_TRUE(enqueued);
+    for (auto& r : results)
+        EXPECT_EQ(1, r.get());
+    EXPECT_EQ(1, blocked.get());
+}
+
+TEST(ThreadPool, maxQueuedDoesntBlockWorkers)
+{
+    size_t const maxQueued = 1;
+    ThreadPool pool(1, maxQueued);
+
+    // Jobs enqueued from within the pool exceed the limit instead of waiting for the only thread
+    auto result = pool.enqueue([&pool]
+                               {
+                                   std::vector<std::future<int>> nested;
+                                   for (int i = 0; i < 10; ++i)
+                                       nested.push_back(pool.enqueue([i] { return i; }));
+                                   return pool.queued();
+                               });
+    EXPECT_EQ(10u, result.get());
+}